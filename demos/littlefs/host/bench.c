@@ -0,0 +1,300 @@
+/*
+ * Small-file benchmark for the SRXE littlefs configuration
+ *
+ * Writes a population of small settings-style files, rewrites each of
+ * them a few times and reads them all back, once for every inline_max in
+ * the sweep. For each run it reports how many blocks the files take, how
+ * often metadata pairs were compacted, the modeled flash time per write
+ * and read, and the time to list the directory with lfs_dir_read and
+ * with lfs_dir_readplus, see flash_emu.h for the timing model.
+ *
+ *     ./bench                  # 24 files of 16..480 bytes, 4 rewrites
+ *     ./bench -N 40 -m 200     # 40 files of 16..200 bytes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "lfs_log.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+// inline_max values to sweep, -1 disables inline files
+static const lfs_size_t sweep[] = {
+    -1, 64, 128, 256, 384, 512,
+};
+#define SWEEP_COUNT (sizeof(sweep)/sizeof(sweep[0]))
+
+#define FILES_MAX 64
+
+// large enough for any inline_max
+static uint8_t file_buffer[1024];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+static uint32_t rng_state;
+static uint32_t rng(void) {
+    // xorshift32
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static void fill(uint8_t *buf, uint32_t seed, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        buf[i] = (uint8_t)(seed*2654435761u >> 24) ^ (uint8_t)i;
+    }
+}
+
+struct result {
+    int stored;
+    lfs_ssize_t blocks;
+    uint32_t compacts;
+    uint32_t erases;
+    uint64_t write_us;
+    uint32_t writes;
+    uint64_t read_us;
+    uint32_t reads;
+    uint64_t list_us;
+    uint64_t listplus_us;
+};
+
+static int write_file(lfs_t *lfs, const char *name,
+        uint32_t seed, uint32_t size) {
+    uint8_t buf[512];
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, name,
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    fill(buf, seed, size);
+    lfs_ssize_t res = lfs_file_write(lfs, &file, buf, size);
+    err = lfs_file_close(lfs, &file);
+    return (res < 0) ? (int)res : err;
+}
+
+static int read_file(lfs_t *lfs, const char *name,
+        uint32_t seed, uint32_t size) {
+    uint8_t buf[512];
+    uint8_t expected[512];
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, name, LFS_O_RDONLY, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    lfs_ssize_t res = lfs_file_read(lfs, &file, buf, sizeof(buf));
+    err = lfs_file_close(lfs, &file);
+    if (res < 0) {
+        return (int)res;
+    }
+
+    fill(expected, seed, size);
+    if ((uint32_t)res != size || memcmp(buf, expected, size) != 0) {
+        return LFS_ERR_CORRUPT;
+    }
+    return err;
+}
+
+static int count_cb(void *data, const struct lfs_info *info) {
+    (void)info;
+    *(int*)data += 1;
+    return 0;
+}
+
+// list the root directory with lfs_dir_read, or lfs_dir_readplus if plus
+static int list(lfs_t *lfs, bool plus, int expected) {
+    lfs_dir_t dir;
+    int err = lfs_dir_open(lfs, &dir, "/");
+    if (err) {
+        return err;
+    }
+
+    int n = 0;
+    if (plus) {
+        err = lfs_dir_readplus(lfs, &dir, count_cb, &n);
+    } else {
+        struct lfs_info info;
+        while ((err = lfs_dir_read(lfs, &dir, &info)) > 0) {
+            n += 1;
+        }
+    }
+
+    int cerr = lfs_dir_close(lfs, &dir);
+    err = err ? err : cerr;
+    if (!err && n != expected+2) {
+        err = LFS_ERR_CORRUPT;
+    }
+    return err;
+}
+
+static int run(lfs_size_t inline_max, uint32_t seed, int count,
+        uint32_t maxsize, int rewrites, struct result *r) {
+    struct lfs_config cfg = srxe_cfg;
+    cfg.inline_max = inline_max;
+
+    uint32_t sizes[FILES_MAX];
+    rng_state = seed*0x9e3779b9u | 1;
+    for (int i = 0; i < count; i++) {
+        sizes[i] = 16 + rng() % (maxsize - 16 + 1);
+    }
+
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    memset(r, 0, sizeof(*r));
+    flash_emu_resetstats();
+    uint32_t compacts = lfs_log_count(LFS_LOG_MD_COMPACT);
+
+    // populate until full
+    char name[8];
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "s%02d", i);
+        uint64_t t = flash_emu_stats.time_us;
+        err = write_file(&lfs, name, i, sizes[i]);
+        if (err == LFS_ERR_NOSPC) {
+            // leave the partial file, it still takes space
+            break;
+        } else if (err) {
+            return err;
+        }
+        r->write_us += flash_emu_stats.time_us - t;
+        r->writes += 1;
+        r->stored += 1;
+    }
+
+    // settings change, same size, new contents
+    for (int j = 0; j < rewrites; j++) {
+        for (int i = 0; i < r->stored; i++) {
+            snprintf(name, sizeof(name), "s%02d", i);
+            uint64_t t = flash_emu_stats.time_us;
+            err = write_file(&lfs, name, i + (j+1)*FILES_MAX, sizes[i]);
+            if (err) {
+                return err;
+            }
+            r->write_us += flash_emu_stats.time_us - t;
+            r->writes += 1;
+        }
+    }
+
+    // read everything back from a fresh mount
+    err = lfs_unmount(&lfs);
+    if (!err) {
+        srxe_bd_reset();
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    for (int i = 0; i < r->stored; i++) {
+        snprintf(name, sizeof(name), "s%02d", i);
+        uint64_t t = flash_emu_stats.time_us;
+        err = read_file(&lfs, name, i + rewrites*FILES_MAX, sizes[i]);
+        if (err) {
+            return err;
+        }
+        r->read_us += flash_emu_stats.time_us - t;
+        r->reads += 1;
+    }
+
+    uint64_t t = flash_emu_stats.time_us;
+    err = list(&lfs, false, r->stored);
+    r->list_us = flash_emu_stats.time_us - t;
+    if (err) {
+        return err;
+    }
+
+    t = flash_emu_stats.time_us;
+    err = list(&lfs, true, r->stored);
+    r->listplus_us = flash_emu_stats.time_us - t;
+    if (err) {
+        return err;
+    }
+
+    r->blocks = lfs_fs_size(&lfs);
+    r->compacts = lfs_log_count(LFS_LOG_MD_COMPACT) - compacts;
+    r->erases = flash_emu_stats.erases;
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-S seed] [-N files] [-m max_size] [-R rewrites]\n"
+            "\n"
+            "  -S  seed for file sizes (1)\n"
+            "  -N  number of files, at most %d (24)\n"
+            "  -m  largest file size, 16..512 (480)\n"
+            "  -R  times every file is rewritten (4)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t seed = 1;
+    int count = 24;
+    uint32_t maxsize = 480;
+    int rewrites = 4;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "S:N:m:R:")) != -1) {
+        switch (opt) {
+            case 'S': seed = strtoul(optarg, NULL, 0); break;
+            case 'N': count = strtol(optarg, NULL, 0); break;
+            case 'm': maxsize = strtoul(optarg, NULL, 0); break;
+            case 'R': rewrites = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 1 || count > FILES_MAX || maxsize < 16 || maxsize > 512
+            || rewrites < 0) {
+        usage(argv[0]);
+    }
+
+    printf("%d files of 16..%"PRIu32" bytes, %d rewrites, %d blocks\n",
+            count, maxsize, rewrites, SRXE_BLOCK_COUNT);
+    printf("%10s %6s %6s %8s %6s %10s %10s %8s %8s\n",
+            "inline_max", "stored", "blocks", "compacts", "erases",
+            "write(ms)", "read(ms)", "ls(ms)", "ls+(ms)");
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        struct result r;
+        int err = run(sweep[i], seed, count, maxsize, rewrites, &r);
+        if (err) {
+            fprintf(stderr, "inline_max %"PRId32": error %d\n",
+                    (int32_t)sweep[i], err);
+            return 1;
+        }
+
+        char label[12];
+        if (sweep[i] == (lfs_size_t)-1) {
+            snprintf(label, sizeof(label), "off");
+        } else {
+            snprintf(label, sizeof(label), "%"PRIu32, sweep[i]);
+        }
+        printf("%10s %6d %6"PRId32" %8"PRIu32" %6"PRIu32" %10.2f %10.2f"
+                " %8.2f %8.2f\n",
+                label, r.stored, r.blocks, r.compacts, r.erases,
+                r.writes ? r.write_us / 1000.0 / r.writes : 0.0,
+                r.reads ? r.read_us / 1000.0 / r.reads : 0.0,
+                r.list_us / 1000.0, r.listplus_us / 1000.0);
+    }
+
+    return 0;
+}
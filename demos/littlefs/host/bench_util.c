@@ -0,0 +1,121 @@
+/*
+ * Shared workload and reporting for the host benchmarks
+ */
+#include "bench_util.h"
+#include "lfs_log.h"
+#include "flash_emu.h"
+
+#include <stdio.h>
+
+
+uint8_t bench_byte(uint32_t seed, uint32_t off) {
+    return (uint8_t)(seed*2654435761u >> 24) ^ (uint8_t)off;
+}
+
+uint32_t bench_file_size(int i, int count, int update) {
+    if (i == count-1) {
+        return 1500;
+    }
+    return 16 + (i*7 + update) % 49;
+}
+
+int bench_file_write(lfs_t *lfs, lfs_file_t *file,
+        int i, int count, int update) {
+    uint8_t buf[256];
+    uint32_t seed = (uint32_t)update*256 + i;
+    uint32_t size = bench_file_size(i, count, update);
+    for (uint32_t off = 0; off < size; off += sizeof(buf)) {
+        uint32_t n = lfs_min(size - off, sizeof(buf));
+        for (uint32_t j = 0; j < n; j++) {
+            buf[j] = bench_byte(seed, off + j);
+        }
+
+        lfs_ssize_t res = lfs_file_write(lfs, file, buf, n);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
+int bench_digest(lfs_t *lfs, const char *dir, int count,
+        const struct lfs_file_config *cfg, uint32_t *crc) {
+    *crc = 0xffffffff;
+    for (int i = 0; i < count; i++) {
+        char path[LFS_NAME_MAX+1];
+        if (dir) {
+            snprintf(path, sizeof(path), "%s/s%02d", dir, i);
+        } else {
+            snprintf(path, sizeof(path), "s%02d", i);
+        }
+
+        lfs_file_t file;
+        int err = lfs_file_opencfg(lfs, &file, path, LFS_O_RDONLY, cfg);
+        if (err) {
+            return err;
+        }
+
+        uint8_t buf[256];
+        lfs_ssize_t res;
+        while ((res = lfs_file_read(lfs, &file, buf, sizeof(buf))) > 0) {
+            *crc = lfs_crc(*crc, buf, res);
+        }
+        lfs_file_close(lfs, &file);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
+void bench_begin(struct bench_result *r) {
+    r->reads = flash_emu_stats.reads;
+    r->read_bytes = flash_emu_stats.read_bytes;
+    r->progs = flash_emu_stats.progs;
+    r->prog_bytes = flash_emu_stats.prog_bytes;
+    r->compacts = lfs_log_count(LFS_LOG_MD_COMPACT);
+    r->time_us = flash_emu_stats.time_us;
+}
+
+void bench_end(struct bench_result *r) {
+    r->reads = flash_emu_stats.reads - r->reads;
+    r->read_bytes = flash_emu_stats.read_bytes - r->read_bytes;
+    r->progs = flash_emu_stats.progs - r->progs;
+    r->prog_bytes = flash_emu_stats.prog_bytes - r->prog_bytes;
+    r->compacts = lfs_log_count(LFS_LOG_MD_COMPACT) - r->compacts;
+    r->time_us = flash_emu_stats.time_us - r->time_us;
+}
+
+void bench_head_reads(const char *op) {
+    char reads[32];
+    char bytes[32];
+    char ms[32];
+    snprintf(reads, sizeof(reads), "reads/%s", op);
+    snprintf(bytes, sizeof(bytes), "read(B)/%s", op);
+    snprintf(ms, sizeof(ms), "ms/%s", op);
+    printf(" %12s %15s %11s", reads, bytes, ms);
+}
+
+void bench_head_progs(const char *op) {
+    char progs[32];
+    char bytes[32];
+    char ms[32];
+    snprintf(progs, sizeof(progs), "progs/%s", op);
+    snprintf(bytes, sizeof(bytes), "prog(B)/%s", op);
+    snprintf(ms, sizeof(ms), "ms/%s", op);
+    printf(" %13s %16s %9s %11s", progs, bytes, "compacts", ms);
+}
+
+void bench_print_reads(const struct bench_result *r, int ops) {
+    printf(" %12.1f %15.1f %11.3f",
+            (double)r->reads / ops, (double)r->read_bytes / ops,
+            r->time_us / 1000.0 / ops);
+}
+
+void bench_print_progs(const struct bench_result *r, int ops) {
+    printf(" %13.1f %16.1f %9"PRIu32" %11.2f",
+            (double)r->progs / ops, (double)r->prog_bytes / ops,
+            r->compacts, r->time_us / 1000.0 / ops);
+}
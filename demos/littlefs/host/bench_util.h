@@ -0,0 +1,71 @@
+/*
+ * Shared workload and reporting for the host benchmarks
+ *
+ * syncbench, txnbench and kvbench each update a set of files, s00, s01,
+ * ..., in two different ways, and check that a remount sees the same
+ * contents after both with bench_digest. What is written is a function
+ * of the file and the update only, see bench_byte, so both ways write
+ * exactly the same data. The flash work of a stretch of a run is measured
+ * with bench_begin and bench_end and printed per operation.
+ */
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdint.h>
+
+#include "lfs.h"
+
+
+// Byte off of the data written with seed, a different pattern for every
+// seed
+uint8_t bench_byte(uint32_t seed, uint32_t off);
+
+// Size of file i of count at an update. The last file is the document,
+// 1500 bytes and outside of its metadata, the rest are settings of
+// 16..64 bytes kept inline.
+uint32_t bench_file_size(int i, int count, int update);
+
+// Write the contents of file i of count at an update, at the file's
+// current position
+//
+// Returns a negative error code on failure.
+int bench_file_write(lfs_t *lfs, lfs_file_t *file,
+        int i, int count, int update);
+
+// CRC of the contents of files s00..s<count-1> in dir, NULL for the root
+//
+// Returns a negative error code on failure.
+int bench_digest(lfs_t *lfs, const char *dir, int count,
+        const struct lfs_file_config *cfg, uint32_t *crc);
+
+
+// Flash work of a stretch of a benchmark, see flash_emu.h
+struct bench_result {
+    uint64_t reads;
+    uint64_t read_bytes;
+    uint64_t progs;
+    uint64_t prog_bytes;
+    uint32_t compacts;
+    uint64_t time_us;
+};
+
+// Start measuring, r holds the totals so far until bench_end
+void bench_begin(struct bench_result *r);
+
+// Stop measuring, leaving the work since bench_begin in r
+void bench_end(struct bench_result *r);
+
+// Print the headings of the read columns, per operation named op
+void bench_head_reads(const char *op);
+
+// Print the headings of the program columns, per operation named op
+void bench_head_progs(const char *op);
+
+// Print the reads, bytes read and time of r, averaged over ops
+void bench_print_reads(const struct bench_result *r, int ops);
+
+// Print the programs, bytes programmed, compactions and time of r,
+// averaged over ops
+void bench_print_progs(const struct bench_result *r, int ops);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Metadata compaction benchmark for lfs_config.compact_buffer
+ *
+ * Fills a directory with small inline files, the way the demo keeps its
+ * settings, then rewrites them until the directory's metadata pair has
+ * been compacted many times. This is run once for every compaction
+ * buffer size in the sweep, from none, where every tag is checked by
+ * rereading the rest of the log, to enough tags to summarize the whole
+ * log in one pass. For each run it reports the flash reads, bytes read
+ * and modeled time of the commits that compacted, see flash_emu.h for
+ * the timing model. Every run must leave behind the same image.
+ *
+ *     ./compactbench           # 24 files of 16..64 bytes, 16 rewrites
+ *     ./compactbench -N 40 -R 4
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "lfs_log.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+// compaction buffer sizes to sweep, in tags
+static const lfs_size_t sweep[] = {
+    0, 16, 64, 256,
+};
+#define SWEEP_COUNT (sizeof(sweep)/sizeof(sweep[0]))
+
+#define FILES_MAX 64
+
+static uint16_t compact_buffer[3*256];
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+// image left behind by the first run, later runs must match it
+static uint8_t image[SRXE_BLOCK_COUNT*SRXE_BLOCK_SIZE];
+
+struct result {
+    uint32_t compacts;
+    uint64_t reads;
+    uint64_t read_bytes;
+    uint64_t time_us;
+};
+
+static int write_file(lfs_t *lfs, const char *name,
+        uint32_t seed, uint32_t size) {
+    uint8_t buf[64];
+    for (uint32_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)(seed*2654435761u >> 24) ^ (uint8_t)i;
+    }
+
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, name,
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    lfs_ssize_t res = lfs_file_write(lfs, &file, buf, size);
+    err = lfs_file_close(lfs, &file);
+    return (res < 0) ? (int)res : err;
+}
+
+static int run(lfs_size_t tags, int count, uint32_t maxsize, int rewrites,
+        struct result *r) {
+    struct lfs_config cfg = srxe_cfg;
+    cfg.compact_buffer = tags ? compact_buffer : NULL;
+    cfg.compact_size = tags*sizeof(uint16_t[3]);
+
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    memset(r, 0, sizeof(*r));
+    char name[12];
+    for (int j = 0; j <= rewrites; j++) {
+        for (int i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "s%02d", i);
+            uint32_t compacts = lfs_log_count(LFS_LOG_MD_COMPACT);
+            struct flash_emu_stats before = flash_emu_stats;
+            err = write_file(&lfs, name, i + j*FILES_MAX,
+                    16 + (i*7 + j) % (maxsize - 16 + 1));
+            if (err) {
+                return err;
+            }
+
+            // only count the commits that compacted
+            if (lfs_log_count(LFS_LOG_MD_COMPACT) != compacts) {
+                r->compacts += lfs_log_count(LFS_LOG_MD_COMPACT) - compacts;
+                r->reads += flash_emu_stats.reads - before.reads;
+                r->read_bytes += flash_emu_stats.read_bytes
+                        - before.read_bytes;
+                r->time_us += flash_emu_stats.time_us - before.time_us;
+            }
+        }
+    }
+
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-N files] [-m max_size] [-R rewrites]\n"
+            "\n"
+            "  -N  number of files, at most %d (24)\n"
+            "  -m  largest file size, 16..64 (64)\n"
+            "  -R  times every file is rewritten (16)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int count = 24;
+    uint32_t maxsize = 64;
+    int rewrites = 16;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:m:R:")) != -1) {
+        switch (opt) {
+            case 'N': count = strtol(optarg, NULL, 0); break;
+            case 'm': maxsize = strtoul(optarg, NULL, 0); break;
+            case 'R': rewrites = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 1 || count > FILES_MAX || maxsize < 16 || maxsize > 64
+            || rewrites < 0) {
+        usage(argv[0]);
+    }
+
+    printf("%d files of 16..%"PRIu32" bytes, %d rewrites\n",
+            count, maxsize, rewrites);
+    printf("%-8s %6s %8s %10s %9s %12s\n",
+            "tags", "RAM(B)", "compacts", "reads", "read(KiB)",
+            "ms/compact");
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        struct result r;
+        int err = run(sweep[i], count, maxsize, rewrites, &r);
+        if (err) {
+            fprintf(stderr, "%"PRIu32" tags: error %d\n", sweep[i], err);
+            return 1;
+        }
+
+        if (i == 0) {
+            memcpy(image, flash_emu_mem, sizeof(image));
+        } else if (memcmp(image, flash_emu_mem, sizeof(image)) != 0) {
+            fprintf(stderr, "%"PRIu32" tags: image differs\n", sweep[i]);
+            return 1;
+        }
+
+        char label[12];
+        if (sweep[i]) {
+            snprintf(label, sizeof(label), "%"PRIu32, sweep[i]);
+        } else {
+            snprintf(label, sizeof(label), "rescan");
+        }
+        printf("%-8s %6zu %8"PRIu32" %10"PRIu64" %9.1f %12.2f\n",
+                label, (size_t)sweep[i]*sizeof(uint16_t[3]), r.compacts,
+                r.reads, r.read_bytes / 1024.0,
+                r.compacts ? r.time_us / 1000.0 / r.compacts : 0.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Skipped erase benchmark for srxe_erase
+ *
+ * Takes a new, all 0xff chip through the life of the demo: format and
+ * fill it with files, rewrite every file a few times, then power cycle,
+ * forgetting which sectors are blank, and rewrite them again. Files are
+ * written with lfs_file_write_nb, which erases a block ahead of time that
+ * is given back when the file ends before using it. For each phase it
+ * reports the erases littlefs asked for, how many of them were skipped
+ * because the sector was already blank, and the modeled time of the
+ * phase, see flash_emu.h for the timing model.
+ *
+ * The Makefile builds this as erasebench, with the device's blank sectors
+ * known in RAM only, as erasebench-blankcheck, with SRXE_BLANK_CHECK, and
+ * as erasebench-noblank, with SRXE_NO_BLANK, which erases every time.
+ *
+ *     ./erasebench             # 8 files of 8000 bytes, 4 rewrites
+ *     ./erasebench-noblank -N 4 -s 16000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "lfs_log.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+enum {
+    PHASE_FILL,
+    PHASE_REWRITE,
+    PHASE_REMOUNT,
+    PHASE_COUNT,
+};
+
+static const char *const phase_names[PHASE_COUNT] = {
+    "format+fill", "rewrite", "power cycle",
+};
+
+#define FILES_MAX 16
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+struct result {
+    uint32_t erases;
+    uint32_t skipped;
+    uint64_t time_us;
+};
+
+static struct result phase_start(void) {
+    struct result r = {
+        .erases = lfs_log_count(LFS_LOG_BD_ERASE),
+        .skipped = lfs_log_count(LFS_LOG_BD_SKIP),
+        .time_us = flash_emu_stats.time_us,
+    };
+    return r;
+}
+
+static void phase_end(struct result *r) {
+    r->erases = lfs_log_count(LFS_LOG_BD_ERASE) - r->erases;
+    r->skipped = lfs_log_count(LFS_LOG_BD_SKIP) - r->skipped;
+    r->time_us = flash_emu_stats.time_us - r->time_us;
+}
+
+static int write_file(lfs_t *lfs, int i, uint32_t seed, uint32_t size) {
+    char name[12];
+    snprintf(name, sizeof(name), "f%02d", i);
+
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, name,
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[256];
+    for (uint32_t off = 0; off < size; off += sizeof(buf)) {
+        uint32_t n = lfs_min(sizeof(buf), size - off);
+        for (uint32_t j = 0; j < n; j++) {
+            buf[j] = (uint8_t)(seed*2654435761u >> 24) ^ (uint8_t)(off + j);
+        }
+
+        const uint8_t *p = buf;
+        while (n > 0) {
+            lfs_ssize_t res = lfs_file_write_nb(lfs, &file, p, n);
+            if (res == LFS_ERR_INPROGRESS) {
+                // the event loop gets a turn while the erase runs
+                flash_emu_idle(1000);
+                continue;
+            } else if (res < 0) {
+                lfs_file_close(lfs, &file);
+                return res;
+            }
+            p += res;
+            n -= res;
+        }
+    }
+
+    return lfs_file_close(lfs, &file);
+}
+
+static int rewrite(lfs_t *lfs, int count, uint32_t size, int rewrites,
+        uint32_t *seed) {
+    for (int j = 0; j < rewrites; j++) {
+        for (int i = 0; i < count; i++) {
+            int err = write_file(lfs, i, (*seed)++, size);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int run(int count, uint32_t size, int rewrites,
+        struct result r[PHASE_COUNT]) {
+    flash_emu_reset();
+    srxe_bd_reset();
+    uint32_t seed = 1;
+    lfs_t lfs;
+
+    r[PHASE_FILL] = phase_start();
+    int err = lfs_format(&lfs, &srxe_cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (!err) {
+        err = rewrite(&lfs, count, size, 1, &seed);
+    }
+    if (err) {
+        return err;
+    }
+    phase_end(&r[PHASE_FILL]);
+
+    r[PHASE_REWRITE] = phase_start();
+    err = rewrite(&lfs, count, size, rewrites, &seed);
+    if (!err) {
+        err = lfs_unmount(&lfs);
+    }
+    if (err) {
+        return err;
+    }
+    phase_end(&r[PHASE_REWRITE]);
+
+    r[PHASE_REMOUNT] = phase_start();
+    srxe_bd_reset();
+    err = lfs_mount(&lfs, &srxe_cfg);
+    if (!err) {
+        err = rewrite(&lfs, count, size, rewrites, &seed);
+    }
+    if (!err) {
+        err = lfs_unmount(&lfs);
+    }
+    if (err) {
+        return err;
+    }
+    phase_end(&r[PHASE_REMOUNT]);
+
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-N files] [-s size] [-R rewrites]\n"
+            "\n"
+            "  -N  number of files, at most %d (8)\n"
+            "  -s  size of each file in bytes (8000)\n"
+            "  -R  times every file is rewritten per phase (4)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int count = 8;
+    uint32_t size = 8000;
+    int rewrites = 4;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:s:R:")) != -1) {
+        switch (opt) {
+            case 'N': count = strtol(optarg, NULL, 0); break;
+            case 's': size = strtoul(optarg, NULL, 0); break;
+            case 'R': rewrites = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 1 || count > FILES_MAX || rewrites < 0) {
+        usage(argv[0]);
+    }
+
+    struct result r[PHASE_COUNT];
+    int err = run(count, size, rewrites, r);
+    if (err) {
+        fprintf(stderr, "error %d\n", err);
+        return 1;
+    }
+
+#if defined(SRXE_NO_BLANK)
+    const char *mode = "always erase";
+#elif defined(SRXE_BLANK_CHECK)
+    const char *mode = "skip blank, check after reset";
+#else
+    const char *mode = "skip blank";
+#endif
+    printf("%s: %d files of %"PRIu32" bytes, %d rewrites\n",
+            mode, count, size, rewrites);
+    printf("%-12s %7s %7s %10s\n", "phase", "erases", "skipped", "time(ms)");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        printf("%-12s %7"PRIu32" %7"PRIu32" %10.1f\n",
+                phase_names[i], r[i].erases, r[i].skipped,
+                r[i].time_us / 1000.0);
+    }
+
+    return 0;
+}
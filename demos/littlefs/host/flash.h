@@ -0,0 +1,28 @@
+/*
+ * Host stand-in for srxecore's flash driver, implemented by flash_emu.c
+ */
+#ifndef FLASH_H
+#define FLASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool flashRead(uint32_t addr, uint8_t *buffer, uint32_t size);
+bool flashWritePage(uint32_t addr, uint8_t *buffer);
+bool flashEraseSector(uint32_t addr, uint8_t wait);
+
+// The emulator can tell when an erase started without waiting is done,
+// the host build uses this as SRXE_FLASH_BUSY, see srxe_bd.h
+bool flash_emu_busy(void);
+
+// Programs of part of a page, the host build uses this as
+// SRXE_FLASH_PROG, see srxe_bd.h
+bool flash_emu_prog(uint32_t addr, const uint8_t *buffer, uint32_t size);
+
+// Continuous reads with chip select held between transfers, the host
+// build uses these as SRXE_FLASH_STREAM_*, see srxe_bd.h
+bool flash_emu_stream_begin(uint32_t addr);
+bool flash_emu_stream_read(uint8_t *buffer, uint32_t size);
+void flash_emu_stream_end(void);
+
+#endif
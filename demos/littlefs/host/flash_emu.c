@@ -0,0 +1,212 @@
+/*
+ * Emulated SPI NOR flash for running the SRXE block device on the host
+ */
+#include <string.h>
+
+#include "flash.h"
+#include "flash_emu.h"
+
+uint8_t flash_emu_mem[FLASH_EMU_SIZE];
+struct flash_emu_stats flash_emu_stats;
+uint32_t flash_emu_ops;
+
+static uint32_t flash_emu_cut_at;
+static bool flash_emu_torn;
+static jmp_buf *flash_emu_jmp;
+static uint8_t flash_emu_bad[FLASH_EMU_SIZE/FLASH_EMU_SECTOR/8];
+static uint64_t flash_emu_busy_until;
+static bool flash_emu_streaming;
+static uint32_t flash_emu_stream_addr;
+
+void flash_emu_reset(void) {
+    memset(flash_emu_mem, 0xff, sizeof(flash_emu_mem));
+    flash_emu_streaming = false;
+    flash_emu_resetstats();
+    flash_emu_disarm();
+    memset(flash_emu_bad, 0, sizeof(flash_emu_bad));
+    flash_emu_ops = 0;
+}
+
+void flash_emu_resetstats(void) {
+    memset(&flash_emu_stats, 0, sizeof(flash_emu_stats));
+    flash_emu_busy_until = 0;
+}
+
+bool flash_emu_busy(void) {
+    return flash_emu_stats.time_us < flash_emu_busy_until;
+}
+
+void flash_emu_idle(uint32_t us) {
+    flash_emu_stats.time_us += us;
+}
+
+// like the real driver, wait for an erase in flight before any command
+static void flash_emu_wait(void) {
+    if (flash_emu_busy()) {
+        flash_emu_stats.time_us = flash_emu_busy_until;
+    }
+}
+
+void flash_emu_cut(uint32_t n, bool torn, jmp_buf *jmp) {
+    flash_emu_cut_at = flash_emu_ops + n;
+    flash_emu_torn = torn;
+    flash_emu_jmp = jmp;
+}
+
+void flash_emu_disarm(void) {
+    flash_emu_jmp = NULL;
+}
+
+void flash_emu_setbad(uint32_t sector, bool bad) {
+    if (sector >= FLASH_EMU_SIZE/FLASH_EMU_SECTOR) {
+        return;
+    }
+
+    if (bad) {
+        flash_emu_bad[sector / 8] |= 1U << (sector % 8);
+    } else {
+        flash_emu_bad[sector / 8] &= ~(1U << (sector % 8));
+    }
+}
+
+static bool flash_emu_isbad(uint32_t addr) {
+    uint32_t sector = addr / FLASH_EMU_SECTOR;
+    return flash_emu_bad[sector / 8] & (1U << (sector % 8));
+}
+
+// returns true if power should be lost during this operation
+static bool flash_emu_cutting(void) {
+    flash_emu_ops += 1;
+    return flash_emu_jmp && flash_emu_ops == flash_emu_cut_at;
+}
+
+static void flash_emu_powerloss(void) {
+    flash_emu_streaming = false;
+    jmp_buf *jmp = flash_emu_jmp;
+    flash_emu_jmp = NULL;
+    longjmp(*jmp, 1);
+}
+
+bool flashRead(uint32_t addr, uint8_t *buffer, uint32_t size) {
+    if (flash_emu_streaming
+            || addr > FLASH_EMU_SIZE || size > FLASH_EMU_SIZE - addr) {
+        return false;
+    }
+
+    flash_emu_wait();
+
+    memcpy(buffer, &flash_emu_mem[addr], size);
+    flash_emu_stats.reads += 1;
+    flash_emu_stats.read_bytes += size;
+    flash_emu_stats.time_us += FLASH_EMU_T_CMD + size*FLASH_EMU_T_BYTE;
+    return true;
+}
+
+// a partial program is charged for the bytes sent
+bool flash_emu_prog(uint32_t addr, const uint8_t *buffer, uint32_t size) {
+    if (flash_emu_streaming || addr >= FLASH_EMU_SIZE
+            || size > FLASH_EMU_PAGE - addr % FLASH_EMU_PAGE) {
+        return false;
+    }
+
+    flash_emu_wait();
+
+    uint32_t xfer = size;
+    bool cut = flash_emu_cutting();
+    if (cut) {
+        if (!flash_emu_torn) {
+            flash_emu_powerloss();
+        }
+        size /= 2;
+    }
+
+    // programming can only clear bits, and not even that on bad sectors
+    uint8_t stuck = flash_emu_isbad(addr) ? 0x01 : 0x00;
+    for (uint32_t i = 0; i < size; i++) {
+        flash_emu_mem[addr+i] &= buffer[i] | stuck;
+    }
+
+    if (cut) {
+        flash_emu_powerloss();
+    }
+
+    flash_emu_stats.progs += 1;
+    flash_emu_stats.prog_bytes += xfer;
+    flash_emu_stats.time_us += FLASH_EMU_T_CMD
+            + xfer*FLASH_EMU_T_BYTE + FLASH_EMU_T_PROG;
+    return true;
+}
+
+bool flashWritePage(uint32_t addr, uint8_t *buffer) {
+    if (addr % FLASH_EMU_PAGE != 0) {
+        return false;
+    }
+
+    return flash_emu_prog(addr, buffer, FLASH_EMU_PAGE);
+}
+
+bool flashEraseSector(uint32_t addr, uint8_t wait) {
+    if (flash_emu_streaming
+            || addr % FLASH_EMU_SECTOR != 0 || addr >= FLASH_EMU_SIZE) {
+        return false;
+    }
+
+    flash_emu_wait();
+
+    uint32_t size = FLASH_EMU_SECTOR;
+    bool cut = flash_emu_cutting();
+    if (cut) {
+        if (!flash_emu_torn) {
+            flash_emu_powerloss();
+        }
+        size /= 2;
+    }
+
+    memset(&flash_emu_mem[addr], 0xff, size);
+
+    if (cut) {
+        flash_emu_powerloss();
+    }
+
+    flash_emu_stats.erases += 1;
+    if (wait) {
+        flash_emu_stats.time_us += FLASH_EMU_T_CMD + FLASH_EMU_T_ERASE;
+    } else {
+        // the erase finishes while the caller gets on with other work
+        flash_emu_stats.time_us += FLASH_EMU_T_CMD;
+        flash_emu_busy_until = flash_emu_stats.time_us + FLASH_EMU_T_ERASE;
+    }
+    return true;
+}
+
+// a stream costs one command up front, then only the bytes clocked out,
+// any other command while it is open fails as it would on the bus
+bool flash_emu_stream_begin(uint32_t addr) {
+    if (flash_emu_streaming || addr >= FLASH_EMU_SIZE) {
+        return false;
+    }
+
+    flash_emu_wait();
+    flash_emu_streaming = true;
+    flash_emu_stream_addr = addr;
+    flash_emu_stats.reads += 1;
+    flash_emu_stats.time_us += FLASH_EMU_T_CMD;
+    return true;
+}
+
+bool flash_emu_stream_read(uint8_t *buffer, uint32_t size) {
+    uint32_t addr = flash_emu_stream_addr;
+    if (!flash_emu_streaming || size > FLASH_EMU_SIZE - addr) {
+        return false;
+    }
+
+    memcpy(buffer, &flash_emu_mem[addr], size);
+    flash_emu_stream_addr += size;
+    flash_emu_stats.read_bytes += size;
+    flash_emu_stats.time_us += size*FLASH_EMU_T_BYTE;
+    return true;
+}
+
+void flash_emu_stream_end(void) {
+    flash_emu_streaming = false;
+}
@@ -0,0 +1,68 @@
+/*
+ * Emulated SPI NOR flash for running the SRXE block device on the host
+ *
+ * Programs can only clear bits and erases set a whole sector back to 0xff,
+ * like the real part. Every operation is counted and charged a modeled
+ * device time, and a power cut can be armed to abort the Nth program or
+ * erase, optionally leaving it half done. Sectors can also be marked bad,
+ * after which programs to them fail to clear the low bit of each byte.
+ */
+#ifndef FLASH_EMU_H
+#define FLASH_EMU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+#define FLASH_EMU_SIZE      (512*1024)
+#define FLASH_EMU_PAGE      256
+#define FLASH_EMU_SECTOR    4096
+
+// Modeled timings in microseconds, roughly a 4 Mbit SPI NOR part on the
+// ATmega128RFA1's 8 MHz SPI bus
+#define FLASH_EMU_T_CMD     5       // command + address
+#define FLASH_EMU_T_BYTE    1       // per byte transferred
+#define FLASH_EMU_T_PROG    1500    // page program
+#define FLASH_EMU_T_ERASE   50000   // sector erase
+
+struct flash_emu_stats {
+    uint64_t reads;
+    uint64_t read_bytes;
+    uint64_t progs;
+    uint64_t prog_bytes;
+    uint64_t erases;
+    uint64_t time_us;
+};
+
+extern uint8_t flash_emu_mem[FLASH_EMU_SIZE];
+extern struct flash_emu_stats flash_emu_stats;
+
+// Number of programs + erases since the last flash_emu_reset
+extern uint32_t flash_emu_ops;
+
+// Erase everything, clear stats, bad sectors and disarm any power cut
+void flash_emu_reset(void);
+
+// Clear stats only
+void flash_emu_resetstats(void);
+
+// Arm a power cut on the nth program or erase from now, counting from 1.
+// If torn is set the interrupted operation is partially applied. The cut
+// longjmps to jmp, which must stay valid until it fires or is disarmed.
+void flash_emu_cut(uint32_t n, bool torn, jmp_buf *jmp);
+
+// Disarm any pending power cut
+void flash_emu_disarm(void);
+
+// Make programs to a sector silently leave stuck bits behind, as a worn
+// out sector would, or repair it again
+void flash_emu_setbad(uint32_t sector, bool bad);
+
+// Whether an erase started without waiting is still running, every other
+// command waits for it first, charging the remaining time
+bool flash_emu_busy(void);
+
+// Charge time spent on other work, an erase in flight runs concurrently
+void flash_emu_idle(uint32_t us);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Settings benchmark for the lfs_kv key-value store
+ *
+ * Keeps the demo's small settings, 8..48 bytes each, in a directory, and
+ * reads all of them back and changes a few at a time the way the demo
+ * saves a settings screen. This is run once with a file for every
+ * setting, opened, read or written and closed each time, and once with
+ * lfs_kv, which looks keys up in the directory's metadata pair and
+ * commits the settings changed together in one batch. For each it
+ * reports the flash reads, bytes read and modeled time per get, and the
+ * programs, bytes programmed, compactions and modeled time per save of
+ * a batch, see flash_emu.h for the timing model and bench_util.h for the
+ * check that both runs leave behind the same settings.
+ *
+ *     ./kvbench                # 24 settings, 4 a save, 64 saves
+ *     ./kvbench -N 48 -B 8 -R 16
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+#include "bench_util.h"
+
+
+#define KEYS_MAX 64
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+static char names[KEYS_MAX][12];
+static char paths[KEYS_MAX][16];
+static uint8_t values[KEYS_MAX][48];
+static lfs_size_t sizes[KEYS_MAX];
+
+static void value_fill(int i, int save) {
+    sizes[i] = 8 + (i*7 + save) % 41;
+    for (lfs_size_t j = 0; j < sizes[i]; j++) {
+        values[i][j] = bench_byte((uint32_t)save*256 + i, j);
+    }
+}
+
+static int file_put(lfs_t *lfs, int i) {
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, paths[i],
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    lfs_ssize_t res = lfs_file_write(lfs, &file, values[i], sizes[i]);
+    err = lfs_file_close(lfs, &file);
+    return (res < 0) ? (int)res : err;
+}
+
+static lfs_ssize_t file_get(lfs_t *lfs, int i, void *buf, lfs_size_t size) {
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, paths[i], LFS_O_RDONLY,
+            &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    lfs_ssize_t res = lfs_file_read(lfs, &file, buf, size);
+    err = lfs_file_close(lfs, &file);
+    return (res < 0) ? res : err ? err : res;
+}
+
+// change count settings, starting after the ones the last save changed
+static int save(lfs_t *lfs, lfs_kv_t *kv, int keys, int count, int s) {
+    for (int j = 0; j < count; j++) {
+        int i = (s*count + j) % keys;
+        value_fill(i, s);
+        int err = kv
+                ? lfs_kv_put(lfs, kv, names[i], values[i], sizes[i])
+                : file_put(lfs, i);
+        if (err) {
+            return err;
+        }
+    }
+
+    return kv ? lfs_kv_commit(lfs, kv) : 0;
+}
+
+static int run(bool use_kv, int keys, int count, int saves,
+        struct bench_result *get, struct bench_result *put, uint32_t *crc) {
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &srxe_cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    // opening the store creates the directory for the files too
+    lfs_kv_t kv;
+    err = lfs_kv_open(&lfs, &kv, "set");
+    if (err) {
+        return err;
+    }
+
+    // every setting exists before measuring
+    for (int i = 0; i < keys && !err; i += count) {
+        err = save(&lfs, use_kv ? &kv : NULL, keys, count, i / count);
+    }
+    if (err) {
+        return err;
+    }
+
+    bench_begin(put);
+    for (int s = 0; s < saves; s++) {
+        err = save(&lfs, use_kv ? &kv : NULL, keys, count, s);
+        if (err) {
+            return err;
+        }
+    }
+    bench_end(put);
+
+    // read every setting, checking it against the last save
+    bench_begin(get);
+    for (int i = 0; i < keys; i++) {
+        uint8_t buf[48];
+        lfs_ssize_t res = use_kv
+                ? lfs_kv_get(&lfs, &kv, names[i], buf, sizeof(buf))
+                : file_get(&lfs, i, buf, sizeof(buf));
+        if (res < 0) {
+            return res;
+        }
+        if ((lfs_size_t)res != sizes[i] || memcmp(buf, values[i], res)) {
+            return LFS_ERR_CORRUPT;
+        }
+    }
+    bench_end(get);
+
+    err = lfs_kv_close(&lfs, &kv);
+    if (err) {
+        return err;
+    }
+
+    // check what a remount sees
+    err = lfs_unmount(&lfs);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (!err) {
+        err = bench_digest(&lfs, "set", keys, &file_cfg, crc);
+    }
+    if (err) {
+        return err;
+    }
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-N settings] [-B batch] [-R saves]\n"
+            "\n"
+            "  -N  number of settings, 1..%d (24)\n"
+            "  -B  settings changed by each save, 1..%d (4)\n"
+            "  -R  number of saves (64)\n",
+            name, KEYS_MAX, LFS_KV_BATCH_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int keys = 24;
+    int count = 4;
+    int saves = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:B:R:")) != -1) {
+        switch (opt) {
+            case 'N': keys = strtol(optarg, NULL, 0); break;
+            case 'B': count = strtol(optarg, NULL, 0); break;
+            case 'R': saves = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (keys < 1 || keys > KEYS_MAX || count < 1
+            || count > LFS_KV_BATCH_MAX || count > keys || saves < 1) {
+        usage(argv[0]);
+    }
+
+    for (int i = 0; i < keys; i++) {
+        snprintf(names[i], sizeof(names[i]), "s%02d", i);
+        snprintf(paths[i], sizeof(paths[i]), "set/%s", names[i]);
+    }
+
+    printf("%d settings, %d a save, %d saves\n", keys, count, saves);
+    printf("%-5s", "store");
+    bench_head_reads("get");
+    bench_head_progs("save");
+    printf("\n");
+    uint32_t crcs[2];
+    for (int use_kv = 0; use_kv < 2; use_kv++) {
+        struct bench_result get;
+        struct bench_result put;
+        int err = run(use_kv, keys, count, saves, &get, &put,
+                &crcs[use_kv]);
+        if (err) {
+            fprintf(stderr, "%s: error %d\n", use_kv ? "kv" : "files", err);
+            return 1;
+        }
+
+        printf("%-5s", use_kv ? "kv" : "files");
+        bench_print_reads(&get, keys);
+        bench_print_progs(&put, saves);
+        printf("\n");
+    }
+
+    if (crcs[0] != crcs[1]) {
+        fprintf(stderr, "settings differ\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""
+Decode binary lfs_log records captured from the SRXE.
+
+The input is a raw dump of struct lfs_log_record, as produced by
+lfs_log_drain, 12 bytes per record, little-endian.
+
+    ./lfs_log_decode.py log.bin
+    ./lfs_log_decode.py --summary log.bin
+"""
+import argparse
+import collections
+import struct
+import sys
+
+RECORD = struct.Struct("<IBBHHH")
+
+# must match enum lfs_log_event in src/lfs_log.h
+EVENTS = {
+    1: "read",
+    2: "prog",
+    3: "erase",
+    4: "sync",
+    5: "bad",
+    6: "compact",
+    7: "skip",
+    8: "relocate",
+}
+
+LEVELS = ["trace", "debug", "info", "warn", "error"]
+
+
+def records(data):
+    for i in range(len(data) // RECORD.size):
+        yield RECORD.unpack_from(data, i * RECORD.size)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+            formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("path", help="binary log dump, '-' for stdin")
+    parser.add_argument("-s", "--summary", action="store_true",
+            help="print per-event totals instead of every record")
+    args = parser.parse_args()
+
+    if args.path == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.path, "rb") as f:
+            data = f.read()
+
+    if len(data) % RECORD.size:
+        print("warning: %d trailing bytes ignored" % (len(data) % RECORD.size),
+                file=sys.stderr)
+
+    counts = collections.Counter()
+    sizes = collections.Counter()
+    for time, event, level, block, off, size in records(data):
+        name = EVENTS.get(event, "event%d" % event)
+        if args.summary:
+            counts[name] += 1
+            sizes[name] += size
+        else:
+            lname = LEVELS[level] if level < len(LEVELS) else str(level)
+            print("%10d %-5s %-6s block %5d off %5d size %5d"
+                    % (time, lname, name, block, off, size))
+
+    if args.summary:
+        for name in sorted(counts):
+            print("%-6s %8d ops %10d bytes" % (name, counts[name], sizes[name]))
+
+
+if __name__ == "__main__":
+    main()
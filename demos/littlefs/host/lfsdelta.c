@@ -0,0 +1,331 @@
+/*
+ * Make and apply delta updates between SRXE littlefs images
+ *
+ * A delta carries only the blocks that are live in the new image and
+ * differ from the old one, see src/srxe_delta.h for the format. Blocks
+ * that are free in the old image are written first, so the old
+ * filesystem stays intact for as long as possible, and the superblock
+ * pair goes last. Every delta is checked by applying it to the old image
+ * on emulated flash with the same applier the SRXE runs.
+ *
+ *     ./lfsdelta old.bin new.bin update.delta  # make a delta
+ *     ./lfsdelta -a dev.bin update.delta       # apply it to an image
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "srxe_delta.h"
+#include "flash_emu.h"
+
+
+#define IMAGE_SIZE (SRXE_BLOCK_COUNT*SRXE_BLOCK_SIZE)
+
+static struct lfs_config cfg;
+static uint8_t page_buffer[SRXE_PAGE_SIZE];
+
+static uint8_t *load(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    rewind(f);
+    uint8_t *buf = malloc(n > 0 ? n : 1);
+    if (!buf || fread(buf, 1, n, f) != (size_t)n) {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+
+    fclose(f);
+    *size = n;
+    return buf;
+}
+
+static int store(const char *path, const uint8_t *buf, size_t size) {
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(buf, 1, size, f) != size || fclose(f) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+// put an image on the emulated flash, without any wear or bad block state
+static void flash(const uint8_t *image) {
+    flash_emu_reset();
+    srxe_bd_reset();
+    memcpy(flash_emu_mem, image, IMAGE_SIZE);
+}
+
+static int mark(void *p, lfs_block_t block) {
+    uint8_t *live = p;
+    if (block < SRXE_BLOCK_COUNT) {
+        live[block] = 1;
+    }
+    return 0;
+}
+
+// find the blocks in use by an image
+static int live_blocks(const uint8_t *image, uint8_t live[SRXE_BLOCK_COUNT]) {
+    flash(image);
+    memset(live, 0, SRXE_BLOCK_COUNT);
+
+    lfs_t lfs;
+    int err = lfs_mount(&lfs, &cfg);
+    if (err) {
+        return err;
+    }
+
+    err = lfs_fs_traverse(&lfs, mark, live);
+    lfs_unmount(&lfs);
+    return err;
+}
+
+static bool blank(const uint8_t *page) {
+    for (int i = 0; i < SRXE_PAGE_SIZE; i++) {
+        if (page[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void put16(uint8_t *p, uint16_t x) {
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t x) {
+    put16(p, x);
+    put16(p+2, x >> 16);
+}
+
+// feed a delta to the applier in small pieces, as a serial link would
+static int apply(const uint8_t *delta, size_t size) {
+    struct srxe_delta d;
+    srxe_delta_init(&d, &cfg, page_buffer);
+    for (size_t off = 0; off < size; off += 64) {
+        size_t n = size - off < 64 ? size - off : 64;
+        int err = srxe_delta_feed(&d, &delta[off], n);
+        if (err) {
+            return err;
+        }
+    }
+
+    return srxe_delta_finish(&d);
+}
+
+static size_t make(const uint8_t *old, const uint8_t *new, uint8_t *delta,
+        int *changed, int *live) {
+    uint8_t newlive[SRXE_BLOCK_COUNT];
+    uint8_t oldlive[SRXE_BLOCK_COUNT];
+    int err = live_blocks(new, newlive);
+    if (err) {
+        fprintf(stderr, "new image does not mount (%d)\n", err);
+        exit(1);
+    }
+    if (live_blocks(old, oldlive)) {
+        // no telling what's free, treat everything as live
+        memset(oldlive, 1, sizeof(oldlive));
+    }
+
+    uint8_t keep[SRXE_DELTA_KEEP_SIZE] = {0};
+    uint8_t rank[SRXE_BLOCK_COUNT];
+    *live = 0;
+    for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+        if (!newlive[b]) {
+            continue;
+        }
+
+        *live += 1;
+        if (memcmp(&old[b*SRXE_BLOCK_SIZE], &new[b*SRXE_BLOCK_SIZE],
+                SRXE_BLOCK_SIZE) == 0) {
+            keep[b / 8] |= 1U << (b % 8);
+        }
+
+        // free in the old image first, then live, then the superblock
+        rank[b] = (b < 2) ? 2 : oldlive[b] ? 1 : 0;
+    }
+
+    // blocks to rewrite, in the order they are written
+    lfs_block_t order[SRXE_BLOCK_COUNT];
+    int count = 0;
+    for (int r = 0; r < 3; r++) {
+        for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+            if (newlive[b] && rank[b] == r
+                    && !(keep[b / 8] & (1U << (b % 8)))) {
+                order[count++] = b;
+            }
+        }
+    }
+    *changed = count;
+
+    // header
+    uint8_t *p = delta;
+    put32(&p[0], SRXE_DELTA_MAGIC);
+    put32(&p[4], SRXE_BLOCK_SIZE);
+    put16(&p[8], SRXE_PAGE_SIZE);
+    put16(&p[10], SRXE_BLOCK_COUNT);
+    put16(&p[12], count);
+    put16(&p[14], 0);
+    memcpy(&p[16], keep, sizeof(keep));
+    uint32_t base = 0xffffffff;
+    for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+        if (keep[b / 8] & (1U << (b % 8))) {
+            base = lfs_crc(base, &old[b*SRXE_BLOCK_SIZE], SRXE_BLOCK_SIZE);
+        }
+    }
+    put32(&p[SRXE_DELTA_HEADER_SIZE-8], base);
+    put32(&p[SRXE_DELTA_HEADER_SIZE-4],
+            lfs_crc(0xffffffff, p, SRXE_DELTA_HEADER_SIZE-4));
+    p += SRXE_DELTA_HEADER_SIZE;
+
+    // records, skipping pages that are blank after the erase
+    for (int i = 0; i < count; i++) {
+        const uint8_t *block = &new[order[i]*SRXE_BLOCK_SIZE];
+        uint16_t pages = 0;
+        for (int j = 0; j < SRXE_DELTA_PAGES; j++) {
+            if (!blank(&block[j*SRXE_PAGE_SIZE])) {
+                pages |= 1U << j;
+            }
+        }
+
+        uint8_t *record = p;
+        put16(&p[0], order[i]);
+        put16(&p[2], pages);
+        p += SRXE_DELTA_RECORD_SIZE;
+        for (int j = 0; j < SRXE_DELTA_PAGES; j++) {
+            if (pages & (1U << j)) {
+                memcpy(p, &block[j*SRXE_PAGE_SIZE], SRXE_PAGE_SIZE);
+                p += SRXE_PAGE_SIZE;
+            }
+        }
+        put32(p, lfs_crc(0xffffffff, record, p - record));
+        p += 4;
+    }
+
+    return p - delta;
+}
+
+// modeled time to write a whole image the way it's done today
+static uint64_t full_flash_us(const uint8_t *new) {
+    flash_emu_reset();
+    for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+        cfg.erase(&cfg, b);
+        for (int j = 0; j < SRXE_DELTA_PAGES; j++) {
+            const uint8_t *page = &new[b*SRXE_BLOCK_SIZE + j*SRXE_PAGE_SIZE];
+            if (!blank(page)) {
+                cfg.prog(&cfg, b, j*SRXE_PAGE_SIZE, page, SRXE_PAGE_SIZE);
+            }
+        }
+    }
+    return flash_emu_stats.time_us;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s old.bin new.bin out.delta\n"
+            "       %s -a image.bin in.delta\n",
+            name, name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool applying = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "a")) != -1) {
+        switch (opt) {
+            case 'a': applying = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != (applying ? 2 : 3)) {
+        usage(argv[0]);
+    }
+
+    // the demo's configuration, minus persistent state on the flash
+    cfg = srxe_cfg;
+    cfg.erase_count = NULL;
+    cfg.bad_blocks = NULL;
+
+    if (applying) {
+        size_t isize, dsize;
+        uint8_t *image = load(argv[optind], &isize);
+        uint8_t *delta = load(argv[optind+1], &dsize);
+        if (!image || !delta) {
+            return 1;
+        }
+        if (isize < IMAGE_SIZE) {
+            fprintf(stderr, "%s: too small for a %d byte filesystem\n",
+                    argv[optind], IMAGE_SIZE);
+            return 1;
+        }
+
+        flash(image);
+        int err = apply(delta, dsize);
+        if (err) {
+            fprintf(stderr, "apply failed (%d)\n", err);
+            return 1;
+        }
+
+        memcpy(image, flash_emu_mem, IMAGE_SIZE);
+        return store(argv[optind], image, isize) ? 1 : 0;
+    }
+
+    size_t osize, nsize;
+    uint8_t *old = load(argv[optind], &osize);
+    uint8_t *new = load(argv[optind+1], &nsize);
+    if (!old || !new) {
+        return 1;
+    }
+    if (osize < IMAGE_SIZE || nsize < IMAGE_SIZE) {
+        fprintf(stderr, "images must hold a %d byte filesystem\n",
+                IMAGE_SIZE);
+        return 1;
+    }
+
+    // worst case every block with every page
+    uint8_t *delta = malloc(SRXE_DELTA_HEADER_SIZE + SRXE_BLOCK_COUNT
+            * (SRXE_DELTA_RECORD_SIZE + SRXE_BLOCK_SIZE + 4));
+    int changed, live;
+    size_t dsize = make(old, new, delta, &changed, &live);
+    if (store(argv[optind+2], delta, dsize)) {
+        return 1;
+    }
+
+    // check the delta turns the old image into the new one
+    uint8_t newlive[SRXE_BLOCK_COUNT];
+    live_blocks(new, newlive);
+    flash(old);
+    flash_emu_resetstats();
+    int err = apply(delta, dsize);
+    uint64_t delta_us = flash_emu_stats.time_us;
+    if (err) {
+        fprintf(stderr, "delta does not apply (%d)\n", err);
+        return 1;
+    }
+    for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+        if (newlive[b] && memcmp(&flash_emu_mem[b*SRXE_BLOCK_SIZE],
+                &new[b*SRXE_BLOCK_SIZE], SRXE_BLOCK_SIZE) != 0) {
+            fprintf(stderr, "block %"PRIu32" differs after applying\n", b);
+            return 1;
+        }
+    }
+
+    uint64_t full_us = full_flash_us(new);
+    printf("%d of %d live blocks changed\n", changed, live);
+    printf("delta %zu bytes, full image %d bytes (%.1f%%)\n",
+            dsize, IMAGE_SIZE, 100.0 * dsize / IMAGE_SIZE);
+    printf("flash time %.2fs, full reflash %.2fs\n",
+            delta_us / 1e6, full_us / 1e6);
+    return 0;
+}
@@ -0,0 +1,678 @@
+/*
+ * Build and check littlefs images for the SRXE on the host
+ *
+ * Images use the same geometry and lfs.c as the demo, so they can be
+ * written straight to flash address 0. An image file holds the
+ * filesystem region, anything past it, as in a full dump of the flash,
+ * is left untouched. Every command takes any number of images and works
+ * on them in parallel, one process per image.
+ *
+ *     ./lfstool create -d root img/dev*.bin          # format, copy root in
+ *     ./lfstool create -d 'devices/{}' img/dev*.bin  # per-device contents
+ *     ./lfstool populate -d extra img/dev*.bin       # add to images
+ *     ./lfstool list img/a.bin
+ *     ./lfstool extract -d 'out/{}' img/dev*.bin
+ *     ./lfstool fsck img/dev*.bin
+ *
+ * {} in a directory is replaced with the image's name, minus directory
+ * and extension.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+
+
+/// File-backed block device ///
+
+#define IMAGE_SIZE (SRXE_BLOCK_COUNT*SRXE_BLOCK_SIZE)
+
+// the whole image is kept in RAM and written back on success
+static uint8_t *image;
+static size_t image_size;
+
+static int image_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    memcpy(buffer, &image[block*c->block_size + off], size);
+    return 0;
+}
+
+static int image_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    // programs can only clear bits, like the real flash
+    const uint8_t *data = buffer;
+    for (lfs_size_t i = 0; i < size; i++) {
+        image[block*c->block_size + off + i] &= data[i];
+    }
+    return 0;
+}
+
+static int image_erase(const struct lfs_config *c, lfs_block_t block) {
+    memset(&image[block*c->block_size], 0xff, c->block_size);
+    return 0;
+}
+
+static int image_sync(const struct lfs_config *c) {
+    (void)c;
+    return 0;
+}
+
+static struct lfs_config cfg;
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+static int image_load(const char *path, FILE *out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(out, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    if (size < IMAGE_SIZE) {
+        fprintf(out, "%s: too small for a %d byte filesystem\n",
+                path, IMAGE_SIZE);
+        fclose(f);
+        return -1;
+    }
+
+    image_size = size;
+    image = malloc(image_size);
+    if (!image || fread(image, 1, image_size, f) != image_size) {
+        fprintf(out, "%s: read failed\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static int image_store(const char *path, FILE *out) {
+    // write a copy and rename it over, so a failure never leaves a
+    // half written image
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(out, "%s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+
+    if (fwrite(image, 1, image_size, f) != image_size || fclose(f) != 0) {
+        fprintf(out, "%s: write failed\n", tmp);
+        remove(tmp);
+        return -1;
+    }
+
+    if (rename(tmp, path) != 0) {
+        fprintf(out, "%s: %s\n", path, strerror(errno));
+        remove(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/// Copying in and out ///
+
+static void subst(char *buf, size_t size, const char *pattern,
+        const char *path) {
+    // name of the image without directory or extension
+    const char *name = strrchr(path, '/');
+    name = name ? name+1 : path;
+    const char *ext = strrchr(name, '.');
+    int namelen = ext && ext != name ? (int)(ext - name) : (int)strlen(name);
+
+    const char *p = strstr(pattern, "{}");
+    if (!p) {
+        snprintf(buf, size, "%s", pattern);
+    } else {
+        snprintf(buf, size, "%.*s%.*s%s",
+                (int)(p - pattern), pattern, namelen, name, p+2);
+    }
+}
+
+static int copy_in(lfs_t *lfs, const char *host, const char *path,
+        FILE *out) {
+    DIR *d = opendir(host);
+    if (!d) {
+        fprintf(out, "%s: %s\n", host, strerror(errno));
+        return -1;
+    }
+
+    int err = 0;
+    struct dirent *ent;
+    while (!err && (ent = readdir(d))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        char hpath[4096];
+        char lpath[4096];
+        snprintf(hpath, sizeof(hpath), "%s/%s", host, ent->d_name);
+        snprintf(lpath, sizeof(lpath), "%s/%s", path, ent->d_name);
+        if (strlen(ent->d_name) > LFS_NAME_MAX) {
+            fprintf(out, "%s: name too long\n", hpath);
+            err = -1;
+            break;
+        }
+
+        struct stat st;
+        if (stat(hpath, &st) != 0) {
+            fprintf(out, "%s: %s\n", hpath, strerror(errno));
+            err = -1;
+        } else if (S_ISDIR(st.st_mode)) {
+            err = lfs_mkdir(lfs, lpath);
+            if (err == LFS_ERR_EXIST) {
+                err = 0;
+            }
+            if (err) {
+                fprintf(out, "%s: mkdir failed (%d)\n", lpath, err);
+            } else {
+                err = copy_in(lfs, hpath, lpath, out);
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            FILE *f = fopen(hpath, "rb");
+            if (!f) {
+                fprintf(out, "%s: %s\n", hpath, strerror(errno));
+                err = -1;
+                break;
+            }
+
+            lfs_file_t file;
+            err = lfs_file_opencfg(lfs, &file, lpath,
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+            if (!err) {
+                uint8_t buf[4096];
+                size_t n;
+                while (!err && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+                    lfs_ssize_t res = lfs_file_write(lfs, &file, buf, n);
+                    if (res < 0) {
+                        err = (int)res;
+                    }
+                }
+                int cerr = lfs_file_close(lfs, &file);
+                err = err ? err : cerr;
+            }
+            fclose(f);
+
+            if (err) {
+                fprintf(out, "%s: write failed (%d)%s\n", lpath, err,
+                        err == LFS_ERR_NOSPC ? ", image is full" : "");
+            }
+        }
+    }
+
+    closedir(d);
+    return err;
+}
+
+// mkdir -p
+static int mkdirs(const char *host) {
+    char buf[4096];
+    snprintf(buf, sizeof(buf), "%s", host);
+    for (char *p = buf+1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(buf, 0777) != 0 && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+
+    return (mkdir(buf, 0777) != 0 && errno != EEXIST) ? -1 : 0;
+}
+
+static int copy_out(lfs_t *lfs, const char *path, const char *host,
+        FILE *out) {
+    if (mkdirs(host) != 0) {
+        fprintf(out, "%s: %s\n", host, strerror(errno));
+        return -1;
+    }
+
+    lfs_dir_t dir;
+    int err = lfs_dir_open(lfs, &dir, path[0] ? path : "/");
+    if (err) {
+        fprintf(out, "%s: open failed (%d)\n", path, err);
+        return err;
+    }
+
+    struct lfs_info info;
+    int res;
+    while (!err && (res = lfs_dir_read(lfs, &dir, &info)) > 0) {
+        if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0) {
+            continue;
+        }
+
+        char hpath[4096];
+        char lpath[4096];
+        snprintf(hpath, sizeof(hpath), "%s/%s", host, info.name);
+        snprintf(lpath, sizeof(lpath), "%s/%s", path, info.name);
+        if (info.type == LFS_TYPE_DIR) {
+            err = copy_out(lfs, lpath, hpath, out);
+            continue;
+        }
+
+        FILE *f = fopen(hpath, "wb");
+        if (!f) {
+            fprintf(out, "%s: %s\n", hpath, strerror(errno));
+            err = -1;
+            break;
+        }
+
+        // a short write stops the copy with n still positive
+        lfs_file_t file;
+        lfs_ssize_t n = 0;
+        err = lfs_file_opencfg(lfs, &file, lpath, LFS_O_RDONLY, &file_cfg);
+        if (!err) {
+            uint8_t buf[4096];
+            while ((n = lfs_file_read(lfs, &file, buf, sizeof(buf))) > 0) {
+                if (fwrite(buf, 1, n, f) != (size_t)n) {
+                    break;
+                }
+            }
+            err = (n < 0) ? (int)n : 0;
+            int cerr = lfs_file_close(lfs, &file);
+            err = err ? err : cerr;
+        }
+        if ((fclose(f) != 0 || n > 0) && !err) {
+            fprintf(out, "%s: %s\n", hpath, strerror(errno));
+            err = -1;
+        } else if (err) {
+            fprintf(out, "%s: read failed (%d)\n", lpath, err);
+        }
+    }
+
+    lfs_dir_close(lfs, &dir);
+    return err ? err : (res < 0 ? res : 0);
+}
+
+
+/// Checking ///
+
+struct fsck {
+    uint8_t seen[SRXE_BLOCK_COUNT];
+    uint8_t dirpair[SRXE_BLOCK_COUNT];
+    lfs_size_t blocks;
+    lfs_size_t bad;
+    lfs_size_t files;
+    lfs_size_t dirs;
+    lfs_size_t bytes;
+};
+
+static int fsck_block(void *p, lfs_block_t block) {
+    struct fsck *c = p;
+    if (block >= SRXE_BLOCK_COUNT) {
+        c->bad += 1;
+    } else {
+        if (!c->seen[block]) {
+            c->blocks += 1;
+        }
+        if (c->seen[block] < UINT8_MAX) {
+            c->seen[block] += 1;
+        }
+    }
+    return 0;
+}
+
+// lfs_fs_traverse reports a directory's pair from both the metadata list
+// and its parent, any other block in use more than once is owned twice
+static int fsck_shared(struct fsck *c, const char *path, FILE *out) {
+    int err = 0;
+    for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+        if (c->seen[b] > 1 + c->dirpair[b]) {
+            fprintf(out, "%s: block %"PRIu32" in use %d times\n",
+                    path, b, c->seen[b]);
+            err = LFS_ERR_CORRUPT;
+        }
+    }
+    return err;
+}
+
+// walk the tree, reading every file and listing it if list is set
+static int walk(lfs_t *lfs, const char *path, int depth,
+        struct fsck *c, FILE *list, FILE *out) {
+    lfs_dir_t dir;
+    int err = lfs_dir_open(lfs, &dir, path[0] ? path : "/");
+    if (err) {
+        fprintf(out, "%s: open failed (%d)\n", path, err);
+        return err;
+    }
+    if (path[0]) {
+        if (dir.head[0] >= SRXE_BLOCK_COUNT
+                || dir.head[1] >= SRXE_BLOCK_COUNT) {
+            fprintf(out, "%s: metadata pair {%"PRIu32", %"PRIu32"} "
+                    "out of range\n", path, dir.head[0], dir.head[1]);
+            lfs_dir_close(lfs, &dir);
+            return LFS_ERR_CORRUPT;
+        }
+        c->dirpair[dir.head[0]] = 1;
+        c->dirpair[dir.head[1]] = 1;
+    }
+
+    struct lfs_info info;
+    int res;
+    while (!err && (res = lfs_dir_read(lfs, &dir, &info)) > 0) {
+        if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0) {
+            continue;
+        }
+
+        char lpath[4096];
+        snprintf(lpath, sizeof(lpath), "%s/%s", path, info.name);
+        if (list) {
+            if (info.type == LFS_TYPE_DIR) {
+                fprintf(list, "%*s%s/\n", 2*depth, "", info.name);
+            } else {
+                fprintf(list, "%*s%-*s %8"PRIu32"\n", 2*depth, "",
+                        32 - 2*depth, info.name, info.size);
+            }
+        }
+
+        if (info.type == LFS_TYPE_DIR) {
+            c->dirs += 1;
+            err = walk(lfs, lpath, depth+1, c, list, out);
+            continue;
+        }
+
+        c->files += 1;
+        lfs_file_t file;
+        err = lfs_file_opencfg(lfs, &file, lpath, LFS_O_RDONLY, &file_cfg);
+        if (!err) {
+            uint8_t buf[4096];
+            lfs_ssize_t n;
+            lfs_size_t total = 0;
+            while ((n = lfs_file_read(lfs, &file, buf, sizeof(buf))) > 0) {
+                total += n;
+            }
+            err = (n < 0) ? (int)n : 0;
+            if (!err && total != info.size) {
+                fprintf(out, "%s: read %"PRIu32" of %"PRIu32" bytes\n",
+                        lpath, total, info.size);
+                err = LFS_ERR_CORRUPT;
+            }
+            int cerr = lfs_file_close(lfs, &file);
+            err = err ? err : cerr;
+            c->bytes += total;
+        }
+        if (err) {
+            fprintf(out, "%s: read failed (%d)\n", lpath, err);
+        }
+    }
+
+    lfs_dir_close(lfs, &dir);
+    return err ? err : (res < 0 ? res : 0);
+}
+
+
+/// Commands ///
+
+enum command {
+    CMD_CREATE,
+    CMD_POPULATE,
+    CMD_LIST,
+    CMD_EXTRACT,
+    CMD_FSCK,
+};
+
+static const char *const commands[] = {
+    "create", "populate", "list", "extract", "fsck",
+};
+
+// run a command on one image, output goes to out
+static int run(enum command cmd, const char *path, const char *dir,
+        FILE *out) {
+    if (cmd == CMD_CREATE) {
+        // keep anything past the filesystem if the image already exists
+        FILE *f = fopen(path, "rb");
+        if (f) {
+            fclose(f);
+            if (image_load(path, out)) {
+                return -1;
+            }
+        } else {
+            image_size = IMAGE_SIZE;
+            image = malloc(image_size);
+            if (!image) {
+                fprintf(out, "%s: out of memory\n", path);
+                return -1;
+            }
+        }
+        memset(image, 0xff, IMAGE_SIZE);
+    } else if (image_load(path, out)) {
+        return -1;
+    }
+
+    lfs_t lfs;
+    int err = 0;
+    if (cmd == CMD_CREATE) {
+        err = lfs_format(&lfs, &cfg);
+        if (err) {
+            fprintf(out, "%s: format failed (%d)\n", path, err);
+            return err;
+        }
+    }
+
+    err = lfs_mount(&lfs, &cfg);
+    if (err) {
+        fprintf(out, "%s: mount failed (%d), not a littlefs image with"
+                " the SRXE geometry?\n", path, err);
+        return err;
+    }
+
+    char host[4096];
+    if (dir) {
+        subst(host, sizeof(host), dir, path);
+    }
+
+    struct fsck c;
+    memset(&c, 0, sizeof(c));
+    switch (cmd) {
+        case CMD_CREATE:
+        case CMD_POPULATE:
+            if (dir) {
+                err = copy_in(&lfs, host, "", out);
+            }
+            break;
+        case CMD_LIST:
+            fprintf(out, "%s:\n", path);
+            err = walk(&lfs, "", 1, &c, out, out);
+            break;
+        case CMD_EXTRACT:
+            if (!dir) {
+                snprintf(host, sizeof(host), "%s.d", path);
+            }
+            err = copy_out(&lfs, "", host, out);
+            break;
+        case CMD_FSCK:
+            err = lfs_fs_traverse(&lfs, fsck_block, &c);
+            if (err) {
+                fprintf(out, "%s: traverse failed (%d)\n", path, err);
+                break;
+            }
+            if (c.bad) {
+                fprintf(out, "%s: %"PRIu32" blocks out of range\n",
+                        path, c.bad);
+                err = LFS_ERR_CORRUPT;
+                break;
+            }
+            err = walk(&lfs, "", 0, &c, NULL, out);
+            if (!err) {
+                err = fsck_shared(&c, path, out);
+            }
+            break;
+    }
+
+    if (!err && (cmd == CMD_CREATE || cmd == CMD_POPULATE || cmd == CMD_FSCK)) {
+        lfs_ssize_t used = lfs_fs_size(&lfs);
+        if (cmd == CMD_FSCK) {
+            fprintf(out, "%s: ok, %"PRIu32" files, %"PRIu32" dirs, "
+                    "%"PRIu32" bytes, %"PRIu32"/%d blocks\n",
+                    path, c.files, c.dirs, c.bytes, c.blocks,
+                    SRXE_BLOCK_COUNT);
+        } else {
+            fprintf(out, "%s: %"PRId32"/%d blocks used\n",
+                    path, used, SRXE_BLOCK_COUNT);
+        }
+    }
+
+    int uerr = lfs_unmount(&lfs);
+    err = err ? err : uerr;
+    if (err) {
+        return err;
+    }
+
+    if (cmd == CMD_CREATE || cmd == CMD_POPULATE) {
+        return image_store(path, out);
+    }
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s create|populate|list|extract|fsck [-j jobs]"
+            " [-d dir] image...\n"
+            "\n"
+            "  create    format images, copying dir in if given\n"
+            "  populate  copy dir into existing images\n"
+            "  list      list the contents of images\n"
+            "  extract   copy the contents of images out to dir"
+            " (image.d)\n"
+            "  fsck      check images can be mounted and read in full\n"
+            "\n"
+            "  -j  images to process at once (number of cpus)\n"
+            "  -d  host directory, {} is replaced with the image name\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+
+    int cmd = -1;
+    for (unsigned i = 0; i < sizeof(commands)/sizeof(commands[0]); i++) {
+        if (strcmp(argv[1], commands[i]) == 0) {
+            cmd = i;
+        }
+    }
+    if (cmd < 0) {
+        usage(argv[0]);
+    }
+
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *dir = NULL;
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "j:d:")) != -1) {
+        switch (opt) {
+            case 'j': jobs = strtol(optarg, NULL, 0); break;
+            case 'd': dir = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind == argc || jobs < 1
+            || (cmd == CMD_POPULATE && !dir)) {
+        usage(argv[0]);
+    }
+
+    // same geometry and limits as the demo, on top of an image file
+    cfg = srxe_cfg;
+    cfg.read = image_read;
+    cfg.prog = image_prog;
+    cfg.erase = image_erase;
+    cfg.sync = image_sync;
+    cfg.erase_count = NULL;
+    cfg.bad_blocks = NULL;
+    // these work on the SRXE flash, not the image, without them
+    // verification reads back through image_read
+    cfg.busy = NULL;
+    cfg.crc = NULL;
+
+    // one child per image, each buffers its output so images don't
+    // interleave, output is printed as each image finishes
+    int count = argc - optind;
+    pid_t *pids = calloc(count, sizeof(pid_t));
+    FILE **outs = calloc(count, sizeof(FILE*));
+    int running = 0;
+    int failed = 0;
+    int next = 0;
+    while (next < count || running > 0) {
+        if (next < count && running < jobs) {
+            outs[next] = tmpfile();
+            if (!outs[next]) {
+                perror("tmpfile");
+                return 1;
+            }
+
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            } else if (pid == 0) {
+                int err = run(cmd, argv[optind+next], dir, outs[next]);
+                fclose(outs[next]);
+                _exit(err ? 1 : 0);
+            }
+
+            pids[next] = pid;
+            running += 1;
+            next += 1;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            perror("wait");
+            return 1;
+        }
+
+        for (int i = 0; i < next; i++) {
+            if (pids[i] == pid) {
+                char buf[4096];
+                size_t n;
+                bool written = true;
+                rewind(outs[i]);
+                while ((n = fread(buf, 1, sizeof(buf), outs[i])) > 0) {
+                    if (fwrite(buf, 1, n, stdout) != n) {
+                        written = false;
+                        break;
+                    }
+                }
+                fclose(outs[i]);
+                if (!written || fflush(stdout) != 0) {
+                    perror("stdout");
+                    written = false;
+                }
+
+                if (!written || !WIFEXITED(status)
+                        || WEXITSTATUS(status) != 0) {
+                    failed += 1;
+                }
+                running -= 1;
+                break;
+            }
+        }
+    }
+
+    if (count > 1) {
+        printf("%d images, %d failed\n", count, failed);
+    }
+    return failed ? 1 : 0;
+}
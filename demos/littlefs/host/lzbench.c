@@ -0,0 +1,317 @@
+/*
+ * Compressed file benchmark for lfs_lz
+ *
+ * Writes a file of representative data in small writes the way the demo
+ * logs, then reads it back sequentially and at random offsets, once as a
+ * plain littlefs file and once compressed with lfs_lz. The data is a text
+ * log of sensor readings, a screen bitmap of text rows and blank space,
+ * and random bytes that don't compress at all. For each it reports the
+ * bytes stored, blocks used, compression ratio, modeled write and read
+ * throughput of the uncompressed data, bytes read from flash and modeled
+ * time per random read, see flash_emu.h for the timing model. The model
+ * covers flash time only, compressing costs the AVR CPU time the host
+ * can't stand in for, see LFS_LZ_WINDOW.
+ *
+ *     ./lzbench                # 24 KiB of each, 64 byte writes
+ *     ./lzbench -s 8192 -w 16
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "lfs_lz.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+#define SIZE_MAX_ 65536
+#define INDEX_CHUNKS 200
+#define SEEKS 64
+#define SEEK_SIZE 32
+
+static uint8_t data[SIZE_MAX_];
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+static uint8_t lz_buffer[LFS_LZ_BUFFER_SIZE];
+static uint8_t lz_index[LFS_LZ_INDEX_SIZE(INDEX_CHUNKS)];
+static const struct lfs_lz_config lz_cfg = {
+    .file_buffer = file_buffer,
+    .buffer = lz_buffer,
+    .index = lz_index,
+    .index_size = sizeof(lz_index),
+};
+
+struct result {
+    lfs_size_t stored;
+    lfs_ssize_t blocks;
+    uint64_t write_us;
+    uint64_t read_us;
+    uint64_t read_bytes;
+    uint64_t seek_us;
+    uint32_t probes;
+};
+
+static uint32_t rng_state;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// sensor readings, one line every second with slowly drifting values
+static void gen_log(uint8_t *buf, uint32_t size) {
+    uint32_t off = 0;
+    int batt = 3950;
+    int temp = 215;
+    for (uint32_t t = 0; off < size; t++) {
+        batt -= (rng() % 8 == 0);
+        temp += (int)(rng() % 3) - 1;
+        char line[80];
+        int n = snprintf(line, sizeof(line),
+                "%06"PRIu32" batt=%d.%03dV temp=%d.%dC rssi=-%"PRIu32" %s\n",
+                t, batt/1000, batt%1000, temp/10, temp%10, 60 + rng()%20,
+                (rng() % 16) ? "ok" : "retry");
+        uint32_t diff = lfs_min((uint32_t)n, size - off);
+        memcpy(&buf[off], line, diff);
+        off += diff;
+    }
+}
+
+// 384 pixel wide 1-bit screen, rows of 8x8 glyphs from a small font with
+// blank rows and margins in between
+static void gen_bitmap(uint8_t *buf, uint32_t size) {
+    uint8_t font[32][8];
+    for (int g = 0; g < 32; g++) {
+        for (int y = 0; y < 8; y++) {
+            font[g][y] = (g == 0 || y == 7) ? 0 : (uint8_t)(rng() & 0x7e);
+        }
+    }
+
+    const uint32_t stride = 384/8;
+    uint8_t glyphs[384/8];
+    for (uint32_t off = 0; off < size; off++) {
+        uint32_t row = off / (stride*8);
+        uint32_t y = (off / stride) % 8;
+        uint32_t x = off % stride;
+        if (y == 0 && x == 0) {
+            // every third row is blank, lines of text end early
+            uint32_t len = (row % 3 == 2) ? 0 : 8 + rng() % (stride - 12);
+            for (uint32_t i = 0; i < stride; i++) {
+                glyphs[i] = (i >= 2 && i < len) ? 1 + rng() % 31 : 0;
+            }
+        }
+        buf[off] = font[glyphs[x]][y];
+    }
+}
+
+static void gen_random(uint8_t *buf, uint32_t size) {
+    for (uint32_t off = 0; off < size; off++) {
+        buf[off] = (uint8_t)rng();
+    }
+}
+
+struct dataset {
+    const char *name;
+    void (*gen)(uint8_t *buf, uint32_t size);
+};
+
+static const struct dataset datasets[] = {
+    {"log",     gen_log},
+    {"bitmap",  gen_bitmap},
+    {"random",  gen_random},
+};
+#define DATASET_COUNT (sizeof(datasets)/sizeof(datasets[0]))
+
+// the plain and compressed file behind one interface
+struct file {
+    bool lz;
+    lfs_file_t plain;
+    lfs_lz_file_t zf;
+};
+
+static int file_open(lfs_t *lfs, struct file *f, int flags) {
+    return f->lz
+            ? lfs_lz_open(lfs, &f->zf, "data", flags, &lz_cfg)
+            : lfs_file_opencfg(lfs, &f->plain, "data", flags, &file_cfg);
+}
+
+static int file_close(lfs_t *lfs, struct file *f) {
+    return f->lz
+            ? lfs_lz_close(lfs, &f->zf)
+            : lfs_file_close(lfs, &f->plain);
+}
+
+static lfs_ssize_t file_write(lfs_t *lfs, struct file *f,
+        const void *buf, lfs_size_t size) {
+    return f->lz
+            ? lfs_lz_write(lfs, &f->zf, buf, size)
+            : lfs_file_write(lfs, &f->plain, buf, size);
+}
+
+static lfs_ssize_t file_read(lfs_t *lfs, struct file *f,
+        void *buf, lfs_size_t size) {
+    return f->lz
+            ? lfs_lz_read(lfs, &f->zf, buf, size)
+            : lfs_file_read(lfs, &f->plain, buf, size);
+}
+
+static lfs_soff_t file_seek(lfs_t *lfs, struct file *f, lfs_soff_t off) {
+    return f->lz
+            ? lfs_lz_seek(lfs, &f->zf, off, LFS_SEEK_SET)
+            : lfs_file_seek(lfs, &f->plain, off, LFS_SEEK_SET);
+}
+
+static int run(bool lz, uint32_t size, uint32_t wsize, struct result *r) {
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &srxe_cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    lfs_ssize_t blocks = lfs_fs_size(&lfs);
+    if (blocks < 0) {
+        return blocks;
+    }
+
+    struct file f = {.lz = lz};
+    struct flash_emu_stats before = flash_emu_stats;
+    err = file_open(&lfs, &f, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+    if (err) {
+        return err;
+    }
+    for (uint32_t off = 0; off < size; off += wsize) {
+        lfs_ssize_t res = file_write(&lfs, &f, &data[off],
+                lfs_min(wsize, size - off));
+        if (res < 0) {
+            file_close(&lfs, &f);
+            return res;
+        }
+    }
+    err = file_close(&lfs, &f);
+    if (err) {
+        return err;
+    }
+    r->write_us = flash_emu_stats.time_us - before.time_us;
+    r->probes = lz ? f.zf.probes : 0;
+
+    struct lfs_info info;
+    err = lfs_stat(&lfs, "data", &info);
+    if (err) {
+        return err;
+    }
+    r->stored = info.size;
+    r->blocks = lfs_fs_size(&lfs) - blocks;
+
+    // read it all back in small reads, then at random offsets
+    err = file_open(&lfs, &f, LFS_O_RDONLY);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[SEEK_SIZE];
+    before = flash_emu_stats;
+    for (uint32_t off = 0; off < size && !err; off += sizeof(buf)) {
+        lfs_size_t n = lfs_min(sizeof(buf), size - off);
+        lfs_ssize_t res = file_read(&lfs, &f, buf, n);
+        if (res < 0) {
+            err = res;
+        } else if ((lfs_size_t)res != n || memcmp(buf, &data[off], n)) {
+            err = LFS_ERR_CORRUPT;
+        }
+    }
+    r->read_us = flash_emu_stats.time_us - before.time_us;
+    r->read_bytes = flash_emu_stats.read_bytes - before.read_bytes;
+
+    rng_state = 0x5eed;
+    before = flash_emu_stats;
+    for (int i = 0; i < SEEKS && !err; i++) {
+        uint32_t off = rng() % (size - SEEK_SIZE + 1);
+        lfs_soff_t pos = file_seek(&lfs, &f, off);
+        lfs_ssize_t res = (pos < 0) ? pos
+                : file_read(&lfs, &f, buf, SEEK_SIZE);
+        if (res < 0) {
+            err = res;
+        } else if (res != SEEK_SIZE || memcmp(buf, &data[off], SEEK_SIZE)) {
+            err = LFS_ERR_CORRUPT;
+        }
+    }
+    r->seek_us = flash_emu_stats.time_us - before.time_us;
+
+    int cerr = file_close(&lfs, &f);
+    if (err || cerr) {
+        return err ? err : cerr;
+    }
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-s size] [-w write_size]\n"
+            "\n"
+            "  -s  file size in bytes, %d..%d (24576)\n"
+            "  -w  size of each write, at least 1 (64)\n",
+            name, SEEK_SIZE, SIZE_MAX_);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t size = 24576;
+    uint32_t wsize = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:")) != -1) {
+        switch (opt) {
+            case 's': size = strtoul(optarg, NULL, 0); break;
+            case 'w': wsize = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (size < SEEK_SIZE || size > SIZE_MAX_ || wsize < 1) {
+        usage(argv[0]);
+    }
+
+    printf("%"PRIu32" byte files in %"PRIu32" byte writes, "
+            "%d chunk index\n", size, wsize, INDEX_CHUNKS);
+    printf("%-7s %-5s %9s %6s %6s %9s %8s %9s %10s %11s\n",
+            "data", "file", "stored(B)", "blocks", "ratio",
+            "write/s", "read/s", "read(KiB)", "ms/seek", "probes/KiB");
+    for (unsigned i = 0; i < DATASET_COUNT; i++) {
+        rng_state = 0x1234567 + i;
+        datasets[i].gen(data, size);
+
+        for (int lz = 0; lz < 2; lz++) {
+            struct result r;
+            int err = run(lz, size, wsize, &r);
+            if (err) {
+                fprintf(stderr, "%s %s: error %d\n", datasets[i].name,
+                        lz ? "lz" : "plain", err);
+                return 1;
+            }
+
+            printf("%-7s %-5s %9"PRIu32" %6d %6.2f %7.1fKi %6.1fKi "
+                    "%9.1f %10.3f %11.1f\n",
+                    datasets[i].name, lz ? "lz" : "plain",
+                    r.stored, (int)r.blocks, (double)size / r.stored,
+                    size / 1024.0 / (r.write_us / 1e6),
+                    size / 1024.0 / (r.read_us / 1e6),
+                    r.read_bytes / 1024.0,
+                    r.seek_us / 1000.0 / SEEKS,
+                    r.probes / (size / 1024.0));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,333 @@
+/*
+ * Multithreaded read benchmark for LFS_THREADSAFE builds
+ *
+ * Every thread stats and reads back its own file in a loop, on a RAM
+ * block device that sleeps for the modeled flash time of each read, see
+ * flash_emu.h. Each thread count is run twice, once with only the
+ * exclusive lock and once with lock_shared, and the aggregate read
+ * throughput of both is reported.
+ *
+ *     ./mtbench                # 1..8 threads, 32 KiB files
+ *     ./mtbench -T 16 -f 65536
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "lfs.h"
+#include "flash_emu.h"
+
+
+/// RAM block device ///
+
+#define BLOCK_SIZE  4096
+#define BLOCK_COUNT 1024
+#define CACHE_SIZE  512
+
+static uint8_t *mem;
+static pthread_rwlock_t fs_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+// only charge read latency while benchmarking
+static bool timed;
+
+static void delay_us(uint32_t us) {
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+}
+
+static int ram_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    memcpy(buffer, &mem[block*c->block_size + off], size);
+    if (timed) {
+        delay_us(FLASH_EMU_T_CMD + size*FLASH_EMU_T_BYTE);
+    }
+    return 0;
+}
+
+static int ram_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    memcpy(&mem[block*c->block_size + off], buffer, size);
+    return 0;
+}
+
+static int ram_erase(const struct lfs_config *c, lfs_block_t block) {
+    memset(&mem[block*c->block_size], 0xff, c->block_size);
+    return 0;
+}
+
+static int ram_sync(const struct lfs_config *c) {
+    (void)c;
+    return 0;
+}
+
+static int lock(const struct lfs_config *c) {
+    (void)c;
+    return -pthread_rwlock_wrlock(&fs_lock);
+}
+
+static int lock_shared(const struct lfs_config *c) {
+    (void)c;
+    return -pthread_rwlock_rdlock(&fs_lock);
+}
+
+static int unlock(const struct lfs_config *c) {
+    (void)c;
+    return -pthread_rwlock_unlock(&fs_lock);
+}
+
+static int lock_cache(const struct lfs_config *c) {
+    (void)c;
+    return -pthread_mutex_lock(&cache_lock);
+}
+
+static int unlock_cache(const struct lfs_config *c) {
+    (void)c;
+    return -pthread_mutex_unlock(&cache_lock);
+}
+
+// lfs_util.h builds with LFS_NO_MALLOC
+static uint8_t read_buffer[CACHE_SIZE];
+static uint8_t prog_buffer[CACHE_SIZE];
+static uint32_t lookahead_buffer[128/4];
+
+static struct lfs_config cfg = {
+    .read           = ram_read,
+    .prog           = ram_prog,
+    .erase          = ram_erase,
+    .sync           = ram_sync,
+    .lock           = lock,
+    .unlock         = unlock,
+
+    .read_size      = 16,
+    .prog_size      = 256,
+    .block_size     = BLOCK_SIZE,
+    .block_count    = BLOCK_COUNT,
+    .cache_size     = CACHE_SIZE,
+    .lookahead_size = sizeof(lookahead_buffer),
+    .block_cycles   = 500,
+
+    .read_buffer        = read_buffer,
+    .prog_buffer        = prog_buffer,
+    .lookahead_buffer   = lookahead_buffer,
+};
+
+
+/// Benchmark ///
+
+#define THREADS_MAX 64
+
+static lfs_t lfs;
+static uint32_t file_size = 32*1024;
+static int rounds = 4;
+static pthread_barrier_t start;
+
+struct worker {
+    pthread_t thread;
+    int id;
+    int err;
+    uint8_t buffer[CACHE_SIZE];
+};
+
+static uint8_t content(int id, uint32_t i) {
+    return (uint8_t)(id*31 + i*7 + (i >> 8));
+}
+
+static void *work(void *p) {
+    struct worker *w = p;
+    char name[16];
+    snprintf(name, sizeof(name), "f%02d", w->id);
+
+    struct lfs_file_config file_cfg = {.buffer = w->buffer};
+    lfs_file_t file;
+    w->err = lfs_file_opencfg(&lfs, &file, name, LFS_O_RDONLY, &file_cfg);
+    pthread_barrier_wait(&start);
+    if (w->err) {
+        return NULL;
+    }
+
+    uint8_t chunk[BLOCK_SIZE];
+    for (int r = 0; r < rounds && !w->err; r++) {
+        struct lfs_info info;
+        w->err = lfs_stat(&lfs, name, &info);
+        if (!w->err && info.size != file_size) {
+            w->err = LFS_ERR_CORRUPT;
+        }
+        if (!w->err) {
+            lfs_soff_t res = lfs_file_seek(&lfs, &file, 0, LFS_SEEK_SET);
+            w->err = (res < 0) ? (int)res : 0;
+        }
+
+        for (uint32_t off = 0; off < file_size && !w->err; ) {
+            lfs_ssize_t res = lfs_file_read(&lfs, &file,
+                    chunk, sizeof(chunk));
+            if (res <= 0) {
+                w->err = res ? (int)res : LFS_ERR_CORRUPT;
+                break;
+            }
+
+            for (lfs_ssize_t i = 0; i < res; i++) {
+                if (chunk[i] != content(w->id, off+i)) {
+                    w->err = LFS_ERR_CORRUPT;
+                    break;
+                }
+            }
+            off += res;
+        }
+    }
+
+    int err = lfs_file_close(&lfs, &file);
+    if (!w->err) {
+        w->err = err;
+    }
+    return NULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// returns aggregate read throughput in KiB/s, or a negative error
+static double run(int threads, bool shared) {
+    static struct worker workers[THREADS_MAX];
+    cfg.lock_shared = shared ? lock_shared : NULL;
+    cfg.unlock_shared = shared ? unlock : NULL;
+    cfg.lock_cache = shared ? lock_cache : NULL;
+    cfg.unlock_cache = shared ? unlock_cache : NULL;
+
+    int err = lfs_mount(&lfs, &cfg);
+    if (err) {
+        return err;
+    }
+
+    timed = true;
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for (int i = 0; i < threads; i++) {
+        workers[i].id = i;
+        workers[i].err = 0;
+        pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start);
+    double t = now();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].err) {
+            err = workers[i].err;
+        }
+    }
+    t = now() - t;
+    pthread_barrier_destroy(&start);
+    timed = false;
+
+    int uerr = lfs_unmount(&lfs);
+    if (err || uerr) {
+        return err ? err : uerr;
+    }
+
+    return (double)threads*rounds*file_size / 1024 / t;
+}
+
+static int populate(int threads) {
+    mem = malloc(BLOCK_SIZE*BLOCK_COUNT);
+    if (!mem) {
+        return LFS_ERR_NOMEM;
+    }
+    memset(mem, 0xff, BLOCK_SIZE*BLOCK_COUNT);
+
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    static uint8_t buffer[CACHE_SIZE];
+    struct lfs_file_config file_cfg = {.buffer = buffer};
+    for (int i = 0; i < threads && !err; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "f%02d", i);
+        lfs_file_t file;
+        err = lfs_file_opencfg(&lfs, &file, name,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+        if (err) {
+            break;
+        }
+
+        for (uint32_t off = 0; off < file_size && !err; off++) {
+            uint8_t b = content(i, off);
+            lfs_ssize_t res = lfs_file_write(&lfs, &file, &b, 1);
+            if (res < 0) {
+                err = (int)res;
+            }
+        }
+
+        int cerr = lfs_file_close(&lfs, &file);
+        if (!err) {
+            err = cerr;
+        }
+    }
+
+    int uerr = lfs_unmount(&lfs);
+    return err ? err : uerr;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-T threads] [-f file_size] [-R rounds]\n"
+            "\n"
+            "  -T  most threads to run, doubling from 1 (8)\n"
+            "  -f  size of each thread's file in bytes (32768)\n"
+            "  -R  times each thread reads its file (4)\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int threads = 8;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "T:f:R:")) != -1) {
+        switch (opt) {
+            case 'T': threads = strtol(optarg, NULL, 0); break;
+            case 'f': file_size = strtoul(optarg, NULL, 0); break;
+            case 'R': rounds = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (threads < 1 || threads > THREADS_MAX || file_size < 1
+            || (uint64_t)file_size*threads > BLOCK_SIZE*BLOCK_COUNT/2
+            || rounds < 1) {
+        usage(argv[0]);
+    }
+
+    int err = populate(threads);
+    if (err) {
+        fprintf(stderr, "populate: %d\n", err);
+        return 1;
+    }
+
+    printf("%d rounds of %"PRIu32" byte files per thread\n",
+            rounds, file_size);
+    printf("%7s %15s %15s %8s\n",
+            "threads", "exclusive(KiB/s)", "shared(KiB/s)", "speedup");
+    for (int n = 1; n <= threads; n *= 2) {
+        double excl = run(n, false);
+        double shared = run(n, true);
+        if (excl < 0 || shared < 0) {
+            fprintf(stderr, "%d threads: error %d\n",
+                    n, (int)(excl < 0 ? excl : shared));
+            return 1;
+        }
+
+        printf("%7d %15.0f %15.0f %7.2fx\n", n, excl, shared, shared / excl);
+    }
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Many-open-files benchmark for lfs_config.file_pool_buffer
+ *
+ * Runs a random workload of small appends, syncs and tail reads spread
+ * over a set of files, the way a log, settings and index kept by the demo
+ * would be used. It is run once opening and closing a file around every
+ * access with a single file buffer, and once for every pool size in the
+ * sweep with all files kept open and borrowing pool lines. Contents are
+ * checked after every read and again after a remount. For each run it
+ * reports the RAM taken by file buffers and handles, with handles at
+ * their host size, and the modeled flash time, see flash_emu.h for the
+ * timing model.
+ *
+ *     ./poolbench              # 16 files, 400 steps
+ *     ./poolbench -n 24 -s 1000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+#define FILES_MAX 32
+
+// pool sizes to sweep, in file buffers, 0 opens and closes every access
+static const lfs_size_t sweep[] = {
+    0, 1, 2, 4,
+};
+#define SWEEP_COUNT (sizeof(sweep)/sizeof(sweep[0]))
+
+static uint8_t pool_buffer[4*SRXE_FILE_BUFFER_SIZE];
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+
+static lfs_file_t files[FILES_MAX];
+static uint32_t sizes[FILES_MAX];
+static char names[FILES_MAX][8];
+
+static uint32_t rng_state;
+static uint32_t rng(void) {
+    // xorshift32
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static uint8_t content(int f, uint32_t off) {
+    return (uint8_t)(f*31 + off*7 + (off >> 8));
+}
+
+struct result {
+    size_t ram;
+    uint64_t time_us;
+    uint64_t reads;
+    uint64_t progs;
+    uint64_t erases;
+};
+
+static int verify(lfs_t *lfs, lfs_file_t *file, int f, uint32_t off) {
+    lfs_soff_t pos = lfs_file_seek(lfs, file, off, LFS_SEEK_SET);
+    if (pos < 0) {
+        return pos;
+    }
+
+    uint8_t buf[64];
+    while (off < sizes[f]) {
+        lfs_ssize_t res = lfs_file_read(lfs, file, buf, sizeof(buf));
+        if (res <= 0) {
+            return res < 0 ? res : LFS_ERR_CORRUPT;
+        }
+
+        for (lfs_ssize_t i = 0; i < res; i++) {
+            if (buf[i] != content(f, off+i)) {
+                return LFS_ERR_CORRUPT;
+            }
+        }
+        off += res;
+    }
+
+    return 0;
+}
+
+static int step(lfs_t *lfs, lfs_file_t *file, int f) {
+    uint32_t op = rng() % 4;
+    if (op == 3) {
+        // read back the end of the file
+        uint32_t n = lfs_min(sizes[f], 64);
+        return verify(lfs, file, f, sizes[f] - n);
+    }
+
+    uint8_t buf[48];
+    uint32_t n = 1 + rng() % sizeof(buf);
+    for (uint32_t i = 0; i < n; i++) {
+        buf[i] = content(f, sizes[f]+i);
+    }
+    lfs_ssize_t res = lfs_file_write(lfs, file, buf, n);
+    if (res < 0) {
+        return res;
+    }
+    sizes[f] += n;
+
+    // most records are synced, some are left for later
+    return (op == 2) ? 0 : lfs_file_sync(lfs, file);
+}
+
+static int run(lfs_size_t lines, int count, int steps, uint32_t seed,
+        struct result *r) {
+    struct lfs_config cfg = srxe_cfg;
+    cfg.file_pool_buffer = lines ? pool_buffer : NULL;
+    cfg.file_pool_size = lines*SRXE_FILE_BUFFER_SIZE;
+    const struct lfs_file_config file_cfg = {
+        .buffer = lines ? NULL : file_buffer,
+    };
+    const int flags = LFS_O_RDWR | LFS_O_CREAT | LFS_O_APPEND;
+
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    memset(sizes, 0, sizeof(sizes));
+    if (lines) {
+        for (int f = 0; f < count && !err; f++) {
+            err = lfs_file_opencfg(&lfs, &files[f], names[f], flags,
+                    &file_cfg);
+        }
+    }
+
+    flash_emu_resetstats();
+    rng_state = seed;
+    for (int i = 0; i < steps && !err; i++) {
+        int f = rng() % count;
+        if (lines) {
+            err = step(&lfs, &files[f], f);
+            continue;
+        }
+
+        err = lfs_file_opencfg(&lfs, &files[0], names[f], flags, &file_cfg);
+        if (!err) {
+            err = step(&lfs, &files[0], f);
+            int cerr = lfs_file_close(&lfs, &files[0]);
+            err = err ? err : cerr;
+        }
+    }
+
+    for (int f = 0; lines && f < count; f++) {
+        int cerr = lfs_file_close(&lfs, &files[f]);
+        err = err ? err : cerr;
+    }
+
+    r->ram = (lines ? lines*SRXE_FILE_BUFFER_SIZE : sizeof(file_buffer))
+            + (lines ? count : 1)*sizeof(lfs_file_t);
+    r->time_us = flash_emu_stats.time_us;
+    r->reads = flash_emu_stats.reads;
+    r->progs = flash_emu_stats.progs;
+    r->erases = flash_emu_stats.erases;
+
+    int uerr = lfs_unmount(&lfs);
+    err = err ? err : uerr;
+    if (err) {
+        return err;
+    }
+
+    // everything made it, even what was still buffered at close
+    err = lfs_mount(&lfs, &cfg);
+    for (int f = 0; f < count && !err; f++) {
+        err = lfs_file_opencfg(&lfs, &files[0], names[f], LFS_O_RDONLY,
+                &file_cfg);
+        if (!err) {
+            err = verify(&lfs, &files[0], f, 0);
+            if (!err && lfs_file_size(&lfs, &files[0])
+                    != (lfs_soff_t)sizes[f]) {
+                err = LFS_ERR_CORRUPT;
+            }
+            int cerr = lfs_file_close(&lfs, &files[0]);
+            err = err ? err : cerr;
+        }
+    }
+
+    uerr = lfs_unmount(&lfs);
+    return err ? err : uerr;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-n files] [-s steps] [-S seed]\n"
+            "\n"
+            "  -n  number of files, 1..%d (16)\n"
+            "  -s  number of accesses (400)\n"
+            "  -S  workload seed (1)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int count = 16;
+    int steps = 400;
+    uint32_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:S:")) != -1) {
+        switch (opt) {
+            case 'n': count = strtol(optarg, NULL, 0); break;
+            case 's': steps = strtol(optarg, NULL, 0); break;
+            case 'S': seed = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 1 || count > FILES_MAX || steps < 0 || !seed) {
+        usage(argv[0]);
+    }
+
+    for (int f = 0; f < count; f++) {
+        snprintf(names[f], sizeof(names[f]), "f%02d", f);
+    }
+
+    printf("%d files, %d accesses\n", count, steps);
+    printf("%-10s %7s %10s %7s %7s %7s\n",
+            "buffers", "RAM(B)", "flash(ms)", "reads", "progs", "erases");
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        struct result r;
+        int err = run(sweep[i], count, steps, seed, &r);
+        if (err) {
+            fprintf(stderr, "pool %"PRIu32": error %d\n", sweep[i], err);
+            return 1;
+        }
+
+        char mode[16];
+        if (sweep[i]) {
+            snprintf(mode, sizeof(mode), "pool %"PRIu32, sweep[i]);
+        } else {
+            snprintf(mode, sizeof(mode), "open/close");
+        }
+        printf("%-10s %7zu %10.1f %7"PRIu64" %7"PRIu64" %7"PRIu64"\n",
+                mode, r.ram, r.time_us / 1000.0,
+                r.reads, r.progs, r.erases);
+    }
+
+    return 0;
+}
@@ -0,0 +1,1010 @@
+/*
+ * Power-loss fault injection for the SRXE littlefs configuration
+ *
+ * Runs a generated workload against srxe_cfg on emulated flash, cutting
+ * power on the Nth program or erase for every N the workload reaches. After
+ * each cut the filesystem is remounted and checked:
+ *
+ * - lfs_fs_traverse must succeed and never see a block twice
+ * - every file and directory must match the state before or after the
+ *   operation that was interrupted, as a whole
+ * - the filesystem must still accept writes and remount afterwards
+ * - lfs_fs_size must agree with a traversal, here and after every step
+ *   of the uninterrupted workload
+ *
+ * The workload also runs lfs_fs_wearlevel, rewrites both data files
+ * with one lfs_file_syncv, which must land together, and replaces files
+ * with a transaction, which must land as a whole, and updates d/a and d/b
+ * as keys of a key-value store with one batch, which must too. These must
+ * be just as safe. With
+ * -b a sector goes bad after formatting, so the workload also has to
+ * survive power loss while the block device retires it.
+ *
+ *     ./powerloss               # sweep every cut point of workload 1
+ *     ./powerloss -t -W 8       # torn writes, workloads 1..8
+ *     ./powerloss -b 5          # block 5 stops programming correctly
+ *     ./powerloss -c 1 -m 512 -i 64   # relocate metadata pairs often
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "lfs_log.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+/// Workload ///
+
+// every path the workload may touch
+static const char *const paths[] = {
+    "cfg", "cfg.tmp", "log", "data0", "data1", "d", "d/a", "d/b",
+};
+#define PATH_COUNT (sizeof(paths)/sizeof(paths[0]))
+#define PATH_CFG    0
+#define PATH_TMP    1
+#define PATH_LOG    2
+#define PATH_DATA   3
+#define PATH_DIR    5
+#define LOG_SEED    0x106
+
+enum op_type {
+    OP_WRITE,   // create/truncate path and write len bytes of seed
+    OP_APPEND,  // append len bytes to the log
+    OP_RENAME,  // rename path over path2
+    OP_REMOVE,  // remove path
+    OP_MKDIR,   // mkdir path
+    OP_WEARLEVEL, // move the coldest file with lfs_fs_wearlevel
+    OP_SAVE,    // rewrite both data files, seed and seed^1, with one syncv
+    OP_TXN,     // in one transaction write path and path2, seed and seed^1,
+                // and rename data1 over cfg.tmp, or remove cfg.tmp
+    OP_KV,      // in one key-value batch put d/a, seed, and put d/b,
+                // seed^1, or delete it if it exists
+};
+
+struct op {
+    enum op_type type;
+    int path;
+    int path2;
+    uint32_t seed;
+    uint32_t len;
+};
+
+struct entry {
+    bool exists;
+    bool dir;
+    uint32_t seed;
+    uint32_t len;
+};
+
+struct state {
+    struct entry e[PATH_COUNT];
+};
+
+#define STEPS_MAX 256
+
+static struct op ops[STEPS_MAX];
+// models[i] is the expected state before ops[i]
+static struct state models[STEPS_MAX+1];
+static int steps;
+
+// largest value OP_KV puts, values are always inline
+static uint32_t kv_max;
+
+static uint32_t rng_state;
+static uint32_t rng(void) {
+    // xorshift32
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static uint8_t content(uint32_t seed, uint32_t i) {
+    uint32_t x = seed*2654435761u ^ (i/4)*40503u ^ i;
+    x ^= x >> 15;
+    x *= 0x2c1b3c6d;
+    x ^= x >> 12;
+    return (uint8_t)x;
+}
+
+static uint32_t rnglen(void) {
+    switch (rng() % 4) {
+        case 0:  return rng() % 64;             // inline
+        case 1:  return 200 + rng() % 1000;     // around cache_size
+        case 2:  return 1500 + rng() % 3000;    // up to a block
+        default: return 4000 + rng() % 9000;    // multiple blocks
+    }
+}
+
+static void apply(struct state *s, const struct op *op) {
+    struct entry *e = &s->e[op->path];
+    switch (op->type) {
+        case OP_WRITE:
+            *e = (struct entry){true, false, op->seed, op->len};
+            break;
+        case OP_APPEND:
+            *e = (struct entry){true, false, LOG_SEED, e->len + op->len};
+            break;
+        case OP_RENAME:
+            s->e[op->path2] = *e;
+            *e = (struct entry){false};
+            break;
+        case OP_REMOVE:
+            *e = (struct entry){false};
+            break;
+        case OP_MKDIR:
+            *e = (struct entry){true, true, 0, 0};
+            break;
+        case OP_WEARLEVEL:
+            break;
+        case OP_SAVE:
+            s->e[PATH_DATA] = (struct entry){true, false, op->seed, op->len};
+            s->e[PATH_DATA+1] = (struct entry){true, false,
+                    op->seed ^ 1, op->len};
+            break;
+        case OP_TXN:
+            *e = (struct entry){true, false, op->seed, op->len};
+            s->e[op->path2] = (struct entry){true, false,
+                    op->seed ^ 1, op->len};
+            s->e[PATH_TMP] = s->e[PATH_DATA+1];
+            s->e[PATH_DATA+1] = (struct entry){false};
+            break;
+        case OP_KV:
+            s->e[PATH_DIR+1] = (struct entry){true, false, op->seed, op->len};
+            s->e[PATH_DIR+2] = s->e[PATH_DIR+2].exists
+                    ? (struct entry){false}
+                    : (struct entry){true, false, op->seed ^ 1, op->len};
+            break;
+    }
+}
+
+static void push(struct op op) {
+    ops[steps] = op;
+    models[steps+1] = models[steps];
+    apply(&models[steps+1], &op);
+    steps += 1;
+}
+
+static void generate(uint32_t seed, int count) {
+    rng_state = seed*0x9e3779b9u | 1;
+    memset(&models[0], 0, sizeof(models[0]));
+    steps = 0;
+
+    while (steps < count && steps+2 <= STEPS_MAX) {
+        const struct state *s = &models[steps];
+        uint32_t total = 0;
+        for (unsigned i = 0; i < PATH_COUNT; i++) {
+            total += s->e[i].len;
+        }
+
+        int choice = rng() % 8;
+        // keep well clear of running out of space
+        if (total > 48*1024) {
+            choice = 5;
+        }
+
+        int path;
+        switch (choice) {
+            case 1:
+                // rewrite existing data files together
+                if (s->e[PATH_DATA].exists && s->e[PATH_DATA+1].exists
+                        && !s->e[PATH_DATA].dir && !s->e[PATH_DATA+1].dir) {
+                    push((struct op){OP_SAVE, PATH_DATA, PATH_DATA+1,
+                            rng(), rnglen()});
+                    break;
+                }
+                // fall through
+            case 0:
+                // plain overwrite, d/a and d/b only if d exists
+                path = 3 + rng() % 4;
+                if (path >= 5) {
+                    if (!s->e[PATH_DIR].exists) {
+                        path = 3;
+                    } else {
+                        path += 1;
+                    }
+                }
+                push((struct op){OP_WRITE, path, 0, rng(), rnglen()});
+                break;
+            case 2: case 3:
+                push((struct op){OP_APPEND, PATH_LOG, 0, 0,
+                        16 + rng() % 300});
+                break;
+            case 4:
+                if (rng() % 2) {
+                    // atomic update of several files at once
+                    push((struct op){OP_TXN, PATH_CFG, PATH_DATA,
+                            rng(), rnglen()});
+                    break;
+                }
+
+                // atomic update through a temporary file
+                push((struct op){OP_WRITE, PATH_TMP, 0, rng(), rnglen()});
+                push((struct op){OP_RENAME, PATH_TMP, PATH_CFG, 0, 0});
+                break;
+            case 5: {
+                // remove a random file, or an empty directory
+                path = rng() % PATH_COUNT;
+                const struct entry *e = &s->e[path];
+                if (!e->exists) {
+                    break;
+                }
+                if (e->dir && (s->e[6].exists || s->e[7].exists)) {
+                    break;
+                }
+                push((struct op){OP_REMOVE, path, 0, 0, 0});
+                break;
+            }
+            case 6:
+                push((struct op){OP_WEARLEVEL, 0, 0, 0, 0});
+                break;
+            default:
+                if (!s->e[PATH_DIR].exists) {
+                    push((struct op){OP_MKDIR, PATH_DIR, 0, 0, 0});
+                } else if (rng() % 2) {
+                    // small settings kept as keys in d
+                    push((struct op){OP_KV, PATH_DIR+1, PATH_DIR+2,
+                            rng(), rng() % (kv_max+1)});
+                }
+                break;
+        }
+    }
+}
+
+static void fill(uint8_t *buf, uint32_t seed, uint32_t off, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        buf[i] = content(seed, off+i);
+    }
+}
+
+// large enough for any inline_max
+static uint8_t file_buffer[1024];
+static lfs_block_t readahead_buffer[4];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+    .readahead_buffer = readahead_buffer,
+    .readahead_size = sizeof(readahead_buffer),
+};
+
+// the second file of OP_SAVE
+static uint8_t file_buffer2[1024];
+static const struct lfs_file_config file_cfg2 = {
+    .buffer = file_buffer2,
+};
+
+static bool check_size(lfs_t *lfs);
+
+static int run(lfs_t *lfs, const struct op *op, uint32_t base) {
+    lfs_file_t file;
+    uint8_t buf[333];
+    int err;
+    switch (op->type) {
+        case OP_WRITE:
+        case OP_APPEND: {
+            int flags = (op->type == OP_WRITE)
+                    ? LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC
+                    : LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND;
+            uint32_t seed = (op->type == OP_WRITE) ? op->seed : LOG_SEED;
+            err = lfs_file_opencfg(lfs, &file, paths[op->path],
+                    flags, &file_cfg);
+            if (err) {
+                return err;
+            }
+
+            // write in odd sized chunks to cross caches and blocks
+            for (uint32_t off = 0; off < op->len; off += sizeof(buf)) {
+                uint32_t n = op->len - off;
+                if (n > sizeof(buf)) {
+                    n = sizeof(buf);
+                }
+                fill(buf, seed, base+off, n);
+                lfs_ssize_t res;
+                if (op->type == OP_APPEND) {
+                    // log records go out as header, payload and trailer
+                    uint32_t h = lfs_min(n, 7);
+                    uint32_t t = lfs_min(n-h, 5);
+                    const struct lfs_iovec iov[3] = {
+                        {buf, h}, {buf+h, n-h-t}, {buf+n-t, t},
+                    };
+                    res = lfs_file_writev(lfs, &file, iov, 3);
+                } else {
+                    res = lfs_file_write(lfs, &file, buf, n);
+                }
+                if (res < 0) {
+                    lfs_file_close(lfs, &file);
+                    return res;
+                }
+            }
+
+            // the size counts what the open file holds too
+            if (!check_size(lfs)) {
+                lfs_file_close(lfs, &file);
+                return LFS_ERR_CORRUPT;
+            }
+
+            return lfs_file_close(lfs, &file);
+        }
+        case OP_RENAME:
+            return lfs_rename(lfs, paths[op->path], paths[op->path2]);
+        case OP_REMOVE:
+            return lfs_remove(lfs, paths[op->path]);
+        case OP_MKDIR:
+            return lfs_mkdir(lfs, paths[op->path]);
+        case OP_WEARLEVEL:
+            err = lfs_fs_wearlevel(lfs, 1, file_buffer);
+            return err < 0 ? err : 0;
+        case OP_SAVE: {
+            lfs_file_t files[2];
+            const struct lfs_file_config *cfgs[2] = {&file_cfg, &file_cfg2};
+            for (int i = 0; i < 2; i++) {
+                err = lfs_file_opencfg(lfs, &files[i], paths[op->path+i],
+                        LFS_O_WRONLY | LFS_O_TRUNC, cfgs[i]);
+                if (err) {
+                    if (i > 0) {
+                        lfs_file_close(lfs, &files[0]);
+                    }
+                    return err;
+                }
+            }
+
+            for (uint32_t off = 0; off < op->len && !err; off += sizeof(buf)) {
+                uint32_t n = lfs_min(op->len - off, sizeof(buf));
+                for (int i = 0; i < 2 && !err; i++) {
+                    fill(buf, op->seed ^ i, off, n);
+                    lfs_ssize_t res = lfs_file_write(lfs, &files[i], buf, n);
+                    err = (res < 0) ? (int)res : 0;
+                }
+            }
+
+            lfs_file_t *const list[2] = {&files[0], &files[1]};
+            if (!err) {
+                err = lfs_file_syncv(lfs, list, 2);
+            }
+            int err0 = lfs_file_close(lfs, &files[0]);
+            int err1 = lfs_file_close(lfs, &files[1]);
+            return err ? err : err0 ? err0 : err1;
+        }
+        case OP_TXN: {
+            lfs_txn_t txn;
+            lfs_file_t files[2];
+            const struct lfs_file_config *cfgs[2] = {&file_cfg, &file_cfg2};
+            const int txnpaths[2] = {op->path, op->path2};
+            err = lfs_txn_begin(lfs, &txn);
+            if (err) {
+                return err;
+            }
+
+            for (int i = 0; i < 2 && !err; i++) {
+                err = lfs_txn_opencfg(lfs, &txn, &files[i],
+                        paths[txnpaths[i]],
+                        LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, cfgs[i]);
+            }
+
+            for (uint32_t off = 0; off < op->len && !err; off += sizeof(buf)) {
+                uint32_t n = lfs_min(op->len - off, sizeof(buf));
+                for (int i = 0; i < 2 && !err; i++) {
+                    fill(buf, op->seed ^ i, off, n);
+                    lfs_ssize_t res = lfs_file_write(lfs, &files[i], buf, n);
+                    err = (res < 0) ? (int)res : 0;
+                }
+            }
+
+            struct lfs_info info;
+            if (!err && lfs_stat(lfs, paths[PATH_DATA+1], &info) == 0) {
+                err = lfs_txn_rename(lfs, &txn,
+                        paths[PATH_DATA+1], paths[PATH_TMP]);
+            } else if (!err && lfs_stat(lfs, paths[PATH_TMP], &info) == 0) {
+                err = lfs_txn_remove(lfs, &txn, paths[PATH_TMP]);
+            }
+
+            // the size counts what the open files hold too
+            if (!err && !check_size(lfs)) {
+                err = LFS_ERR_CORRUPT;
+            }
+
+            if (err) {
+                lfs_txn_abort(lfs, &txn);
+                return err;
+            }
+            return lfs_txn_commit(lfs, &txn);
+        }
+        case OP_KV: {
+            lfs_kv_t kv;
+            err = lfs_kv_open(lfs, &kv, paths[PATH_DIR]);
+            if (err) {
+                return err;
+            }
+
+            // values must stay around until the batch is committed
+            uint8_t values[2][64];
+            fill(values[0], op->seed, 0, op->len);
+            fill(values[1], op->seed ^ 1, 0, op->len);
+            err = lfs_kv_put(lfs, &kv, "a", values[0], op->len);
+
+            struct lfs_info info;
+            if (!err && lfs_stat(lfs, paths[op->path2], &info) == 0) {
+                err = lfs_kv_delete(lfs, &kv, "b");
+            } else if (!err) {
+                err = lfs_kv_put(lfs, &kv, "b", values[1], op->len);
+            }
+
+            if (!err) {
+                err = lfs_kv_commit(lfs, &kv);
+            }
+            int cerr = lfs_kv_close(lfs, &kv);
+            return err ? err : cerr;
+        }
+    }
+
+    return LFS_ERR_INVAL;
+}
+
+
+/// Checks ///
+
+static char failure[256];
+
+#define FAIL(...) do { \
+        snprintf(failure, sizeof(failure), __VA_ARGS__); \
+        return false; \
+    } while (0)
+
+static uint8_t seen[SRXE_BLOCK_COUNT];
+
+static int traverse_cb(void *data, lfs_block_t block) {
+    (void)data;
+    if (block >= SRXE_BLOCK_COUNT) {
+        snprintf(failure, sizeof(failure),
+                "traverse: block %"PRIu32" out of range", block);
+        return LFS_ERR_CORRUPT;
+    }
+    seen[block] += 1;
+    return 0;
+}
+
+static bool check_traverse(lfs_t *lfs) {
+    memset(seen, 0, sizeof(seen));
+    failure[0] = '\0';
+    int err = lfs_fs_traverse(lfs, traverse_cb, NULL);
+    if (err) {
+        if (!failure[0]) {
+            FAIL("traverse: %d", err);
+        }
+        return false;
+    }
+
+    // lfs_fs_traverse reports directory pairs both from the metadata list
+    // and from their parent, anything else must only be in use once
+    lfs_block_t dirpair[2] = {(lfs_block_t)-1, (lfs_block_t)-1};
+    lfs_dir_t dir;
+    err = lfs_dir_open(lfs, &dir, "d");
+    if (!err) {
+        dirpair[0] = dir.head[0];
+        dirpair[1] = dir.head[1];
+        lfs_dir_close(lfs, &dir);
+    } else if (err != LFS_ERR_NOENT) {
+        FAIL("dir_open d: %d", err);
+    }
+
+    for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+        unsigned limit = (b == dirpair[0] || b == dirpair[1]) ? 2 : 1;
+        if (seen[b] > limit) {
+            FAIL("traverse: block %"PRIu32" in use %d times", b, seen[b]);
+        }
+    }
+
+    return true;
+}
+
+static int count_cb(void *data, lfs_block_t block) {
+    (void)block;
+    *(lfs_size_t*)data += 1;
+    return 0;
+}
+
+// lfs_fs_size keeps a count as the filesystem changes, it must match
+// what a traversal finds
+static bool check_size(lfs_t *lfs) {
+    lfs_size_t count = 0;
+    int err = lfs_fs_traverse(lfs, count_cb, &count);
+    if (err) {
+        FAIL("traverse: %d", err);
+    }
+
+    // lfs_fs_traverse also reports directory pairs from their parent,
+    // lfs_fs_size doesn't
+    struct lfs_info info;
+    err = lfs_stat(lfs, paths[PATH_DIR], &info);
+    if (!err) {
+        count -= 2;
+    } else if (err != LFS_ERR_NOENT) {
+        FAIL("stat %s: %d", paths[PATH_DIR], err);
+    }
+
+    lfs_ssize_t size = lfs_fs_size(lfs);
+    if (size < 0 || (lfs_size_t)size != count) {
+        FAIL("fs_size %"PRId32", traverse counts %"PRIu32, size, count);
+    }
+    return true;
+}
+
+// returns 1 if the path matches e, 0 if not, <0 on error
+static int match(lfs_t *lfs, int path, const struct entry *e) {
+    struct lfs_info info;
+    int err = lfs_stat(lfs, paths[path], &info);
+    if (err == LFS_ERR_NOENT) {
+        return !e->exists;
+    } else if (err) {
+        return err;
+    }
+
+    if (!e->exists) {
+        return 0;
+    }
+    if (e->dir) {
+        return info.type == LFS_TYPE_DIR;
+    }
+    if (info.type != LFS_TYPE_REG || info.size != e->len) {
+        return 0;
+    }
+
+    lfs_file_t file;
+    err = lfs_file_opencfg(lfs, &file, paths[path], LFS_O_RDONLY, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[256];
+    int res = 1;
+    for (uint32_t off = 0; off < e->len && res == 1; off += sizeof(buf)) {
+        uint32_t n = e->len - off;
+        if (n > sizeof(buf)) {
+            n = sizeof(buf);
+        }
+        lfs_ssize_t r = lfs_file_read(lfs, &file, buf, n);
+        if (r < 0) {
+            res = r;
+        } else if ((uint32_t)r != n) {
+            res = 0;
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                if (buf[i] != content(e->seed, off+i)) {
+                    res = 0;
+                    break;
+                }
+            }
+        }
+    }
+
+    err = lfs_file_close(lfs, &file);
+    return err ? err : res;
+}
+
+// entries from lfs_dir_readplus, checked against lfs_dir_read
+struct listing {
+    struct lfs_info info[PATH_COUNT+2];
+    int count;
+};
+
+static int listing_cb(void *data, const struct lfs_info *info) {
+    struct listing *l = data;
+    if (l->count == (int)(PATH_COUNT+2)) {
+        return LFS_ERR_FBIG;
+    }
+    l->info[l->count++] = *info;
+    return 0;
+}
+
+static bool check_names(lfs_t *lfs, const char *dirpath, const char *prefix) {
+    lfs_dir_t dir;
+    int err = lfs_dir_open(lfs, &dir, dirpath);
+    if (err == LFS_ERR_NOENT) {
+        return true;
+    } else if (err) {
+        FAIL("dir_open %s: %d", dirpath, err);
+    }
+
+    static struct listing listing;
+    listing.count = 0;
+    err = lfs_dir_readplus(lfs, &dir, listing_cb, &listing);
+    if (!err) {
+        err = lfs_dir_rewind(lfs, &dir);
+    }
+    if (err) {
+        lfs_dir_close(lfs, &dir);
+        FAIL("dir_readplus %s: %d", dirpath, err);
+    }
+
+    struct lfs_info info;
+    int n = 0;
+    while ((err = lfs_dir_read(lfs, &dir, &info)) > 0) {
+        const struct lfs_info *plus = &listing.info[n];
+        if (n++ >= listing.count || strcmp(plus->name, info.name) != 0 ||
+                plus->type != info.type || plus->size != info.size) {
+            lfs_dir_close(lfs, &dir);
+            FAIL("dir_readplus %s disagrees at %.32s", dirpath, info.name);
+        }
+
+        if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0) {
+            continue;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "%s%.32s", prefix, info.name);
+        bool known = false;
+        for (unsigned i = 0; i < PATH_COUNT; i++) {
+            known = known || strcmp(path, paths[i]) == 0;
+        }
+        if (!known) {
+            lfs_dir_close(lfs, &dir);
+            FAIL("unexpected entry %s", path);
+        }
+    }
+
+    lfs_dir_close(lfs, &dir);
+    if (err < 0) {
+        FAIL("dir_read %s: %d", dirpath, err);
+    } else if (n != listing.count) {
+        FAIL("dir_readplus %s: %d entries, expected %d",
+                dirpath, listing.count, n);
+    }
+    return true;
+}
+
+// check the filesystem against any of the candidate states
+static bool check_state(lfs_t *lfs,
+        const struct state *const *candidates, int count) {
+    if (!check_names(lfs, "/", "") || !check_names(lfs, "d", "d/")) {
+        return false;
+    }
+
+    int lastpath = 0;
+    for (int c = 0; c < count; c++) {
+        bool ok = true;
+        for (unsigned p = 0; p < PATH_COUNT && ok; p++) {
+            int res = match(lfs, p, &candidates[c]->e[p]);
+            if (res < 0) {
+                FAIL("%s: error %d", paths[p], res);
+            }
+            if (!res) {
+                ok = false;
+                lastpath = p;
+            }
+        }
+
+        if (ok) {
+            return true;
+        }
+    }
+
+    FAIL("%s matches no expected state", paths[lastpath]);
+}
+
+
+/// Sweep ///
+
+static struct lfs_config cfg;
+static jmp_buf powerloss;
+// the filesystem and the block device's state sectors
+static uint8_t formatted[(SRXE_BLOCK_COUNT+2)*SRXE_BLOCK_SIZE];
+static volatile int current;
+static int verbose;
+
+static int run_workload(lfs_t *lfs) {
+    for (current = 0; current < steps; current++) {
+        // appends continue where the log left off
+        uint32_t base = (ops[current].type == OP_APPEND)
+                ? models[current].e[PATH_LOG].len : 0;
+        int err = run(lfs, &ops[current], base);
+        if (err) {
+            return err;
+        }
+
+        if (!check_size(lfs)) {
+            return LFS_ERR_CORRUPT;
+        }
+    }
+
+    return 0;
+}
+
+// run with power cut at op n, or no cut if n is 0
+// returns true on success, total ops are stored in ops_out
+static bool sweep_point(uint32_t n, bool torn, uint32_t *ops_out) {
+    lfs_t lfs;
+    memcpy(flash_emu_mem, formatted, sizeof(formatted));
+    flash_emu_ops = 0;
+    current = -1;
+    srxe_bd_reset();
+
+    if (setjmp(powerloss) == 0) {
+        if (n) {
+            flash_emu_cut(n, torn, &powerloss);
+        }
+
+        int err = lfs_mount(&lfs, &cfg);
+        if (err) {
+            FAIL("mount: %d", err);
+        }
+
+        failure[0] = '\0';
+        err = run_workload(&lfs);
+        if (err && failure[0]) {
+            return false;
+        } else if (err) {
+            FAIL("step %d: error %d", current, err);
+        }
+
+        err = lfs_unmount(&lfs);
+        if (err) {
+            FAIL("unmount: %d", err);
+        }
+
+        flash_emu_disarm();
+        if (ops_out) {
+            *ops_out = flash_emu_ops;
+        }
+        if (n) {
+            // the workload finished before op n
+            current = steps;
+        }
+    }
+
+    flash_emu_disarm();
+    srxe_bd_reset();
+
+    // remount after power loss
+    int err = lfs_mount(&lfs, &cfg);
+    if (err) {
+        FAIL("remount: %d", err);
+    }
+
+    // any state between the interrupted step and the next is fine
+    int step = current < 0 ? 0 : current;
+    const struct state *all[3];
+    int count = 0;
+    all[count++] = &models[step];
+    if (step < steps) {
+        all[count++] = &models[step+1];
+    }
+
+    // creating a file commits an empty file before its contents
+    struct state created;
+    if (step < steps && (ops[step].type == OP_WRITE
+            || ops[step].type == OP_APPEND)
+            && !models[step].e[ops[step].path].exists) {
+        created = models[step];
+        created.e[ops[step].path] = (struct entry){true, false, 0, 0};
+        all[count++] = &created;
+    }
+
+    // counting now means the fixes below must keep the count
+    if (!check_traverse(&lfs) || !check_state(&lfs, all, count)
+            || !check_size(&lfs)) {
+        lfs_unmount(&lfs);
+        return false;
+    }
+
+    // the filesystem must still be writable, this also fixes up any
+    // orphans or moves left behind
+    lfs_file_t file;
+    err = lfs_file_opencfg(&lfs, &file, "after",
+            LFS_O_WRONLY | LFS_O_CREAT, &file_cfg);
+    if (!err) {
+        lfs_ssize_t res = lfs_file_write(&lfs, &file, "after", 5);
+        err = lfs_file_close(&lfs, &file);
+        if (res < 0) {
+            err = res;
+        }
+    }
+    if (!err) {
+        err = lfs_remove(&lfs, "after");
+    }
+    if (err) {
+        lfs_unmount(&lfs);
+        FAIL("write after remount: %d", err);
+    }
+
+    if (!check_size(&lfs)) {
+        lfs_unmount(&lfs);
+        return false;
+    }
+
+    err = lfs_unmount(&lfs);
+    if (err) {
+        FAIL("unmount after remount: %d", err);
+    }
+
+    // and still be consistent after another mount
+    err = lfs_mount(&lfs, &cfg);
+    if (err) {
+        FAIL("second remount: %d", err);
+    }
+    bool ok = check_traverse(&lfs) && check_state(&lfs, all, count);
+    lfs_unmount(&lfs);
+    return ok;
+}
+
+static const char *op_name(const struct op *op) {
+    static char buf[64];
+    switch (op->type) {
+        case OP_WRITE:
+            snprintf(buf, sizeof(buf), "write %s %"PRIu32,
+                    paths[op->path], op->len);
+            break;
+        case OP_APPEND:
+            snprintf(buf, sizeof(buf), "append %s %"PRIu32,
+                    paths[op->path], op->len);
+            break;
+        case OP_RENAME:
+            snprintf(buf, sizeof(buf), "rename %s %s",
+                    paths[op->path], paths[op->path2]);
+            break;
+        case OP_REMOVE:
+            snprintf(buf, sizeof(buf), "remove %s", paths[op->path]);
+            break;
+        case OP_MKDIR:
+            snprintf(buf, sizeof(buf), "mkdir %s", paths[op->path]);
+            break;
+        case OP_WEARLEVEL:
+            snprintf(buf, sizeof(buf), "wearlevel");
+            break;
+        case OP_SAVE:
+            snprintf(buf, sizeof(buf), "save %s %s %"PRIu32,
+                    paths[op->path], paths[op->path2], op->len);
+            break;
+        case OP_TXN:
+            snprintf(buf, sizeof(buf), "txn %s %s %"PRIu32,
+                    paths[op->path], paths[op->path2], op->len);
+            break;
+        case OP_KV:
+            snprintf(buf, sizeof(buf), "kv %s %s %"PRIu32,
+                    paths[op->path], paths[op->path2], op->len);
+            break;
+    }
+    return buf;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-t] [-k] [-v] [-S seed] [-W workloads] [-n steps]\n"
+            "          [-s first] [-e last] [-c block_cycles] [-b block]\n"
+            "          [-i inline_max] [-m metadata_max]\n"
+            "\n"
+            "  -t  tear the interrupted program/erase instead of skipping it\n"
+            "  -k  keep going after a failure\n"
+            "  -v  print every step of the workload\n"
+            "  -S  first workload seed (1)\n"
+            "  -W  number of workloads to sweep (1)\n"
+            "  -n  steps per workload (64)\n"
+            "  -s  first cut point (1)\n"
+            "  -e  last cut point (every op in the workload)\n"
+            "  -c  override block_cycles (%"PRId32")\n"
+            "  -b  make a block go bad after formatting, may be repeated\n"
+            "  -i  override inline_max (%"PRIu32", -1 disables)\n"
+            "  -m  override metadata_max, compacting more often (%"PRIu32")\n",
+            name, srxe_cfg.block_cycles, srxe_cfg.inline_max,
+            srxe_cfg.block_size);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool torn = false;
+    bool keepgoing = false;
+    uint32_t seed = 1;
+    uint32_t workloads = 1;
+    int count = 64;
+    uint32_t first = 1;
+    uint32_t last = 0;
+    uint8_t bad[SRXE_BLOCK_COUNT] = {0};
+    cfg = srxe_cfg;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "tkvS:W:n:s:e:c:b:i:m:")) != -1) {
+        switch (opt) {
+            case 't': torn = true; break;
+            case 'k': keepgoing = true; break;
+            case 'v': verbose = 1; break;
+            case 'S': seed = strtoul(optarg, NULL, 0); break;
+            case 'W': workloads = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtol(optarg, NULL, 0); break;
+            case 's': first = strtoul(optarg, NULL, 0); break;
+            case 'e': last = strtoul(optarg, NULL, 0); break;
+            case 'c': cfg.block_cycles = strtol(optarg, NULL, 0); break;
+            case 'i': cfg.inline_max = strtol(optarg, NULL, 0); break;
+            case 'm': cfg.metadata_max = strtoul(optarg, NULL, 0); break;
+            case 'b': {
+                unsigned long block = strtoul(optarg, NULL, 0);
+                // the superblock can't be relocated
+                if (block < 2 || block >= SRXE_BLOCK_COUNT) {
+                    usage(argv[0]);
+                }
+                bad[block] = 1;
+                break;
+            }
+            default: usage(argv[0]);
+        }
+    }
+    lfs_size_t metadata_max = cfg.metadata_max ? cfg.metadata_max
+            : cfg.block_size;
+    if (count < 1 || count > STEPS_MAX-2 || first < 1
+            || metadata_max > cfg.block_size
+            || (cfg.inline_max != (lfs_size_t)-1
+                && cfg.inline_max > metadata_max/8)) {
+        usage(argv[0]);
+    }
+
+    kv_max = (cfg.inline_max == (lfs_size_t)-1) ? 0
+            : (cfg.inline_max && cfg.inline_max < 64) ? cfg.inline_max
+            : 64;
+
+    // format once and reuse the image for every run
+    flash_emu_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (err) {
+        fprintf(stderr, "format: %d\n", err);
+        return 1;
+    }
+    memcpy(formatted, flash_emu_mem, sizeof(formatted));
+    for (lfs_block_t b = 0; b < SRXE_BLOCK_COUNT; b++) {
+        flash_emu_setbad(b, bad[b]);
+    }
+
+    uint32_t points = 0;
+    uint32_t failures = 0;
+    clock_t start = clock();
+    for (uint32_t w = seed; w < seed + workloads; w++) {
+        generate(w, count);
+
+        if (verbose) {
+            for (int i = 0; i < steps; i++) {
+                printf("workload %"PRIu32" step %d: %s\n",
+                        w, i, op_name(&ops[i]));
+            }
+        }
+
+        // dry run to find the number of cut points
+        uint32_t total = 0;
+        uint32_t relocations = lfs_log_count(LFS_LOG_MD_RELOCATE);
+        if (!sweep_point(0, false, &total)) {
+            fprintf(stderr, "workload %"PRIu32": fails without power loss:"
+                    " %s\n", w, failure);
+            return 1;
+        }
+        relocations = lfs_log_count(LFS_LOG_MD_RELOCATE) - relocations;
+
+        uint32_t end = (last && last < total) ? last : total;
+        for (uint32_t n = first; n <= end; n++) {
+            points += 1;
+            if (!sweep_point(n, torn, NULL)) {
+                failures += 1;
+                printf("workload %"PRIu32" cut %"PRIu32"/%"PRIu32
+                        " during step %d (%s): %s\n",
+                        w, n, total, current,
+                        current >= 0 && current < steps
+                            ? op_name(&ops[current]) : "-",
+                        failure);
+                if (!keepgoing) {
+                    return 1;
+                }
+            }
+        }
+
+        printf("workload %"PRIu32": %d steps, %"PRIu32" cut points, "
+                "%"PRIu32" relocations\n",
+                w, steps, end >= first ? end - first + 1 : 0, relocations);
+    }
+
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%"PRIu32" cut points, %"PRIu32" failures, %.1fs (%.0f/min)\n",
+            points, failures, secs, secs > 0 ? points / secs * 60 : 0.0);
+    return failures ? 1 : 0;
+}
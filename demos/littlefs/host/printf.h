@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for srxecore's printf
+ */
+#ifndef PRINTF_H
+#define PRINTF_H
+
+#include <stdio.h>
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Metadata commit benchmark for lfs_config.prog_size
+ *
+ * Rewrites small inline files, the way the demo keeps its settings, so
+ * every rewrite is a single metadata commit. littlefs pads each commit to
+ * prog_size, so the smaller it is, the more commits fit in a metadata
+ * block before the pair has to be compacted. This is run once for every
+ * prog_size in the sweep, from the 256 byte flash page down. For each run
+ * it reports the commits per compaction, the bytes programmed per commit
+ * and the modeled time per commit including compactions, see flash_emu.h
+ * for the timing model.
+ *
+ *     ./progbench              # 8 files of 16..64 bytes, 64 rewrites
+ *     ./progbench -N 24 -R 16
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "lfs_log.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+// prog_size values to sweep
+static const lfs_size_t sweep[] = {
+    256, 64, 16,
+};
+#define SWEEP_COUNT (sizeof(sweep)/sizeof(sweep[0]))
+
+#define FILES_MAX 64
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+struct result {
+    uint32_t commits;
+    uint32_t compacts;
+    uint64_t prog_bytes;
+    uint64_t time_us;
+};
+
+static int write_file(lfs_t *lfs, const char *name,
+        uint32_t seed, uint32_t size) {
+    uint8_t buf[64];
+    for (uint32_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)(seed*2654435761u >> 24) ^ (uint8_t)i;
+    }
+
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, name,
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    lfs_ssize_t res = lfs_file_write(lfs, &file, buf, size);
+    err = lfs_file_close(lfs, &file);
+    return (res < 0) ? (int)res : err;
+}
+
+static int run(lfs_size_t prog_size, int count, uint32_t maxsize,
+        int rewrites, struct result *r) {
+    struct lfs_config cfg = srxe_cfg;
+    cfg.prog_size = prog_size;
+
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    // create the files first, then measure only the rewrites
+    char name[12];
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "s%02d", i);
+        err = write_file(&lfs, name, i, 16);
+        if (err) {
+            return err;
+        }
+    }
+
+    uint32_t compacts = lfs_log_count(LFS_LOG_MD_COMPACT);
+    struct flash_emu_stats before = flash_emu_stats;
+    for (int j = 1; j <= rewrites; j++) {
+        for (int i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "s%02d", i);
+            err = write_file(&lfs, name, i + j*FILES_MAX,
+                    16 + (i*7 + j) % (maxsize - 16 + 1));
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    r->commits = rewrites*count;
+    r->compacts = lfs_log_count(LFS_LOG_MD_COMPACT) - compacts;
+    r->prog_bytes = flash_emu_stats.prog_bytes - before.prog_bytes;
+    r->time_us = flash_emu_stats.time_us - before.time_us;
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-N files] [-m max_size] [-R rewrites]\n"
+            "\n"
+            "  -N  number of files, at most %d (8)\n"
+            "  -m  largest file size, 16..64 (64)\n"
+            "  -R  times every file is rewritten (64)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int count = 8;
+    uint32_t maxsize = 64;
+    int rewrites = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:m:R:")) != -1) {
+        switch (opt) {
+            case 'N': count = strtol(optarg, NULL, 0); break;
+            case 'm': maxsize = strtoul(optarg, NULL, 0); break;
+            case 'R': rewrites = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 1 || count > FILES_MAX || maxsize < 16 || maxsize > 64
+            || rewrites < 1) {
+        usage(argv[0]);
+    }
+
+    printf("%d files of 16..%"PRIu32" bytes, %d rewrites\n",
+            count, maxsize, rewrites);
+    printf("%-9s %8s %8s %14s %12s %11s\n",
+            "prog_size", "commits", "compacts", "commits/compact",
+            "prog(B)/commit", "ms/commit");
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        struct result r;
+        int err = run(sweep[i], count, maxsize, rewrites, &r);
+        if (err) {
+            fprintf(stderr, "prog_size %"PRIu32": error %d\n",
+                    sweep[i], err);
+            return 1;
+        }
+
+        printf("%-9"PRIu32" %8"PRIu32" %8"PRIu32" %14.1f %12.1f %11.2f\n",
+                sweep[i], r.commits, r.compacts,
+                r.compacts ? (double)r.commits / r.compacts : 0.0,
+                (double)r.prog_bytes / r.commits,
+                r.time_us / 1000.0 / r.commits);
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * UI responsiveness benchmark for saving a file on the SRXE
+ *
+ * Models a UI loop that spends a frame's worth of time on other work and
+ * then hands the filesystem the next record of a document being saved,
+ * followed by a sync. The save is run once with lfs_file_write and
+ * lfs_file_sync, which wait for every erase, and once with
+ * lfs_file_write_nb and lfs_file_sync_nb, which return while an erase is
+ * in flight. For each it reports the total save time and how long the
+ * longest single call held up the UI, see flash_emu.h for the timing
+ * model.
+ *
+ *     ./savebench                  # 16 KiB in 64 byte records
+ *     ./savebench -f 8192 -u 5000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+#define FRAME_BUDGET_US 20000
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+struct result {
+    uint64_t total_us;
+    uint64_t worst_us;
+    uint32_t frames;
+    uint32_t late;
+};
+
+static int save(lfs_t *lfs, bool nb, uint32_t size, uint32_t chunk,
+        uint32_t frame_us, struct result *r) {
+    memset(r, 0, sizeof(*r));
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, "document",
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    flash_emu_resetstats();
+    uint8_t buf[512];
+    uint32_t off = 0;
+    bool synced = false;
+    while (!synced) {
+        flash_emu_idle(frame_us);
+        r->frames += 1;
+
+        uint64_t t = flash_emu_stats.time_us;
+        int res;
+        if (off < size) {
+            uint32_t n = lfs_min(size - off, chunk);
+            for (uint32_t i = 0; i < n; i++) {
+                buf[i] = (uint8_t)(off + i);
+            }
+            res = nb
+                    ? lfs_file_write_nb(lfs, &file, buf, n)
+                    : lfs_file_write(lfs, &file, buf, n);
+            if (res >= 0) {
+                off += res;
+            }
+        } else {
+            res = nb
+                    ? lfs_file_sync_nb(lfs, &file)
+                    : lfs_file_sync(lfs, &file);
+            synced = (res == 0);
+        }
+
+        uint64_t stall = flash_emu_stats.time_us - t;
+        r->worst_us = lfs_max(r->worst_us, stall);
+        if (frame_us + stall > FRAME_BUDGET_US) {
+            r->late += 1;
+        }
+
+        if (res < 0 && res != LFS_ERR_INPROGRESS) {
+            lfs_file_close(lfs, &file);
+            return res;
+        }
+    }
+
+    r->total_us = flash_emu_stats.time_us;
+    err = lfs_file_close(lfs, &file);
+    if (err) {
+        return err;
+    }
+
+    // make sure the document made it
+    err = lfs_file_opencfg(lfs, &file, "document", LFS_O_RDONLY, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    for (off = 0; off < size && !err; off += sizeof(buf)) {
+        lfs_ssize_t res = lfs_file_read(lfs, &file, buf, sizeof(buf));
+        if (res < 0) {
+            err = res;
+        } else if ((uint32_t)res != lfs_min(size - off, sizeof(buf))) {
+            err = LFS_ERR_CORRUPT;
+        }
+        for (lfs_ssize_t i = 0; i < res && !err; i++) {
+            if (buf[i] != (uint8_t)(off + i)) {
+                err = LFS_ERR_CORRUPT;
+            }
+        }
+    }
+
+    int cerr = lfs_file_close(lfs, &file);
+    return err ? err : cerr;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-f file_size] [-c chunk] [-u frame_us]\n"
+            "\n"
+            "  -f  size of the saved document in bytes (16384)\n"
+            "  -c  size of each record, 1..512 (64)\n"
+            "  -u  time spent on other work every frame in us (2000)\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t size = 16*1024;
+    uint32_t chunk = 64;
+    uint32_t frame_us = 2000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:c:u:")) != -1) {
+        switch (opt) {
+            case 'f': size = strtoul(optarg, NULL, 0); break;
+            case 'c': chunk = strtoul(optarg, NULL, 0); break;
+            case 'u': frame_us = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (size < 1 || chunk < 1 || chunk > 512) {
+        usage(argv[0]);
+    }
+
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &srxe_cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (err) {
+        fprintf(stderr, "mount: %d\n", err);
+        return 1;
+    }
+
+    printf("%"PRIu32" bytes in %"PRIu32" byte records, %"PRIu32" us "
+            "frames, late over %d ms\n",
+            size, chunk, frame_us, FRAME_BUDGET_US/1000);
+    printf("%-9s %8s %10s %10s %6s\n",
+            "mode", "frames", "total(ms)", "worst(ms)", "late");
+    for (int nb = 0; nb < 2; nb++) {
+        struct result r;
+        err = save(&lfs, nb, size, chunk, frame_us, &r);
+        if (err) {
+            fprintf(stderr, "%s: error %d\n",
+                    nb ? "nonblock" : "blocking", err);
+            return 1;
+        }
+
+        printf("%-9s %8"PRIu32" %10.1f %10.1f %6"PRIu32"\n",
+                nb ? "nonblock" : "blocking", r.frames,
+                r.total_us / 1000.0, r.worst_us / 1000.0, r.late);
+    }
+
+    return lfs_unmount(&lfs) ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+/*
+ * Host stand-in for the demo's screen output
+ */
+#include <stdio.h>
+
+#include "screen.h"
+
+void printLine(const char *line) {
+    fprintf(stderr, "%s\n", line);
+}
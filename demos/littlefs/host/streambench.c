@@ -0,0 +1,274 @@
+/*
+ * Sequential read benchmark for the SRXE littlefs configuration
+ *
+ * Writes one large file, then streams it back in small reads the way an
+ * audio or graphics asset would be, once for every read-ahead size in the
+ * sweep. For each run it reports the number of flash reads and the
+ * modeled read time against reading the same blocks raw, see flash_emu.h
+ * for the timing model.
+ *
+ * Afterwards it rewrites a file of changing size through one LFS_O_RDWR
+ * handle with read-ahead, and reads it back every time the allocator
+ * hands out the head block the read-ahead table was filled for again, to
+ * check a rewrite never leaves the table pointing at old blocks.
+ *
+ *     ./streambench                # 96 KiB file in 64 byte reads
+ *     ./streambench -f 65536 -c 16
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+// read-ahead sizes to sweep, in blocks
+static const lfs_size_t sweep[] = {
+    0, 2, 4, 8, 16, 32,
+};
+#define SWEEP_COUNT (sizeof(sweep)/sizeof(sweep[0]))
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static lfs_block_t readahead_buffer[32];
+
+static uint8_t content(uint32_t i) {
+    return (uint8_t)(i*7 + (i >> 8));
+}
+
+static int populate(lfs_t *lfs, uint32_t size) {
+    const struct lfs_file_config file_cfg = {.buffer = file_buffer};
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, "asset",
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[256];
+    for (uint32_t off = 0; off < size && !err; off += sizeof(buf)) {
+        uint32_t n = lfs_min(size - off, sizeof(buf));
+        for (uint32_t i = 0; i < n; i++) {
+            buf[i] = content(off+i);
+        }
+        lfs_ssize_t res = lfs_file_write(lfs, &file, buf, n);
+        if (res < 0) {
+            err = res;
+        }
+    }
+
+    int cerr = lfs_file_close(lfs, &file);
+    return err ? err : cerr;
+}
+
+static int stream(lfs_t *lfs, lfs_size_t readahead,
+        uint32_t size, uint32_t chunk) {
+    const struct lfs_file_config file_cfg = {
+        .buffer = file_buffer,
+        .readahead_buffer = readahead_buffer,
+        .readahead_size = readahead*sizeof(lfs_block_t),
+    };
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, "asset", LFS_O_RDONLY, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[512];
+    for (uint32_t off = 0; off < size && !err; off += chunk) {
+        lfs_ssize_t res = lfs_file_read(lfs, &file, buf, chunk);
+        if (res < 0) {
+            err = res;
+            break;
+        }
+
+        for (lfs_ssize_t i = 0; i < res; i++) {
+            if (buf[i] != content(off+i)) {
+                err = LFS_ERR_CORRUPT;
+                break;
+            }
+        }
+    }
+
+    int cerr = lfs_file_close(lfs, &file);
+    return err ? err : cerr;
+}
+
+#define REWRITES 100
+
+static uint8_t rewrite_content(int gen, uint32_t i) {
+    return (uint8_t)(gen*0x35) ^ content(i);
+}
+
+static int rewrite_check(lfs_t *lfs, lfs_file_t *file, int gen, uint32_t size) {
+    lfs_soff_t pos = lfs_file_seek(lfs, file, 0, LFS_SEEK_SET);
+    if (pos < 0) {
+        return pos;
+    }
+
+    uint8_t buf[64];
+    for (uint32_t off = 0; off < size; off += sizeof(buf)) {
+        lfs_ssize_t res = lfs_file_read(lfs, file, buf, sizeof(buf));
+        if (res < 0) {
+            return res;
+        }
+
+        for (lfs_ssize_t i = 0; i < res; i++) {
+            if (buf[i] != rewrite_content(gen, off+i)) {
+                fprintf(stderr, "rewrite %d: byte %"PRIu32" is %02x, "
+                        "not %02x\n", gen, off+(uint32_t)i, buf[i],
+                        rewrite_content(gen, off+i));
+                return LFS_ERR_CORRUPT;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int rewrite(lfs_t *lfs, lfs_file_t *file, int gen, uint32_t size) {
+    int err = lfs_file_truncate(lfs, file, 0);
+    lfs_soff_t pos = err ? err : lfs_file_seek(lfs, file, 0, LFS_SEEK_SET);
+    if (pos < 0) {
+        return pos;
+    }
+
+    uint8_t buf[256];
+    for (uint32_t off = 0; off < size; off += sizeof(buf)) {
+        uint32_t n = lfs_min(size - off, sizeof(buf));
+        for (uint32_t i = 0; i < n; i++) {
+            buf[i] = rewrite_content(gen, off+i);
+        }
+        lfs_ssize_t res = lfs_file_write(lfs, file, buf, n);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    return lfs_file_sync(lfs, file);
+}
+
+// rewrite one file through a handle that keeps its read-ahead table,
+// returns how many times the table's head came back
+static int rewrites(lfs_t *lfs) {
+    const struct lfs_file_config file_cfg = {
+        .buffer = file_buffer,
+        .readahead_buffer = readahead_buffer,
+        .readahead_size = 8*sizeof(lfs_block_t),
+    };
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, "rewrite",
+            LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    err = rewrite(lfs, &file, 0, 12000);
+    if (!err) {
+        err = rewrite_check(lfs, &file, 0, 12000);
+    }
+
+    int repeats = 0;
+    lfs_block_t head = file.ctz.head;
+    for (int gen = 1; gen < REWRITES && !err; gen++) {
+        uint32_t size = 4200 + (gen*3089) % 12000;
+        err = rewrite(lfs, &file, gen, size);
+        if (!err && file.ctz.head == head) {
+            repeats += 1;
+            err = rewrite_check(lfs, &file, gen, size);
+        }
+    }
+
+    int cerr = lfs_file_close(lfs, &file);
+    err = err ? err : cerr;
+    return err ? err : repeats;
+}
+
+static int count_block(void *p, lfs_block_t block) {
+    (void)block;
+    *(lfs_size_t*)p += 1;
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-f file_size] [-c chunk]\n"
+            "\n"
+            "  -f  size of the streamed file in bytes (98304)\n"
+            "  -c  size of each read, 1..512 (64)\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t size = 96*1024;
+    uint32_t chunk = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:c:")) != -1) {
+        switch (opt) {
+            case 'f': size = strtoul(optarg, NULL, 0); break;
+            case 'c': chunk = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (size < 1 || chunk < 1 || chunk > 512) {
+        usage(argv[0]);
+    }
+
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &srxe_cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (!err) {
+        err = populate(&lfs, size);
+    }
+    if (err) {
+        fprintf(stderr, "populate: %d\n", err);
+        return 1;
+    }
+
+    // the same blocks read with one command each, as fast as the bus goes
+    lfs_size_t blocks = 0;
+    lfs_fs_traverse(&lfs, count_block, &blocks);
+    double raw_ms = (blocks*FLASH_EMU_T_CMD + size*FLASH_EMU_T_BYTE) / 1000.0;
+
+    printf("%"PRIu32" byte file in %"PRIu32" byte reads, raw %.2f ms\n",
+            size, chunk, raw_ms);
+    printf("%9s %8s %10s %8s\n", "readahead", "reads", "read(ms)", "of raw");
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        flash_emu_resetstats();
+        err = stream(&lfs, sweep[i], size, chunk);
+        if (err) {
+            fprintf(stderr, "readahead %"PRIu32": error %d\n", sweep[i], err);
+            return 1;
+        }
+
+        double ms = flash_emu_stats.time_us / 1000.0;
+        printf("%9"PRIu32" %8"PRIu64" %10.2f %7.1f%%\n",
+                sweep[i], flash_emu_stats.reads, ms, 100.0 * raw_ms / ms);
+    }
+
+    // an empty filesystem, so the allocator comes back around quickly
+    err = lfs_unmount(&lfs);
+    if (!err) {
+        err = lfs_format(&lfs, &srxe_cfg);
+    }
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    int repeats = err ? err : rewrites(&lfs);
+    if (repeats < 0) {
+        fprintf(stderr, "rewrites: error %d\n", repeats);
+        return 1;
+    }
+    printf("%d rewrites, head reused %d times, read back ok\n",
+            REWRITES, repeats);
+
+    return lfs_unmount(&lfs) ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Save-all benchmark for lfs_file_syncv
+ *
+ * Keeps the demo's state files open, a few small settings files and a
+ * larger document, and saves all of them at once the way the demo's
+ * periodic "save all state" does, after changing every one. The saves
+ * are run once syncing each file with lfs_file_sync, one metadata commit
+ * each, and once with a single lfs_file_syncv. For each it reports the
+ * programs, bytes programmed, compactions and modeled time per save, see
+ * flash_emu.h for the timing model and bench_util.h for the files.
+ *
+ *     ./syncbench              # 5 files, 64 saves
+ *     ./syncbench -N 8 -R 16
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+#include "bench_util.h"
+
+
+#define FILES_MAX LFS_SYNCV_MAX
+
+static uint8_t file_buffers[FILES_MAX][SRXE_FILE_BUFFER_SIZE];
+static struct lfs_file_config file_cfgs[FILES_MAX];
+
+// replace the contents of file i with those of a save
+static int change(lfs_t *lfs, lfs_file_t *file, int i, int count, int save) {
+    int err = lfs_file_truncate(lfs, file, 0);
+    if (!err) {
+        err = lfs_file_rewind(lfs, file);
+    }
+    if (!err) {
+        err = bench_file_write(lfs, file, i, count, save);
+    }
+
+    return err;
+}
+
+static int run(bool grouped, int count, int saves,
+        struct bench_result *r, uint32_t *crc) {
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &srxe_cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    lfs_file_t files[FILES_MAX];
+    lfs_file_t *list[FILES_MAX];
+    for (int i = 0; i < count; i++) {
+        char name[12];
+        snprintf(name, sizeof(name), "s%02d", i);
+        file_cfgs[i].buffer = file_buffers[i];
+        err = lfs_file_opencfg(&lfs, &files[i], name,
+                LFS_O_RDWR | LFS_O_CREAT, &file_cfgs[i]);
+        if (err) {
+            return err;
+        }
+        list[i] = &files[i];
+    }
+
+    bench_begin(r);
+    for (int save = 0; save < saves; save++) {
+        for (int i = 0; i < count; i++) {
+            err = change(&lfs, &files[i], i, count, save);
+            if (err) {
+                return err;
+            }
+        }
+
+        if (grouped) {
+            err = lfs_file_syncv(&lfs, list, count);
+        } else {
+            for (int i = 0; i < count && !err; i++) {
+                err = lfs_file_sync(&lfs, &files[i]);
+            }
+        }
+        if (err) {
+            return err;
+        }
+    }
+
+    bench_end(r);
+
+    for (int i = 0; i < count; i++) {
+        err = lfs_file_close(&lfs, &files[i]);
+        if (err) {
+            return err;
+        }
+    }
+
+    // check what a remount sees
+    err = lfs_unmount(&lfs);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (!err) {
+        err = bench_digest(&lfs, NULL, count, &file_cfgs[0], crc);
+    }
+    if (err) {
+        return err;
+    }
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-N files] [-R saves]\n"
+            "\n"
+            "  -N  number of files, 2..%d (5)\n"
+            "  -R  number of saves (64)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int count = 5;
+    int saves = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:R:")) != -1) {
+        switch (opt) {
+            case 'N': count = strtol(optarg, NULL, 0); break;
+            case 'R': saves = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 2 || count > FILES_MAX || saves < 1) {
+        usage(argv[0]);
+    }
+
+    printf("%d files, %d saves\n", count, saves);
+    printf("%-8s", "sync");
+    bench_head_progs("save");
+    printf("\n");
+    uint32_t crcs[2];
+    for (int grouped = 0; grouped < 2; grouped++) {
+        struct bench_result r;
+        int err = run(grouped, count, saves, &r, &crcs[grouped]);
+        if (err) {
+            fprintf(stderr, "%s: error %d\n",
+                    grouped ? "syncv" : "sync", err);
+            return 1;
+        }
+
+        printf("%-8s", grouped ? "syncv" : "sync");
+        bench_print_progs(&r, saves);
+        printf("\n");
+    }
+
+    if (crcs[0] != crcs[1]) {
+        fprintf(stderr, "file contents differ\n");
+        return 1;
+    }
+
+    return 0;
+}
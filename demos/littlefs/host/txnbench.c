@@ -0,0 +1,183 @@
+/*
+ * Multi-file update benchmark for lfs_txn_commit
+ *
+ * Replaces a set of related files together, the way the demo updates its
+ * settings, an index and a larger document, so that a power loss never
+ * leaves some of them old and some new. This is run once the way it has
+ * to be done without transactions, writing each file to a temporary file
+ * and renaming it over the old one, a commit for the file and another
+ * for the rename, and once staging the files in one transaction, which
+ * commits them all at once. For each it reports the programs, bytes
+ * programmed, compactions and modeled time per update, see flash_emu.h
+ * for the timing model and bench_util.h for the files.
+ *
+ *     ./txnbench               # 3 files, 64 updates
+ *     ./txnbench -N 4 -R 16
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+#include "bench_util.h"
+
+
+#define FILES_MAX LFS_TXN_MAX
+
+static uint8_t file_buffers[FILES_MAX][SRXE_FILE_BUFFER_SIZE];
+static struct lfs_file_config file_cfgs[FILES_MAX];
+
+// write each file to a temporary file and rename it into place
+static int update_rename(lfs_t *lfs, int count, int update) {
+    for (int i = 0; i < count; i++) {
+        char name[12];
+        char tmp[16];
+        snprintf(name, sizeof(name), "s%02d", i);
+        snprintf(tmp, sizeof(tmp), "s%02d.tmp", i);
+
+        lfs_file_t file;
+        int err = lfs_file_opencfg(lfs, &file, tmp,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfgs[i]);
+        if (err) {
+            return err;
+        }
+
+        err = bench_file_write(lfs, &file, i, count, update);
+        int cerr = lfs_file_close(lfs, &file);
+        if (err || cerr) {
+            return err ? err : cerr;
+        }
+
+        err = lfs_rename(lfs, tmp, name);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+// stage every file in one transaction
+static int update_txn(lfs_t *lfs, int count, int update) {
+    lfs_txn_t txn;
+    int err = lfs_txn_begin(lfs, &txn);
+    if (err) {
+        return err;
+    }
+
+    // paths are looked up again when the transaction commits
+    lfs_file_t files[FILES_MAX];
+    char names[FILES_MAX][12];
+    for (int i = 0; i < count && !err; i++) {
+        snprintf(names[i], sizeof(names[i]), "s%02d", i);
+        err = lfs_txn_opencfg(lfs, &txn, &files[i], names[i],
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfgs[i]);
+        if (!err) {
+            err = bench_file_write(lfs, &files[i], i, count, update);
+        }
+    }
+
+    if (err) {
+        lfs_txn_abort(lfs, &txn);
+        return err;
+    }
+    return lfs_txn_commit(lfs, &txn);
+}
+
+static int run(bool txn, int count, int updates,
+        struct bench_result *r, uint32_t *crc) {
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &srxe_cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    bench_begin(r);
+    for (int update = 0; update < updates; update++) {
+        err = txn
+                ? update_txn(&lfs, count, update)
+                : update_rename(&lfs, count, update);
+        if (err) {
+            return err;
+        }
+    }
+
+    bench_end(r);
+
+    // check what a remount sees
+    err = lfs_unmount(&lfs);
+    if (!err) {
+        err = lfs_mount(&lfs, &srxe_cfg);
+    }
+    if (!err) {
+        err = bench_digest(&lfs, NULL, count, &file_cfgs[0], crc);
+    }
+    if (err) {
+        return err;
+    }
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-N files] [-R updates]\n"
+            "\n"
+            "  -N  number of files, 2..%d (3)\n"
+            "  -R  number of updates (64)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int count = 3;
+    int updates = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:R:")) != -1) {
+        switch (opt) {
+            case 'N': count = strtol(optarg, NULL, 0); break;
+            case 'R': updates = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 2 || count > FILES_MAX || updates < 1) {
+        usage(argv[0]);
+    }
+
+    for (int i = 0; i < FILES_MAX; i++) {
+        file_cfgs[i].buffer = file_buffers[i];
+    }
+
+    printf("%d files, %d updates\n", count, updates);
+    printf("%-8s", "update");
+    bench_head_progs("update");
+    printf("\n");
+    uint32_t crcs[2];
+    for (int txn = 0; txn < 2; txn++) {
+        struct bench_result r;
+        int err = run(txn, count, updates, &r, &crcs[txn]);
+        if (err) {
+            fprintf(stderr, "%s: error %d\n", txn ? "txn" : "rename", err);
+            return 1;
+        }
+
+        printf("%-8s", txn ? "txn" : "rename");
+        bench_print_progs(&r, updates);
+        printf("\n");
+    }
+
+    if (crcs[0] != crcs[1]) {
+        fprintf(stderr, "file contents differ\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Sequential write benchmark for lfs_config.verify
+ *
+ * Writes a large file from scratch a few times, in small writes the way
+ * the demo logs data, once for every verify policy in the sweep: reading
+ * every program back into the read cache, comparing a CRC from srxe_crc
+ * instead, checking only a sample of programs, and leaving the checks to
+ * srxe_prog, which reads back every page it programs in all of these
+ * runs. For each run it reports the flash reads, bytes read and modeled
+ * write throughput, see flash_emu.h for the timing model.
+ *
+ *     ./verifybench            # 32 KiB file in 64 byte writes, 8 times
+ *     ./verifybench -s 16384 -w 256
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+#include "bench_util.h"
+
+
+struct policy {
+    const char *name;
+    int verify;
+    lfs_size_t verify_interval;
+    bool crc;
+};
+
+// verify policies to sweep
+static const struct policy sweep[] = {
+    {"readback",    LFS_VERIFY_ALL,     0,  false},
+    {"crc",         LFS_VERIFY_ALL,     0,  true},
+    {"sampled/8",   LFS_VERIFY_SAMPLED, 8,  true},
+    {"none",        LFS_VERIFY_NONE,    0,  false},
+};
+#define SWEEP_COUNT (sizeof(sweep)/sizeof(sweep[0]))
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+static int write_file(lfs_t *lfs, uint32_t seed, uint32_t size,
+        uint32_t wsize) {
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, "log",
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[256];
+    for (uint32_t off = 0; off < size; off += wsize) {
+        uint32_t n = lfs_min(wsize, size - off);
+        for (uint32_t j = 0; j < n; j++) {
+            buf[j] = bench_byte(seed, off + j);
+        }
+
+        lfs_ssize_t res = lfs_file_write(lfs, &file, buf, n);
+        if (res < 0) {
+            lfs_file_close(lfs, &file);
+            return res;
+        }
+    }
+
+    return lfs_file_close(lfs, &file);
+}
+
+static int run(const struct policy *p, uint32_t size, uint32_t wsize,
+        int count, struct bench_result *r) {
+    struct lfs_config cfg = srxe_cfg;
+    cfg.verify = p->verify;
+    cfg.verify_interval = p->verify_interval;
+    cfg.crc = p->crc ? srxe_crc : NULL;
+
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (err) {
+        return err;
+    }
+
+    bench_begin(r);
+    for (int i = 0; i < count; i++) {
+        err = write_file(&lfs, i, size, wsize);
+        if (err) {
+            return err;
+        }
+    }
+
+    bench_end(r);
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-s size] [-w write_size] [-n count]\n"
+            "\n"
+            "  -s  file size in bytes (32768)\n"
+            "  -w  size of each write, 1..256 (64)\n"
+            "  -n  times the file is written (8)\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t size = 32768;
+    uint32_t wsize = 64;
+    int count = 8;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:n:")) != -1) {
+        switch (opt) {
+            case 's': size = strtoul(optarg, NULL, 0); break;
+            case 'w': wsize = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (wsize < 1 || wsize > 256 || count < 1) {
+        usage(argv[0]);
+    }
+
+    printf("%"PRIu32" byte file in %"PRIu32" byte writes, %d times\n",
+            size, wsize, count);
+    printf("%-10s %8s %9s %10s %8s\n",
+            "verify", "reads", "read(KiB)", "write(ms)", "KiB/s");
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        struct bench_result r;
+        int err = run(&sweep[i], size, wsize, count, &r);
+        if (err) {
+            fprintf(stderr, "%s: error %d\n", sweep[i].name, err);
+            return 1;
+        }
+
+        printf("%-10s %8"PRIu64" %9.1f %10.1f %8.1f\n",
+                sweep[i].name, r.reads, r.read_bytes / 1024.0,
+                r.time_us / 1000.0,
+                (double)size*count / 1024.0 / (r.time_us / 1e6));
+    }
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Static wear leveling benchmark for lfs_fs_wearlevel
+ *
+ * Writes a few files that are never touched again, then rewrites a hot
+ * file over and over with block relocation turned off, so the hot file's
+ * metadata pair wears far ahead of everything else. Every so often it
+ * runs the demo's housekeeping loop, calling lfs_fs_wearlevel until it
+ * returns 0. This is run once without wear leveling and once with it.
+ * For each it reports the moves and erases spent on wear leveling, the
+ * most moves any one housekeeping loop made, and the fewest, mean and
+ * most erases of any block at the end.
+ *
+ * Worn blocks that are in use can't take a moved file, so a housekeeping
+ * loop must stop once moving files no longer brings them onto more worn
+ * blocks. Exits with an error if a loop makes more than LOOP_MOVES moves.
+ *
+ *     ./wearbench              # 4 cold files, 20000 rewrites, threshold 20
+ *     ./wearbench -N 2 -R 5000 -t 50
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+#define FILES_MAX 8
+#define COLD_SIZE 6000
+#define HOT_SIZE 5000
+#define HOUSEKEEPING 1000
+
+// most moves one housekeeping loop may make, every cold file and the hot
+// file at most twice
+#define LOOP_MOVES (2*(FILES_MAX+1))
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+static struct lfs_config cfg;
+
+struct result {
+    uint32_t moves;
+    uint32_t loop_moves;
+    uint64_t move_erases;
+    struct lfs_wear wear;
+};
+
+static int put(lfs_t *lfs, const char *name, uint32_t size, uint8_t seed) {
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, name,
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[256];
+    for (uint32_t off = 0; off < size && !err; off += sizeof(buf)) {
+        uint32_t n = lfs_min(size - off, sizeof(buf));
+        for (uint32_t i = 0; i < n; i++) {
+            buf[i] = seed ^ (uint8_t)(off + i);
+        }
+        lfs_ssize_t res = lfs_file_write(lfs, &file, buf, n);
+        if (res < 0) {
+            err = res;
+        }
+    }
+
+    int cerr = lfs_file_close(lfs, &file);
+    return err ? err : cerr;
+}
+
+static int run(int count, int rewrites, lfs_size_t threshold,
+        struct result *r) {
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    for (int i = 0; i < count && !err; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "c%d", i);
+        err = put(&lfs, name, COLD_SIZE, (uint8_t)i);
+    }
+    if (err) {
+        return err;
+    }
+
+    memset(r, 0, sizeof(*r));
+    for (int i = 0; i < rewrites; i++) {
+        err = put(&lfs, "hot", HOT_SIZE, (uint8_t)(0x80 + i));
+        if (err) {
+            return err;
+        }
+
+        if (threshold && (i+1) % HOUSEKEEPING == 0) {
+            uint64_t erases = flash_emu_stats.erases;
+            uint32_t moves = 0;
+            int res;
+            while ((res = lfs_fs_wearlevel(&lfs, threshold,
+                    file_buffer)) > 0) {
+                moves += 1;
+                if (moves > LOOP_MOVES) {
+                    fprintf(stderr, "housekeeping after rewrite %d "
+                            "didn't stop after %d moves\n", i+1, LOOP_MOVES);
+                    return LFS_ERR_INVAL;
+                }
+            }
+            if (res < 0) {
+                return res;
+            }
+
+            r->moves += moves;
+            r->loop_moves = lfs_max(r->loop_moves, moves);
+            r->move_erases += flash_emu_stats.erases - erases;
+        }
+    }
+
+    err = lfs_fs_wear(&lfs, &r->wear);
+    if (err) {
+        return err;
+    }
+    return lfs_unmount(&lfs);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-N cold_files] [-R rewrites] [-t threshold]\n"
+            "\n"
+            "  -N  number of cold files, 1..%d (4)\n"
+            "  -R  number of hot file rewrites (20000)\n"
+            "  -t  lfs_fs_wearlevel threshold, at least 1 (20)\n",
+            name, FILES_MAX);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int count = 4;
+    int rewrites = 20000;
+    lfs_size_t threshold = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:R:t:")) != -1) {
+        switch (opt) {
+            case 'N': count = strtol(optarg, NULL, 0); break;
+            case 'R': rewrites = strtol(optarg, NULL, 0); break;
+            case 't': threshold = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (count < 1 || count > FILES_MAX || rewrites < 1 || threshold < 1) {
+        usage(argv[0]);
+    }
+
+    // without relocation the hot metadata pair is never moved, the worst
+    // case for blocks that are worn but in use
+    cfg = srxe_cfg;
+    cfg.block_cycles = -1;
+
+    printf("%d cold files, %d rewrites, threshold %"PRIu32
+            ", housekeeping every %d\n",
+            count, rewrites, threshold, HOUSEKEEPING);
+    printf("%-9s %6s %10s %11s %6s %6s %6s\n",
+            "leveling", "moves", "loop max", "erases", "min", "mean", "max");
+    for (int level = 0; level < 2; level++) {
+        struct result r;
+        int err = run(count, rewrites, level ? threshold : 0, &r);
+        if (err) {
+            fprintf(stderr, "%s: error %d\n", level ? "on" : "off", err);
+            return 1;
+        }
+
+        printf("%-9s %6"PRIu32" %10"PRIu32" %11"PRIu64
+                " %6"PRIu32" %6"PRIu32" %6"PRIu32"\n",
+                level ? "on" : "off", r.moves, r.loop_moves, r.move_erases,
+                r.wear.min, r.wear.mean, r.wear.max);
+    }
+
+    return 0;
+}
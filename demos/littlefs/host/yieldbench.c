@@ -0,0 +1,213 @@
+/*
+ * Event loop latency benchmark for lfs_config.yield
+ *
+ * Runs the long filesystem operations of the demo, mount, traverse, a
+ * large write and sync, a burst of small commits that forces metadata
+ * compaction, and wear leveling, with the event loop getting a turn
+ * through yield. Every turn charges some modeled time for scanning the
+ * keyboard and refreshing the display. For each yield_ops setting it
+ * reports the longest time the event loop went without a turn, see
+ * flash_emu.h for the timing model.
+ *
+ *     ./yieldbench             # 500 us of event loop work per turn
+ *     ./yieldbench -u 2000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lfs.h"
+#include "srxe_bd.h"
+#include "flash_emu.h"
+
+
+// yield_ops values to sweep, -1 runs without yield
+static const lfs_size_t sweep[] = {
+    -1, 16, 4, 1,
+};
+#define SWEEP_COUNT (sizeof(sweep)/sizeof(sweep[0]))
+
+enum {
+    OP_MOUNT,
+    OP_TRAVERSE,
+    OP_WRITE,
+    OP_COMMITS,
+    OP_WEARLEVEL,
+    OP_COUNT,
+};
+
+static const char *const op_names[OP_COUNT] = {
+    "mount", "traverse", "write+sync", "commits", "wearlevel",
+};
+
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
+};
+
+static uint32_t loop_us = 500;
+static uint64_t last_us;
+static uint64_t worst_us;
+
+static void yield(const struct lfs_config *c) {
+    (void)c;
+    worst_us = lfs_max(worst_us, flash_emu_stats.time_us - last_us);
+    flash_emu_idle(loop_us);
+    last_us = flash_emu_stats.time_us;
+}
+
+static void start(void) {
+    last_us = flash_emu_stats.time_us;
+    worst_us = 0;
+}
+
+static uint64_t finish(void) {
+    return lfs_max(worst_us, flash_emu_stats.time_us - last_us);
+}
+
+static int write_file(lfs_t *lfs, const char *name,
+        uint32_t seed, uint32_t size) {
+    lfs_file_t file;
+    int err = lfs_file_opencfg(lfs, &file, name,
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    if (err) {
+        return err;
+    }
+
+    uint8_t buf[256];
+    for (uint32_t off = 0; off < size && !err; off += sizeof(buf)) {
+        uint32_t n = lfs_min(size - off, sizeof(buf));
+        for (uint32_t i = 0; i < n; i++) {
+            buf[i] = (uint8_t)(seed + off + i);
+        }
+        lfs_ssize_t res = lfs_file_write(lfs, &file, buf, n);
+        if (res < 0) {
+            err = res;
+        }
+    }
+
+    int cerr = lfs_file_close(lfs, &file);
+    return err ? err : cerr;
+}
+
+static int count_block(void *p, lfs_block_t block) {
+    (void)block;
+    *(lfs_size_t*)p += 1;
+    return 0;
+}
+
+static int run(lfs_size_t yield_ops, uint64_t worst[OP_COUNT]) {
+    struct lfs_config cfg = srxe_cfg;
+    if (yield_ops != (lfs_size_t)-1) {
+        cfg.yield = yield;
+        cfg.yield_ops = yield_ops;
+    }
+
+    // the same starting image every time
+    flash_emu_reset();
+    srxe_bd_reset();
+    lfs_t lfs;
+    int err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    for (int i = 0; i < 6 && !err; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "f%d", i);
+        err = write_file(&lfs, name, i, 1000 + 2000*i);
+    }
+    if (!err) {
+        err = lfs_unmount(&lfs);
+    }
+    if (err) {
+        return err;
+    }
+
+    start();
+    err = lfs_mount(&lfs, &cfg);
+    worst[OP_MOUNT] = finish();
+    if (err) {
+        return err;
+    }
+
+    start();
+    lfs_size_t blocks = 0;
+    err = lfs_fs_traverse(&lfs, count_block, &blocks);
+    worst[OP_TRAVERSE] = finish();
+
+    if (!err) {
+        start();
+        err = write_file(&lfs, "big", 7, 16*1024);
+        worst[OP_WRITE] = finish();
+    }
+
+    if (!err) {
+        start();
+        for (int i = 0; i < 100 && !err; i++) {
+            err = write_file(&lfs, "settings", i, 32);
+        }
+        worst[OP_COMMITS] = finish();
+    }
+
+    if (!err) {
+        start();
+        lfs_ssize_t res = lfs_fs_wearlevel(&lfs, 0, file_buffer);
+        worst[OP_WEARLEVEL] = finish();
+        err = (res < 0) ? res : 0;
+    }
+
+    int uerr = lfs_unmount(&lfs);
+    return err ? err : uerr;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-u loop_us]\n"
+            "\n"
+            "  -u  time the event loop takes per turn in us (500)\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "u:")) != -1) {
+        switch (opt) {
+            case 'u': loop_us = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+
+    uint64_t worst[SWEEP_COUNT][OP_COUNT];
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        int err = run(sweep[i], worst[i]);
+        if (err) {
+            fprintf(stderr, "yield_ops %"PRId32": error %d\n",
+                    (int32_t)sweep[i], err);
+            return 1;
+        }
+    }
+
+    printf("longest time without an event loop turn in ms, "
+            "%"PRIu32" us per turn\n", loop_us);
+    printf("%-10s", "yield_ops");
+    for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+        if (sweep[i] == (lfs_size_t)-1) {
+            printf(" %8s", "off");
+        } else {
+            printf(" %8"PRIu32, sweep[i]);
+        }
+    }
+    printf("\n");
+
+    for (int op = 0; op < OP_COUNT; op++) {
+        printf("%-10s", op_names[op]);
+        for (unsigned i = 0; i < SWEEP_COUNT; i++) {
+            printf(" %8.2f", worst[i][op] / 1000.0);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -12,6 +12,7 @@
 // some constants used throughout the code
 #define LFS_BLOCK_NULL ((lfs_block_t)-1)
 #define LFS_BLOCK_INLINE ((lfs_block_t)-2)
+#define LFS_USED_UNKNOWN ((lfs_size_t)-1)
 
 enum {
     LFS_OK_RELOCATED = 1,
@@ -28,6 +29,18 @@ enum {
 
 /// Caching block device operations ///
 
+// With shared locking, readers may run concurrently, so the
+// filesystem-wide read cache needs a lock of its own
+#ifdef LFS_THREADSAFE
+#define LFS_CACHE_LOCK(cfg) \
+    ((cfg)->lock_shared ? (cfg)->lock_cache(cfg) : 0)
+#define LFS_CACHE_UNLOCK(cfg) \
+    ((cfg)->lock_shared ? (void)(cfg)->unlock_cache(cfg) : (void)0)
+#else
+#define LFS_CACHE_LOCK(cfg)   ((void)cfg, 0)
+#define LFS_CACHE_UNLOCK(cfg) ((void)cfg)
+#endif
+
 static inline void lfs_cache_drop(lfs_t *lfs, lfs_cache_t *rcache) {
     // do not zero, cheaper if cache is readonly or only going to be
     // written with identical data (during relocates)
@@ -41,7 +54,39 @@ static inline void lfs_cache_zero(lfs_t *lfs, lfs_cache_t *pcache) {
     pcache->block = LFS_BLOCK_NULL;
 }
 
-static int lfs_bd_read(lfs_t *lfs,
+// file caches also hold inline files whole, so they may be larger
+// than cache_size
+static inline lfs_size_t lfs_file_buffersize(lfs_t *lfs) {
+    return lfs_max(lfs->cfg->cache_size, lfs->inline_max);
+}
+
+static inline lfs_size_t lfs_cache_max(lfs_t *lfs, lfs_block_t block) {
+    return (block == LFS_BLOCK_INLINE)
+            ? lfs_file_buffersize(lfs)
+            : lfs->cfg->cache_size;
+}
+
+// give the caller's event loop a turn every yield_ops block device
+// operations, and instead of the block device waiting out an erase
+static void lfs_bd_yield(lfs_t *lfs) {
+    if (!lfs->cfg->yield) {
+        return;
+    }
+
+    lfs->yield_count += 1;
+    if (lfs->yield_count >= lfs->cfg->yield_ops) {
+        lfs->yield_count = 0;
+        lfs->cfg->yield(lfs->cfg);
+    }
+
+    if (lfs->cfg->busy) {
+        while (lfs->cfg->busy(lfs->cfg) > 0) {
+            lfs->cfg->yield(lfs->cfg);
+        }
+    }
+}
+
+static int lfs_bd_rawread(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off,
         void *buffer, lfs_size_t size) {
@@ -92,6 +137,7 @@ static int lfs_bd_read(lfs_t *lfs,
                 size >= lfs->cfg->read_size) {
             // bypass cache?
             diff = lfs_aligndown(diff, lfs->cfg->read_size);
+            lfs_bd_yield(lfs);
             int err = lfs->cfg->read(lfs->cfg, block, off, data, diff);
             if (err) {
                 return err;
@@ -113,6 +159,7 @@ static int lfs_bd_read(lfs_t *lfs,
                     lfs->cfg->block_size)
                 - rcache->off,
                 lfs->cfg->cache_size);
+        lfs_bd_yield(lfs);
         int err = lfs->cfg->read(lfs->cfg, rcache->block,
                 rcache->off, rcache->buffer, rcache->size);
         LFS_ASSERT(err <= 0);
@@ -124,6 +171,26 @@ static int lfs_bd_read(lfs_t *lfs,
     return 0;
 }
 
+static int lfs_bd_read(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+        lfs_block_t block, lfs_off_t off,
+        void *buffer, lfs_size_t size) {
+    // file caches belong to one reader, only the shared cache needs a lock
+    if (rcache != &lfs->rcache) {
+        return lfs_bd_rawread(lfs, pcache, rcache, hint,
+                block, off, buffer, size);
+    }
+
+    int err = LFS_CACHE_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+
+    err = lfs_bd_rawread(lfs, pcache, rcache, hint, block, off, buffer, size);
+    LFS_CACHE_UNLOCK(lfs->cfg);
+    return err;
+}
+
 static int lfs_bd_cmp(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off,
@@ -172,12 +239,46 @@ static int lfs_bd_crc(lfs_t *lfs,
     return 0;
 }
 
+#ifndef LFS_READONLY
+// compare freshly programmed data with what is on disk, as the verify
+// policy asks, returns LFS_CMP_EQ for data that wasn't checked
+static int lfs_bd_verify(lfs_t *lfs, lfs_cache_t *rcache,
+        lfs_block_t block, lfs_off_t off,
+        const void *buffer, lfs_size_t size) {
+    if (lfs->cfg->verify == LFS_VERIFY_NONE) {
+        return LFS_CMP_EQ;
+    } else if (lfs->cfg->verify == LFS_VERIFY_SAMPLED) {
+        lfs->verify_count += 1;
+        if (lfs->verify_count < lfs->cfg->verify_interval) {
+            return LFS_CMP_EQ;
+        }
+        lfs->verify_count = 0;
+    }
+
+    if (lfs->cfg->crc) {
+        uint32_t crc;
+        lfs_bd_yield(lfs);
+        int err = lfs->cfg->crc(lfs->cfg, block, off, size, &crc);
+        LFS_ASSERT(err <= 0);
+        if (err) {
+            return err;
+        }
+
+        return (crc == lfs_crc(0xffffffff, buffer, size))
+                ? LFS_CMP_EQ : LFS_CMP_LT;
+    }
+
+    return lfs_bd_cmp(lfs, NULL, rcache, size, block, off, buffer, size);
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_bd_flush(lfs_t *lfs,
         lfs_cache_t *pcache, lfs_cache_t *rcache, bool validate) {
     if (pcache->block != LFS_BLOCK_NULL && pcache->block != LFS_BLOCK_INLINE) {
         LFS_ASSERT(pcache->block < lfs->cfg->block_count);
         lfs_size_t diff = lfs_alignup(pcache->size, lfs->cfg->prog_size);
+        lfs_bd_yield(lfs);
         int err = lfs->cfg->prog(lfs->cfg, pcache->block,
                 pcache->off, pcache->buffer, diff);
         LFS_ASSERT(err <= 0);
@@ -188,9 +289,8 @@ static int lfs_bd_flush(lfs_t *lfs,
         if (validate) {
             // check data on disk
             lfs_cache_drop(lfs, rcache);
-            int res = lfs_bd_cmp(lfs,
-                    NULL, rcache, diff,
-                    pcache->block, pcache->off, pcache->buffer, diff);
+            int res = lfs_bd_verify(lfs, rcache, pcache->block, pcache->off,
+                    pcache->buffer, diff);
             if (res < 0) {
                 return res;
             }
@@ -217,6 +317,7 @@ static int lfs_bd_sync(lfs_t *lfs,
         return err;
     }
 
+    lfs_bd_yield(lfs);
     err = lfs->cfg->sync(lfs->cfg);
     LFS_ASSERT(err <= 0);
     return err;
@@ -232,13 +333,13 @@ static int lfs_bd_prog(lfs_t *lfs,
     LFS_ASSERT(block == LFS_BLOCK_INLINE || block < lfs->cfg->block_count);
     LFS_ASSERT(off + size <= lfs->cfg->block_size);
 
+    lfs_size_t max = lfs_cache_max(lfs, block);
     while (size > 0) {
         if (block == pcache->block &&
                 off >= pcache->off &&
-                off < pcache->off + lfs->cfg->cache_size) {
+                off < pcache->off + max) {
             // already fits in pcache?
-            lfs_size_t diff = lfs_min(size,
-                    lfs->cfg->cache_size - (off-pcache->off));
+            lfs_size_t diff = lfs_min(size, max - (off-pcache->off));
             memcpy(&pcache->buffer[off-pcache->off], data, diff);
 
             data += diff;
@@ -246,7 +347,7 @@ static int lfs_bd_prog(lfs_t *lfs,
             size -= diff;
 
             pcache->size = lfs_max(pcache->size, off - pcache->off);
-            if (pcache->size == lfs->cfg->cache_size) {
+            if (pcache->size == max) {
                 // eagerly flush out pcache if we fill up
                 int err = lfs_bd_flush(lfs, pcache, rcache, validate);
                 if (err) {
@@ -274,6 +375,7 @@ static int lfs_bd_prog(lfs_t *lfs,
 #ifndef LFS_READONLY
 static int lfs_bd_erase(lfs_t *lfs, lfs_block_t block) {
     LFS_ASSERT(block < lfs->cfg->block_count);
+    lfs_bd_yield(lfs);
     int err = lfs->cfg->erase(lfs->cfg, block);
     LFS_ASSERT(err <= 0);
     return err;
@@ -530,6 +632,8 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
         const void *buffer, lfs_size_t size);
 static lfs_ssize_t lfs_file_rawwrite(lfs_t *lfs, lfs_file_t *file,
         const void *buffer, lfs_size_t size);
+static lfs_ssize_t lfs_file_rawwritev(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, int iovcnt);
 static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file);
 static int lfs_file_outline(lfs_t *lfs, lfs_file_t *file);
 static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file);
@@ -544,6 +648,9 @@ static int lfs_fs_pred(lfs_t *lfs, const lfs_block_t dir[2],
 static lfs_stag_t lfs_fs_parent(lfs_t *lfs, const lfs_block_t dir[2],
         lfs_mdir_t *parent);
 static int lfs_fs_forceconsistency(lfs_t *lfs);
+static lfs_size_t lfs_dir_getused(lfs_t *lfs,
+        const lfs_mdir_t *dir, uint16_t id);
+static void lfs_fs_addused(lfs_t *lfs, lfs_ssize_t diff);
 #endif
 
 #ifdef LFS_MIGRATE
@@ -560,7 +667,7 @@ static lfs_ssize_t lfs_file_rawread(lfs_t *lfs, lfs_file_t *file,
 static int lfs_file_rawclose(lfs_t *lfs, lfs_file_t *file);
 static lfs_soff_t lfs_file_rawsize(lfs_t *lfs, lfs_file_t *file);
 
-static lfs_ssize_t lfs_fs_rawsize(lfs_t *lfs);
+static lfs_ssize_t lfs_fs_rawsize(lfs_t *lfs, bool cache);
 static int lfs_fs_rawtraverse(lfs_t *lfs,
         int (*cb)(void *data, lfs_block_t block), void *data,
         bool includeorphans);
@@ -600,6 +707,57 @@ static void lfs_alloc_drop(lfs_t *lfs) {
 }
 
 #ifndef LFS_READONLY
+// find which blocks in the lookahead window starting at free.off are in
+// use, dropping the window on failure
+static int lfs_alloc_scan(lfs_t *lfs) {
+    // find mask of free blocks from tree
+    memset(lfs->free.buffer, 0, lfs->cfg->lookahead_size);
+    int err = lfs_fs_rawtraverse(lfs, lfs_alloc_lookahead, lfs, true);
+    if (err) {
+        lfs_alloc_drop(lfs);
+        return err;
+    }
+
+    // bad blocks are never free
+    if (lfs->cfg->bad_blocks) {
+        err = lfs->cfg->bad_blocks(lfs->cfg, lfs_alloc_lookahead, lfs);
+        if (err) {
+            lfs_alloc_drop(lfs);
+            return err;
+        }
+    }
+
+    // neither is a block we've erased ahead of time
+    if (lfs->free.erased != LFS_BLOCK_NULL) {
+        lfs_alloc_lookahead(lfs, lfs->free.erased);
+    }
+
+    return 0;
+}
+
+// find the most worn free block in the rest of the lookahead window,
+// starting from the free block at off, this is best effort so errors
+// from erase_count just leave the block uncounted
+static lfs_block_t lfs_alloc_worn(lfs_t *lfs, lfs_block_t off) {
+    lfs_block_t best = off;
+    lfs_size_t bestcount = 0;
+    for (lfs_block_t i = off; i < lfs->free.size; i++) {
+        if (lfs->free.buffer[i / 32] & (1U << (i % 32))) {
+            continue;
+        }
+
+        lfs_size_t count;
+        int err = lfs->cfg->erase_count(lfs->cfg,
+                (lfs->free.off + i) % lfs->cfg->block_count, &count);
+        if (!err && count > bestcount) {
+            best = i;
+            bestcount = count;
+        }
+    }
+
+    return best;
+}
+
 static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
     while (true) {
         while (lfs->free.i != lfs->free.size) {
@@ -608,6 +766,20 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
             lfs->free.ack -= 1;
 
             if (!(lfs->free.buffer[off / 32] & (1U << (off % 32)))) {
+                if (lfs->free.worn) {
+                    // static wear leveling wants the most worn block
+                    lfs_block_t best = lfs_alloc_worn(lfs, off);
+                    if (best != off) {
+                        // leave off for the next allocation
+                        lfs->free.buffer[best / 32] |= 1U << (best % 32);
+                        lfs->free.i -= 1;
+                        lfs->free.ack += 1;
+                        *block = (lfs->free.off + best)
+                                % lfs->cfg->block_count;
+                        return 0;
+                    }
+                }
+
                 // found a free block
                 *block = (lfs->free.off + off) % lfs->cfg->block_count;
 
@@ -635,16 +807,29 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
                 % lfs->cfg->block_count;
         lfs->free.size = lfs_min(8*lfs->cfg->lookahead_size, lfs->free.ack);
         lfs->free.i = 0;
-
-        // find mask of free blocks from tree
-        memset(lfs->free.buffer, 0, lfs->cfg->lookahead_size);
-        int err = lfs_fs_rawtraverse(lfs, lfs_alloc_lookahead, lfs, true);
+        int err = lfs_alloc_scan(lfs);
         if (err) {
-            lfs_alloc_drop(lfs);
             return err;
         }
     }
 }
+
+// allocate a block for data, handing out the block a non-blocking write
+// erased ahead of time first, returns true if the block is already erased
+static int lfs_alloc_erased(lfs_t *lfs, lfs_block_t *block) {
+    if (lfs->free.erased != LFS_BLOCK_NULL) {
+        *block = lfs->free.erased;
+        lfs->free.erased = LFS_BLOCK_NULL;
+        return true;
+    }
+
+    int err = lfs_alloc(lfs, block);
+    if (err) {
+        return err;
+    }
+
+    return false;
+}
 #endif
 
 /// Metadata pair and directory operations ///
@@ -809,6 +994,161 @@ static int lfs_dir_traverse_filter(void *p,
 }
 #endif
 
+#ifndef LFS_READONLY
+// Compacting with lfs_dir_traverse_filter rereads the rest of the log for
+// every tag. Instead we can find every tag that survives with one pass in
+// log order, keeping the newest tag of every type and id so far and
+// applying the same rules as the filter to them as later tags come in.
+//
+// Tags in the summary are kept in log order, so lfs_dir_traverse can walk
+// them alongside the log. It counts as the filter does, every tag from the
+// log and every attr is a position, and ids are the ids the filter
+// would leave them with.
+
+// tags with the unique bit are only replaced by the same type
+static inline uint16_t lfs_summary_type(uint16_t type) {
+    return (type & 0x100) ? type : (type & 0x700);
+}
+
+static void lfs_summary_drop(struct lfs_summary *summary,
+        uint16_t type, uint16_t id) {
+    for (lfs_size_t i = 0; i < summary->count; i++) {
+        if (summary->tags[i].type == type && summary->tags[i].id == id) {
+            summary->count -= 1;
+            memmove(&summary->tags[i], &summary->tags[i+1],
+                    (summary->count - i)*sizeof(summary->tags[i]));
+            return;
+        }
+    }
+}
+
+static int lfs_summary_add(lfs_t *lfs, struct lfs_summary *summary,
+        lfs_tag_t tag, const void *buffer, uint16_t pos) {
+    uint16_t type = lfs_tag_type3(tag);
+    uint16_t id = lfs_tag_id(tag);
+    if (type == LFS_FROM_NOOP) {
+        return 0;
+    } else if (type == LFS_FROM_USERATTRS) {
+        // these replace user attributes, but are kept as a whole
+        const struct lfs_attr *a = buffer;
+        for (unsigned i = 0; i < lfs_tag_size(tag); i++) {
+            lfs_summary_drop(summary, LFS_TYPE_USERATTR + a[i].type, id);
+            summary->last = pos;
+        }
+    } else if (type != LFS_FROM_MOVE) {
+        // everything else, but moves, is seen by the filter
+        summary->last = pos;
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+            // deletes drop their id, and creates/deletes move later ids
+            for (lfs_size_t i = 0; i < summary->count; i++) {
+                if (type == LFS_TYPE_DELETE && summary->tags[i].id == id) {
+                    summary->count -= 1;
+                    memmove(&summary->tags[i], &summary->tags[i+1],
+                            (summary->count - i)*sizeof(summary->tags[i]));
+                    i -= 1;
+                } else if (id <= summary->tags[i].id) {
+                    summary->tags[i].id += lfs_tag_splice(tag);
+                }
+            }
+            return 0;
+        }
+
+        lfs_summary_drop(summary, lfs_summary_type(type), id);
+        if (type & 0x400) {
+            // not kept by compaction
+            return 0;
+        }
+    }
+
+    if (summary->count == lfs->cfg->compact_size/sizeof(*summary->tags)) {
+        return LFS_ERR_NOMEM;
+    }
+
+    summary->tags[summary->count] = (struct lfs_summary_tag){
+        .type   = lfs_summary_type(type),
+        .id     = id,
+        .pos    = pos,
+    };
+    summary->count += 1;
+    return 0;
+}
+
+// summarize a compaction of source with attrs, if this fails compaction
+// falls back to lfs_dir_traverse_filter, which reports any errors
+static void lfs_dir_summarize(lfs_t *lfs, const lfs_mdir_t *source,
+        const struct lfs_mattr *attrs, int attrcount) {
+    struct lfs_summary *summary = &lfs->summary;
+    summary->source = NULL;
+    summary->count = 0;
+    summary->last = 0xffff;
+    if (!lfs->cfg->compact_size) {
+        return;
+    }
+
+    lfs_off_t off = 0;
+    lfs_tag_t ptag = 0xffffffff;
+    lfs_size_t pos = 0;
+    int i = 0;
+    while (true) {
+        lfs_tag_t tag;
+        const void *buffer = NULL;
+        if (off+lfs_tag_dsize(ptag) < source->off) {
+            off += lfs_tag_dsize(ptag);
+            int err = lfs_bd_read(lfs,
+                    NULL, &lfs->rcache, sizeof(tag),
+                    source->pair[0], off, &tag, sizeof(tag));
+            if (err) {
+                return;
+            }
+
+            tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
+            ptag = tag;
+        } else if (i < attrcount) {
+            tag = attrs[i].tag;
+            buffer = attrs[i].buffer;
+            i += 1;
+        } else {
+            break;
+        }
+
+        if (pos > 0xffff) {
+            return;
+        }
+
+        int err = lfs_summary_add(lfs, summary, tag, buffer, pos);
+        if (err) {
+            LFS_DEBUG("Too many tags to summarize {0x%"PRIx32", 0x%"PRIx32"}",
+                    source->pair[0], source->pair[1]);
+            return;
+        }
+        pos += 1;
+    }
+
+    summary->source = source;
+    summary->attrs = attrs;
+    summary->attrcount = attrcount;
+}
+
+// what lfs_dir_traverse_filter would leave of the tag at pos, next walks
+// the summary along with the traversal
+static lfs_tag_t lfs_summary_filter(const struct lfs_summary *summary,
+        lfs_tag_t tag, lfs_size_t pos, lfs_size_t *next) {
+    while (*next < summary->count && summary->tags[*next].pos < pos) {
+        *next += 1;
+    }
+
+    // deleted attrs are dropped once anything follows them
+    if (*next == summary->count || summary->tags[*next].pos != pos ||
+            (lfs_tag_isdelete(tag) && pos != summary->last)) {
+        return LFS_MKTAG(LFS_FROM_NOOP, 0, 0);
+    }
+
+    return (tag & ~LFS_MKTAG(0, 0x3ff, 0))
+            | LFS_MKTAG(0, summary->tags[*next].id, 0);
+}
+#endif
+
 #ifndef LFS_READONLY
 // maximum recursive depth of lfs_dir_traverse, the deepest call:
 //
@@ -851,6 +1191,18 @@ static int lfs_dir_traverse(lfs_t *lfs,
     unsigned sp = 0;
     int res;
 
+    // if lfs_dir_summarize has already looked at this compaction, filter
+    // with its summary instead of rescanning the log for every tag
+    const struct lfs_summary *summary = NULL;
+    if (lfs_tag_id(tmask) != 0 && off == 0
+            && lfs->summary.source == dir
+            && lfs->summary.attrs == attrs
+            && lfs->summary.attrcount == attrcount) {
+        summary = &lfs->summary;
+    }
+    lfs_size_t pos = 0;
+    lfs_size_t next = 0;
+
     // iterate over directory and attrs
     lfs_tag_t tag;
     const void *buffer;
@@ -882,13 +1234,18 @@ static int lfs_dir_traverse(lfs_t *lfs,
                 break;
             }
 
+            // position in the summarized log?
+            pos += (sp == 0);
+
             // do we need to filter?
             lfs_tag_t mask = LFS_MKTAG(0x7ff, 0, 0);
             if ((mask & tmask & tag) != (mask & tmask & ttag)) {
                 continue;
             }
 
-            if (lfs_tag_id(tmask) != 0) {
+            if (summary && sp == 0) {
+                tag = lfs_summary_filter(summary, tag, pos-1, &next);
+            } else if (lfs_tag_id(tmask) != 0) {
                 LFS_ASSERT(sp < LFS_DIR_TRAVERSE_DEPTH);
                 // recurse, scan for duplicates, and update tag based on
                 // creates/deletes
@@ -1143,8 +1500,14 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 // toss our crc into the filesystem seed for
                 // pseudorandom numbers, note we use another crc here
                 // as a collection function because it is sufficiently
-                // random and convenient
+                // random and convenient, the seed is shared with
+                // concurrent readers like the read cache
+                err = LFS_CACHE_LOCK(lfs->cfg);
+                if (err) {
+                    return err;
+                }
                 lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
+                LFS_CACHE_UNLOCK(lfs->cfg);
 
                 // update with what's found so far
                 besttag = tempbesttag;
@@ -1272,7 +1635,10 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             dir->erased = (fcrc_ == fcrc.crc);
         }
 
-        // synthetic move
+        // synthetic move, the moved entry no longer counts either, or a
+        // name that was deleted past it would stop the search here
+        // instead of continuing to the tail
+        uint16_t count = dir->count;
         if (lfs_gstate_hasmovehere(&lfs->gdisk, dir->pair)) {
             if (lfs_tag_id(lfs->gdisk.tag) == lfs_tag_id(besttag)) {
                 besttag |= 0x80000000;
@@ -1280,6 +1646,10 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                     lfs_tag_id(lfs->gdisk.tag) < lfs_tag_id(besttag)) {
                 besttag -= LFS_MKTAG(0, 1, 0);
             }
+
+            if (lfs_tag_id(lfs->gdisk.tag) < count) {
+                count -= 1;
+            }
         }
 
         // found tag? or found best id?
@@ -1289,7 +1659,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
 
         if (lfs_tag_isvalid(besttag)) {
             return besttag;
-        } else if (lfs_tag_id(besttag) < dir->count) {
+        } else if (lfs_tag_id(besttag) < count) {
             return LFS_ERR_NOENT;
         } else {
             return 0;
@@ -1762,6 +2132,7 @@ static int lfs_dir_drop(lfs_t *lfs, lfs_mdir_t *dir, lfs_mdir_t *tail) {
         return err;
     }
 
+    lfs_fs_addused(lfs, -2);
     return 0;
 }
 #endif
@@ -1790,6 +2161,9 @@ static int lfs_dir_split(lfs_t *lfs,
     dir->tail[0] = tail.pair[0];
     dir->tail[1] = tail.pair[1];
     dir->split = true;
+    // linked in by the commit that called us, which forgets the count if
+    // it fails
+    lfs_fs_addused(lfs, 2);
 
     // update root if needed
     if (lfs_pair_cmp(dir->pair, lfs->root) == 0 && split == 0) {
@@ -1845,6 +2219,8 @@ static int lfs_dir_compact(lfs_t *lfs,
     // save some state in case block is bad
     bool relocated = false;
     bool tired = lfs_dir_needsrelocation(lfs, dir);
+    LFS_LOG_EVENT(LFS_LOG_LEVEL_INFO, LFS_LOG_MD_COMPACT,
+            dir->pair[0], begin, end);
 
     // increment revision count
     dir->rev += 1;
@@ -1974,6 +2350,9 @@ static int lfs_dir_compact(lfs_t *lfs,
             dir->count = end - begin;
             dir->off = commit.off;
             dir->etag = commit.ptag;
+            // the rest of the block was just erased, so later commits can
+            // append instead of compacting again
+            dir->erased = true;
             // update gstate
             lfs->gdelta = (lfs_gstate_t){0};
             if (!relocated) {
@@ -1998,6 +2377,8 @@ relocate:
         }
 
         // relocate half of pair
+        LFS_LOG_EVENT(LFS_LOG_LEVEL_INFO, LFS_LOG_MD_RELOCATE,
+                dir->pair[1], 0, 0);
         int err = lfs_alloc(lfs, &dir->pair[1]);
         if (err && (err != LFS_ERR_NOSPC || !tired)) {
             return err;
@@ -2087,7 +2468,7 @@ static int lfs_dir_splittingcompact(lfs_t *lfs, lfs_mdir_t *dir,
             && lfs_pair_cmp(dir->pair, (const lfs_block_t[2]){0, 1}) == 0) {
         // oh no! we're writing too much to the superblock,
         // should we expand?
-        lfs_ssize_t size = lfs_fs_rawsize(lfs);
+        lfs_ssize_t size = lfs_fs_rawsize(lfs, false);
         if (size < 0) {
             return size;
         }
@@ -2230,8 +2611,12 @@ compact:
     // fall back to compaction
     lfs_cache_drop(lfs, &lfs->pcache);
 
+    // every traversal while splitting and compacting is of the same log
+    // and attrs, so they can all share one summary
+    lfs_dir_summarize(lfs, dir, attrs, attrcount);
     state = lfs_dir_splittingcompact(lfs, dir, attrs, attrcount,
             dir, 0, dir->count);
+    lfs->summary.source = NULL;
     if (state < 0) {
         return state;
     }
@@ -2291,11 +2676,12 @@ fixmlist:;
 static int lfs_dir_orphaningcommit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_mattr *attrs, int attrcount) {
     // check for any inline files that aren't RAM backed and
-    // forcefully evict them, needed for filesystem consistency
+    // forcefully evict them, needed for filesystem consistency, pooled
+    // files without a buffer have nothing in RAM
     for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
         if (dir != &f->m && lfs_pair_cmp(f->m.pair, dir->pair) == 0 &&
                 f->type == LFS_TYPE_REG && (f->flags & LFS_F_INLINE) &&
-                f->ctz.size > lfs->cfg->cache_size) {
+                f->ctz.size > lfs->inline_max && f->cache.buffer) {
             int err = lfs_file_outline(lfs, f);
             if (err) {
                 return err;
@@ -2348,6 +2734,7 @@ static int lfs_dir_orphaningcommit(lfs_t *lfs, lfs_mdir_t *dir,
             return state;
         }
 
+        lfs_fs_addused(lfs, -2);
         ldir = pdir;
     }
 
@@ -2485,6 +2872,8 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_mattr *attrs, int attrcount) {
     int orphans = lfs_dir_orphaningcommit(lfs, dir, attrs, attrcount);
     if (orphans < 0) {
+        // we may have gotten partway, recount on the next lfs_fs_size
+        lfs->used = LFS_USED_UNKNOWN;
         return orphans;
     }
 
@@ -2577,6 +2966,7 @@ static int lfs_rawmkdir(lfs_t *lfs, const char *path) {
             return err;
         }
 
+        lfs_fs_addused(lfs, 2);
         lfs->mlist = cwd.next;
         err = lfs_fs_preporphans(lfs, -1);
         if (err) {
@@ -2584,7 +2974,9 @@ static int lfs_rawmkdir(lfs_t *lfs, const char *path) {
         }
     }
 
-    // now insert into our parent block
+    // now insert into our parent block, this also links us into the list
+    // if our predecessor didn't above
+    bool linked = cwd.m.split;
     lfs_pair_tole32(dir.pair);
     err = lfs_dir_commit(lfs, &cwd.m, LFS_MKATTRS(
             {LFS_MKTAG(LFS_TYPE_CREATE, id, 0), NULL},
@@ -2597,6 +2989,10 @@ static int lfs_rawmkdir(lfs_t *lfs, const char *path) {
         return err;
     }
 
+    if (!linked) {
+        lfs_fs_addused(lfs, 2);
+    }
+
     return 0;
 }
 #endif
@@ -2697,6 +3093,177 @@ static int lfs_dir_rawread(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
     return true;
 }
 
+// name and struct of one id found by lfs_dir_getplus
+struct lfs_dir_plus {
+    uint16_t id;
+    lfs_tag_t ntag;
+    lfs_tag_t stag;
+    lfs_off_t noff;
+    lfs_off_t soff;
+};
+
+// not a valid tag, tags read from disk never have the top bit set
+#define LFS_PLUS_PENDING 0xffffffff
+#define LFS_PLUS_NOENT   0x80000000
+
+// Looks up the name and struct of count consecutive ids in one pass over
+// the log, the same way lfs_dir_getslice does for a single tag
+static int lfs_dir_getplus(lfs_t *lfs, const lfs_mdir_t *dir,
+        uint16_t id, struct lfs_dir_plus *plus, int count) {
+    for (int i = 0; i < count; i++) {
+        plus[i].id = id + i;
+        if (lfs_gstate_hasmovehere(&lfs->gdisk, dir->pair) &&
+                lfs_tag_id(lfs->gdisk.tag) <= id + i) {
+            // synthetic moves
+            plus[i].id += 1;
+        }
+        plus[i].ntag = LFS_PLUS_PENDING;
+        plus[i].stag = LFS_PLUS_PENDING;
+    }
+
+    lfs_off_t off = dir->off;
+    lfs_tag_t ntag = dir->etag;
+    int pending = count;
+
+    // iterate over dir block backwards, until every id is found
+    while (pending > 0 &&
+            off >= sizeof(lfs_tag_t) + lfs_tag_dsize(ntag)) {
+        off -= lfs_tag_dsize(ntag);
+        lfs_tag_t tag = ntag;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, sizeof(ntag),
+                dir->pair[0], off, &ntag, sizeof(ntag));
+        if (err) {
+            return err;
+        }
+
+        ntag = (lfs_frombe32(ntag) ^ tag) & 0x7fffffff;
+
+        for (int i = 0; i < count; i++) {
+            struct lfs_dir_plus *p = &plus[i];
+            if (p->ntag != LFS_PLUS_PENDING && p->stag != LFS_PLUS_PENDING) {
+                continue;
+            }
+
+            if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE &&
+                    lfs_tag_id(tag) <= p->id) {
+                if (tag == LFS_MKTAG(LFS_TYPE_CREATE, p->id, 0)) {
+                    // found where we were created
+                    p->ntag = LFS_PLUS_NOENT;
+                    p->stag = LFS_PLUS_NOENT;
+                    pending -= 1;
+                    continue;
+                }
+
+                // move around splices
+                p->id -= lfs_tag_splice(tag);
+            }
+
+            if (p->ntag == LFS_PLUS_PENDING &&
+                    (LFS_MKTAG(0x780, 0x3ff, 0) & tag)
+                        == LFS_MKTAG(LFS_TYPE_NAME, p->id, 0)) {
+                p->ntag = lfs_tag_isdelete(tag) ? LFS_PLUS_NOENT : tag;
+                p->noff = off+sizeof(tag);
+            } else if (p->stag == LFS_PLUS_PENDING &&
+                    (LFS_MKTAG(0x700, 0x3ff, 0) & tag)
+                        == LFS_MKTAG(LFS_TYPE_STRUCT, p->id, 0)) {
+                p->stag = lfs_tag_isdelete(tag) ? LFS_PLUS_NOENT : tag;
+                p->soff = off+sizeof(tag);
+            } else {
+                continue;
+            }
+
+            if (p->ntag != LFS_PLUS_PENDING && p->stag != LFS_PLUS_PENDING) {
+                pending -= 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int lfs_dir_rawreadplus(lfs_t *lfs, lfs_dir_t *dir,
+        int (*cb)(void *data, const struct lfs_info *info), void *data) {
+    struct lfs_info info;
+
+    // special offset for '.' and '..'
+    while (dir->pos < 2) {
+        int res = lfs_dir_rawread(lfs, dir, &info);
+        if (res < 0) {
+            return res;
+        }
+
+        res = cb(data, &info);
+        if (res) {
+            return res;
+        }
+    }
+
+    while (true) {
+        if (dir->id == dir->m.count) {
+            if (!dir->m.split) {
+                return 0;
+            }
+
+            int err = lfs_dir_fetch(lfs, &dir->m, dir->m.tail);
+            if (err) {
+                return err;
+            }
+
+            dir->id = 0;
+        }
+
+        struct lfs_dir_plus plus[LFS_READPLUS_IDS];
+        int count = lfs_min(dir->m.count - dir->id, LFS_READPLUS_IDS);
+        int err = lfs_dir_getplus(lfs, &dir->m, dir->id, plus, count);
+        if (err) {
+            return err;
+        }
+
+        for (int i = 0; i < count; i++) {
+            const struct lfs_dir_plus *p = &plus[i];
+            dir->id += 1;
+            if (p->ntag == LFS_PLUS_PENDING || p->ntag == LFS_PLUS_NOENT ||
+                    p->stag == LFS_PLUS_PENDING ||
+                    p->stag == LFS_PLUS_NOENT) {
+                continue;
+            }
+
+            memset(&info, 0, sizeof(info));
+            info.type = lfs_tag_type3(p->ntag);
+            lfs_size_t diff = lfs_min(lfs_tag_size(p->ntag), lfs->name_max+1);
+            err = lfs_bd_read(lfs,
+                    NULL, &lfs->rcache, diff,
+                    dir->m.pair[0], p->noff, info.name, diff);
+            if (err) {
+                return err;
+            }
+
+            if (lfs_tag_type3(p->stag) == LFS_TYPE_CTZSTRUCT) {
+                struct lfs_ctz ctz;
+                memset(&ctz, 0, sizeof(ctz));
+                diff = lfs_min(lfs_tag_size(p->stag), sizeof(ctz));
+                err = lfs_bd_read(lfs,
+                        NULL, &lfs->rcache, diff,
+                        dir->m.pair[0], p->soff, &ctz, diff);
+                if (err) {
+                    return err;
+                }
+                lfs_ctz_fromle32(&ctz);
+                info.size = ctz.size;
+            } else if (lfs_tag_type3(p->stag) == LFS_TYPE_INLINESTRUCT) {
+                info.size = lfs_tag_size(p->stag);
+            }
+
+            dir->pos += 1;
+            int res = cb(data, &info);
+            if (res) {
+                return res;
+            }
+        }
+    }
+}
+
 static int lfs_dir_rawseek(lfs_t *lfs, lfs_dir_t *dir, lfs_off_t off) {
     // simply walk from head dir
     int err = lfs_dir_rawrewind(lfs, dir);
@@ -2766,19 +3333,23 @@ static int lfs_ctz_index(lfs_t *lfs, lfs_off_t *off) {
     return i;
 }
 
-static int lfs_ctz_find(lfs_t *lfs,
-        const lfs_cache_t *pcache, lfs_cache_t *rcache,
-        lfs_block_t head, lfs_size_t size,
-        lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
+#ifndef LFS_READONLY
+// number of blocks in a ctz list of size bytes
+static lfs_size_t lfs_ctz_count(lfs_t *lfs, lfs_size_t size) {
     if (size == 0) {
-        *block = LFS_BLOCK_NULL;
-        *off = 0;
         return 0;
     }
 
-    lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
-    lfs_off_t target = lfs_ctz_index(lfs, &pos);
+    return lfs_ctz_index(lfs, &(lfs_off_t){size-1}) + 1;
+}
+#endif
 
+// follow the skip-list from the block at index current back to the block
+// at index target
+static int lfs_ctz_walk(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        lfs_block_t head, lfs_off_t current, lfs_off_t target,
+        lfs_block_t *block) {
     while (current > target) {
         lfs_size_t skip = lfs_min(
                 lfs_npw2(current-target+1) - 1,
@@ -2796,30 +3367,83 @@ static int lfs_ctz_find(lfs_t *lfs,
     }
 
     *block = head;
-    *off = pos;
     return 0;
 }
 
-#ifndef LFS_READONLY
-static int lfs_ctz_extend(lfs_t *lfs,
-        lfs_cache_t *pcache, lfs_cache_t *rcache,
-        lfs_block_t head, lfs_size_t size,
+static int lfs_ctz_find(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        lfs_block_t head, lfs_size_t size,
+        lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
+    if (size == 0) {
+        *block = LFS_BLOCK_NULL;
+        *off = 0;
+        return 0;
+    }
+
+    lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
+    lfs_off_t target = lfs_ctz_index(lfs, &pos);
+
+    int err = lfs_ctz_walk(lfs, pcache, rcache, head, current, target, block);
+    if (err) {
+        return err;
+    }
+
+    *off = pos;
+    return 0;
+}
+
+// find the count blocks starting at index in one walk, the last one with
+// the skip-list and the others through each block's pointer to the block
+// before it, returns how many blocks were found before the end of the file
+static lfs_ssize_t lfs_ctz_findrange(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        lfs_block_t head, lfs_size_t size,
+        lfs_off_t index, lfs_block_t *blocks, lfs_size_t count) {
+    lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
+    LFS_ASSERT(size > 0 && index <= current);
+    count = lfs_min(count, current - index + 1);
+
+    int err = lfs_ctz_walk(lfs, pcache, rcache,
+            head, current, index+count-1, &blocks[count-1]);
+    if (err) {
+        return err;
+    }
+
+    for (lfs_size_t i = count-1; i > 0; i--) {
+        err = lfs_bd_read(lfs,
+                pcache, rcache, sizeof(blocks[i-1]),
+                blocks[i], 0, &blocks[i-1], sizeof(blocks[i-1]));
+        if (err) {
+            return err;
+        }
+        blocks[i-1] = lfs_fromle32(blocks[i-1]);
+    }
+
+    return count;
+}
+
+#ifndef LFS_READONLY
+static int lfs_ctz_extend(lfs_t *lfs,
+        lfs_cache_t *pcache, lfs_cache_t *rcache,
+        lfs_block_t head, lfs_size_t size,
         lfs_block_t *block, lfs_off_t *off) {
     while (true) {
         // go ahead and grab a block
         lfs_block_t nblock;
-        int err = lfs_alloc(lfs, &nblock);
-        if (err) {
+        int err = lfs_alloc_erased(lfs, &nblock);
+        if (err < 0) {
             return err;
         }
 
         {
-            err = lfs_bd_erase(lfs, nblock);
-            if (err) {
-                if (err == LFS_ERR_CORRUPT) {
-                    goto relocate;
+            if (!err) {
+                err = lfs_bd_erase(lfs, nblock);
+                if (err) {
+                    if (err == LFS_ERR_CORRUPT) {
+                        goto relocate;
+                    }
+                    return err;
                 }
-                return err;
             }
 
             if (size == 0) {
@@ -2945,6 +3569,27 @@ static int lfs_ctz_traverse(lfs_t *lfs,
 
 
 /// Top level file operations ///
+// read an inline file whole into the file's buffer
+static int lfs_file_loadinline(lfs_t *lfs, lfs_file_t *file) {
+    file->cache.block = file->ctz.head;
+    file->cache.off = 0;
+    file->cache.size = lfs_file_buffersize(lfs);
+
+    // don't always read (may be new/trunc file)
+    if (file->ctz.size > 0) {
+        lfs_stag_t res = lfs_dir_get(lfs, &file->m,
+                LFS_MKTAG(0x700, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_STRUCT, file->id,
+                    lfs_min(file->cache.size, 0x3fe)),
+                file->cache.buffer);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
 static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
         const char *path, int flags,
         const struct lfs_file_config *cfg) {
@@ -2967,6 +3612,10 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
     file->pos = 0;
     file->off = 0;
     file->cache.buffer = NULL;
+    file->cache.block = LFS_BLOCK_NULL;
+    file->cache.size = 0;
+    file->stamp = lfs->pool_stamp;
+    file->ra.count = 0;
 
     // allocate entry for file if it doesn't exist
     lfs_stag_t tag = lfs_dir_find(lfs, &file->m, &path, &file->id);
@@ -2997,17 +3646,24 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
             goto cleanup;
         }
 
-        // get next slot and create entry to remember name
-        err = lfs_dir_commit(lfs, &file->m, LFS_MKATTRS(
-                {LFS_MKTAG(LFS_TYPE_CREATE, file->id, 0), NULL},
-                {LFS_MKTAG(LFS_TYPE_REG, file->id, nlen), path},
-                {LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0), NULL}));
-
-        // it may happen that the file name doesn't fit in the metadata blocks, e.g., a 256 byte file name will
-        // not fit in a 128 byte block.
-        err = (err == LFS_ERR_NOSPC) ? LFS_ERR_NAMETOOLONG : err;
-        if (err) {
-            goto cleanup;
+        if (flags & LFS_F_TXN) {
+            // the entry is created by lfs_txn_commit, until then the file
+            // isn't in any metadata pair
+            file->m.pair[0] = LFS_BLOCK_NULL;
+            file->m.pair[1] = LFS_BLOCK_NULL;
+        } else {
+            // get next slot and create entry to remember name
+            err = lfs_dir_commit(lfs, &file->m, LFS_MKATTRS(
+                    {LFS_MKTAG(LFS_TYPE_CREATE, file->id, 0), NULL},
+                    {LFS_MKTAG(LFS_TYPE_REG, file->id, nlen), path},
+                    {LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0), NULL}));
+
+            // it may happen that the file name doesn't fit in the metadata blocks, e.g., a 256 byte file name will
+            // not fit in a 128 byte block.
+            err = (err == LFS_ERR_NOSPC) ? LFS_ERR_NAMETOOLONG : err;
+            if (err) {
+                goto cleanup;
+            }
         }
 
         tag = LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, 0);
@@ -3038,7 +3694,8 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
     // fetch attrs
     for (unsigned i = 0; i < file->cfg->attr_count; i++) {
         // if opened for read / read-write operations
-        if ((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY) {
+        if ((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY &&
+                !lfs_pair_isnull(file->m.pair)) {
             lfs_stag_t res = lfs_dir_get(lfs, &file->m,
                     LFS_MKTAG(0x7ff, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_USERATTR + file->cfg->attrs[i].type,
@@ -3063,38 +3720,39 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
 #endif
     }
 
-    // allocate buffer if needed
+    // allocate buffer if needed, pooled files borrow one when first used
     if (file->cfg->buffer) {
         file->cache.buffer = file->cfg->buffer;
+    } else if (lfs->cfg->file_pool_buffer) {
+        file->flags |= LFS_F_POOLED;
     } else {
-        file->cache.buffer = lfs_malloc(lfs->cfg->cache_size);
+        file->cache.buffer = lfs_malloc(lfs_file_buffersize(lfs));
         if (!file->cache.buffer) {
             err = LFS_ERR_NOMEM;
             goto cleanup;
         }
     }
 
-    // zero to avoid information leak
-    lfs_cache_zero(lfs, &file->cache);
+    if (file->cache.buffer) {
+        // zero to avoid information leak
+        lfs_cache_zero(lfs, &file->cache);
+    }
 
     if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
-        // load inline files
+        // load inline files, which may have been written with a larger
+        // inline_max than we can buffer
+        if (lfs_tag_size(tag) > lfs_file_buffersize(lfs)) {
+            err = LFS_ERR_FBIG;
+            goto cleanup;
+        }
+
         file->ctz.head = LFS_BLOCK_INLINE;
         file->ctz.size = lfs_tag_size(tag);
         file->flags |= LFS_F_INLINE;
-        file->cache.block = file->ctz.head;
-        file->cache.off = 0;
-        file->cache.size = lfs->cfg->cache_size;
 
-        // don't always read (may be new/trunc file)
-        if (file->ctz.size > 0) {
-            lfs_stag_t res = lfs_dir_get(lfs, &file->m,
-                    LFS_MKTAG(0x700, 0x3ff, 0),
-                    LFS_MKTAG(LFS_TYPE_STRUCT, file->id,
-                        lfs_min(file->cache.size, 0x3fe)),
-                    file->cache.buffer);
-            if (res < 0) {
-                err = res;
+        if (file->cache.buffer) {
+            err = lfs_file_loadinline(lfs, file);
+            if (err) {
                 goto cleanup;
             }
         }
@@ -3130,8 +3788,8 @@ static int lfs_file_rawclose(lfs_t *lfs, lfs_file_t *file) {
     // remove from list of mdirs
     lfs_mlist_remove(lfs, (struct lfs_mlist*)file);
 
-    // clean up memory
-    if (!file->cfg->buffer) {
+    // clean up memory, pool lines are free once no file points at them
+    if (!file->cfg->buffer && !(file->flags & LFS_F_POOLED)) {
         lfs_free(file->cache.buffer);
     }
 
@@ -3144,17 +3802,19 @@ static int lfs_file_relocate(lfs_t *lfs, lfs_file_t *file) {
     while (true) {
         // just relocate what exists into new block
         lfs_block_t nblock;
-        int err = lfs_alloc(lfs, &nblock);
-        if (err) {
+        int err = lfs_alloc_erased(lfs, &nblock);
+        if (err < 0) {
             return err;
         }
 
-        err = lfs_bd_erase(lfs, nblock);
-        if (err) {
-            if (err == LFS_ERR_CORRUPT) {
-                goto relocate;
+        if (!err) {
+            err = lfs_bd_erase(lfs, nblock);
+            if (err) {
+                if (err == LFS_ERR_CORRUPT) {
+                    goto relocate;
+                }
+                return err;
             }
-            return err;
         }
 
         // either read from dirty cache or disk
@@ -3197,6 +3857,9 @@ static int lfs_file_relocate(lfs_t *lfs, lfs_file_t *file) {
         file->cache.size = lfs->pcache.size;
         lfs_cache_zero(lfs, &lfs->pcache);
 
+        // the read-ahead table is keyed on the head, which the allocator
+        // may hand out again, so drop it whenever the blocks change
+        file->ra.count = 0;
         file->block = nblock;
         file->flags |= LFS_F_WRITING;
         return 0;
@@ -3294,6 +3957,7 @@ relocate:
         // actual file updates
         file->ctz.head = file->block;
         file->ctz.size = file->pos;
+        file->ra.count = 0;
         file->flags &= ~LFS_F_WRITING;
         file->flags |= LFS_F_DIRTY;
 
@@ -3304,6 +3968,109 @@ relocate:
     return 0;
 }
 
+// give up a file's pool line, syncing anything only the line holds
+static int lfs_file_giveback(lfs_t *lfs, lfs_file_t *file) {
+#ifndef LFS_READONLY
+    int err = lfs_file_rawsync(lfs, file);
+    if (err) {
+        return err;
+    }
+#else
+    (void)lfs;
+#endif
+
+    file->flags &= ~LFS_F_READING;
+    file->cache.buffer = NULL;
+    file->cache.block = LFS_BLOCK_NULL;
+    file->cache.size = 0;
+    return 0;
+}
+
+// does giving up a file's pool line need a sync?
+static bool lfs_file_isbuffered(const lfs_file_t *file) {
+#ifndef LFS_READONLY
+    return (file->flags & (LFS_F_DIRTY | LFS_F_WRITING))
+            && !(file->flags & LFS_F_ERRED);
+#else
+    (void)file;
+    return false;
+#endif
+}
+
+// make sure a pooled file holds a line of file_pool_buffer, taking one
+// from the least recently used file if they are all in use
+static int lfs_file_borrow(lfs_t *lfs, lfs_file_t *file) {
+    if (!(file->flags & LFS_F_POOLED)) {
+        return 0;
+    }
+
+    lfs->pool_stamp += 1;
+    file->stamp = lfs->pool_stamp;
+    if (file->cache.buffer) {
+        return 0;
+    }
+
+    // any free lines?
+    lfs_size_t size = lfs_file_buffersize(lfs);
+    uint8_t *pool = lfs->cfg->file_pool_buffer;
+    uint8_t *buffer = NULL;
+    for (lfs_size_t i = 0;
+            i < lfs->cfg->file_pool_size / size && !buffer; i++) {
+        buffer = &pool[i*size];
+        for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
+            if (f->type == LFS_TYPE_REG && f->cache.buffer == buffer) {
+                buffer = NULL;
+                break;
+            }
+        }
+    }
+
+    if (!buffer) {
+        // evict the least recently used file, preferring files with
+        // nothing to sync
+        lfs_file_t *victim = NULL;
+        bool vbuffered = false;
+        for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
+            if (f == file || f->type != LFS_TYPE_REG ||
+                    !(f->flags & LFS_F_POOLED) || !f->cache.buffer) {
+                continue;
+            }
+
+            bool buffered = lfs_file_isbuffered(f);
+            if (!victim || (vbuffered && !buffered) ||
+                    (vbuffered == buffered &&
+                        lfs->pool_stamp - f->stamp
+                            > lfs->pool_stamp - victim->stamp)) {
+                victim = f;
+                vbuffered = buffered;
+            }
+        }
+
+        if (!victim) {
+            return LFS_ERR_NOMEM;
+        }
+
+        buffer = victim->cache.buffer;
+        int err = lfs_file_giveback(lfs, victim);
+        if (err) {
+            return err;
+        }
+    }
+
+    file->cache.buffer = buffer;
+    lfs_cache_zero(lfs, &file->cache);
+    if (file->flags & LFS_F_INLINE) {
+        int err = lfs_file_loadinline(lfs, file);
+        if (err) {
+            file->cache.buffer = NULL;
+            file->cache.block = LFS_BLOCK_NULL;
+            return err;
+        }
+    }
+
+    return 0;
+}
+
 #ifndef LFS_READONLY
 static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file) {
     if (file->flags & LFS_F_ERRED) {
@@ -3311,6 +4078,14 @@ static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file) {
         return 0;
     }
 
+    if ((file->flags & LFS_F_DIRTY) && (file->flags & LFS_F_INLINE)) {
+        // committing an inline file needs its contents
+        int err = lfs_file_borrow(lfs, file);
+        if (err) {
+            return err;
+        }
+    }
+
     int err = lfs_file_flush(lfs, file);
     if (err) {
         file->flags |= LFS_F_ERRED;
@@ -3319,6 +4094,7 @@ static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file) {
 
 
     if ((file->flags & LFS_F_DIRTY) &&
+            !(file->flags & LFS_F_TXN) &&
             !lfs_pair_isnull(file->m.pair)) {
         // update dir entry
         uint16_t type;
@@ -3341,6 +4117,7 @@ static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file) {
         }
 
         // commit file data and attributes
+        lfs_size_t used = lfs_dir_getused(lfs, &file->m, file->id);
         err = lfs_dir_commit(lfs, &file->m, LFS_MKATTRS(
                 {LFS_MKTAG(type, file->id, size), buffer},
                 {LFS_MKTAG(LFS_FROM_USERATTRS, file->id,
@@ -3351,12 +4128,174 @@ static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file) {
         }
 
         file->flags &= ~LFS_F_DIRTY;
+        if (!(file->flags & LFS_F_INLINE)) {
+            lfs_fs_addused(lfs, lfs_ctz_count(lfs, file->ctz.size));
+        }
+        lfs_fs_addused(lfs, -(lfs_ssize_t)used);
+    }
+
+    return 0;
+}
+
+static int lfs_file_rawsync_nb(lfs_t *lfs, lfs_file_t *file) {
+    if (lfs->cfg->busy) {
+        int busy = lfs->cfg->busy(lfs->cfg);
+        if (busy) {
+            return (busy < 0) ? busy : LFS_ERR_INPROGRESS;
+        }
+    }
+
+    return lfs_file_rawsync(lfs, file);
+}
+
+// whether a flushed file still needs its dir entry committed
+static bool lfs_file_syncpending(const lfs_file_t *file) {
+    return (file->flags & LFS_F_DIRTY)
+            && !(file->flags & (LFS_F_ERRED | LFS_F_TXN))
+            && !lfs_pair_isnull(file->m.pair);
+}
+
+static int lfs_file_rawsyncv(lfs_t *lfs, lfs_file_t *const *files,
+        int count) {
+    // flush everyone's data first
+    for (int i = 0; i < count; i++) {
+        lfs_file_t *file = files[i];
+        if (file->flags & LFS_F_ERRED) {
+            continue;
+        }
+
+        if ((file->flags & LFS_F_DIRTY) && (file->flags & LFS_F_INLINE)
+                && (file->flags & LFS_F_POOLED)) {
+            // borrowing a line for an inline file may take it from another
+            // file in the group, so these are committed on their own
+            int err = lfs_file_rawsync(lfs, file);
+            if (err) {
+                return err;
+            }
+            continue;
+        }
+
+        int err = lfs_file_flush(lfs, file);
+        if (err) {
+            file->flags |= LFS_F_ERRED;
+            return err;
+        }
+    }
+
+    // commit the dir entries of files sharing a metadata pair together
+    for (int i = 0; i < count; i++) {
+        lfs_file_t *file = files[i];
+        if (!lfs_file_syncpending(file)) {
+            continue;
+        }
+
+        lfs_file_t *group[LFS_SYNCV_MAX];
+        struct lfs_ctz ctzs[LFS_SYNCV_MAX];
+        lfs_size_t used[LFS_SYNCV_MAX];
+        struct lfs_mattr attrs[2*LFS_SYNCV_MAX];
+        int n = 0;
+        for (int j = i; j < count && n < LFS_SYNCV_MAX; j++) {
+            lfs_file_t *f = files[j];
+            if (!lfs_file_syncpending(f)
+                    || lfs_pair_cmp(f->m.pair, file->m.pair) != 0) {
+                continue;
+            }
+
+            // the same file may be listed more than once
+            bool listed = false;
+            for (int k = 0; k < n; k++) {
+                listed = listed || group[k] == f;
+            }
+            if (listed) {
+                continue;
+            }
+
+            if (f->flags & LFS_F_INLINE) {
+                // inline the whole file
+                attrs[2*n] = (struct lfs_mattr){
+                        LFS_MKTAG(LFS_TYPE_INLINESTRUCT, f->id, f->ctz.size),
+                        f->cache.buffer};
+            } else {
+                // update the ctz reference, copied so alloc will work
+                // during a relocate
+                ctzs[n] = f->ctz;
+                lfs_ctz_tole32(&ctzs[n]);
+                attrs[2*n] = (struct lfs_mattr){
+                        LFS_MKTAG(LFS_TYPE_CTZSTRUCT, f->id, sizeof(ctzs[n])),
+                        &ctzs[n]};
+            }
+            attrs[2*n+1] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_FROM_USERATTRS, f->id, f->cfg->attr_count),
+                    f->cfg->attrs};
+            used[n] = lfs_dir_getused(lfs, &f->m, f->id);
+            group[n] = f;
+            n += 1;
+        }
+
+        // commit file data and attributes, later files in the pair see
+        // the new metadata through the mlist
+        int err = lfs_dir_commit(lfs, &file->m, attrs, 2*n);
+        if (err) {
+            for (int k = 0; k < n; k++) {
+                group[k]->flags |= LFS_F_ERRED;
+            }
+            return err;
+        }
+
+        for (int k = 0; k < n; k++) {
+            group[k]->flags &= ~LFS_F_DIRTY;
+            if (!(group[k]->flags & LFS_F_INLINE)) {
+                lfs_fs_addused(lfs,
+                        lfs_ctz_count(lfs, group[k]->ctz.size));
+            }
+            lfs_fs_addused(lfs, -(lfs_ssize_t)used[k]);
+        }
     }
 
     return 0;
 }
 #endif
 
+// find the block at the file's position, going through the read-ahead
+// table if there is one
+static int lfs_file_findread(lfs_t *lfs, lfs_file_t *file, bool sequential) {
+    lfs_off_t off = file->pos;
+    lfs_off_t index = lfs_ctz_index(lfs, &off);
+    bool hit = (file->ra.count > 0
+            && file->ra.head == file->ctz.head
+            && index >= file->ra.index
+            && index - file->ra.index < file->ra.count);
+
+    if (!hit && sequential && file->cfg && file->cfg->readahead_size > 0) {
+        // reading straight through, find the next few blocks at once
+        LFS_ASSERT(file->cfg->readahead_size % sizeof(lfs_block_t) == 0);
+        file->ra.count = 0;
+        lfs_ssize_t count = lfs_ctz_findrange(lfs, NULL, &file->cache,
+                file->ctz.head, file->ctz.size, index,
+                file->cfg->readahead_buffer,
+                file->cfg->readahead_size / sizeof(lfs_block_t));
+        if (count < 0) {
+            return count;
+        }
+
+        file->ra.head = file->ctz.head;
+        file->ra.index = index;
+        file->ra.count = count;
+        hit = true;
+    }
+
+    if (hit) {
+        const lfs_block_t *blocks = file->cfg->readahead_buffer;
+        file->block = blocks[index - file->ra.index];
+        file->off = off;
+        return 0;
+    }
+
+    return lfs_ctz_find(lfs, NULL, &file->cache,
+            file->ctz.head, file->ctz.size,
+            file->pos, &file->block, &file->off);
+}
+
 static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size) {
     uint8_t *data = buffer;
@@ -3375,9 +4314,10 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         if (!(file->flags & LFS_F_READING) ||
                 file->off == lfs->cfg->block_size) {
             if (!(file->flags & LFS_F_INLINE)) {
-                int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                        file->ctz.head, file->ctz.size,
-                        file->pos, &file->block, &file->off);
+                // running off the end of a block means we're reading
+                // sequentially
+                int err = lfs_file_findread(lfs, file,
+                        file->flags & LFS_F_READING);
                 if (err) {
                     return err;
                 }
@@ -3421,11 +4361,15 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
 static lfs_ssize_t lfs_file_rawread(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size) {
     LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+    int err = lfs_file_borrow(lfs, file);
+    if (err) {
+        return err;
+    }
 
 #ifndef LFS_READONLY
     if (file->flags & LFS_F_WRITING) {
         // flush out any writes
-        int err = lfs_file_flush(lfs, file);
+        err = lfs_file_flush(lfs, file);
         if (err) {
             return err;
         }
@@ -3435,6 +4379,42 @@ static lfs_ssize_t lfs_file_rawread(lfs_t *lfs, lfs_file_t *file,
     return lfs_file_flushedread(lfs, file, buffer, size);
 }
 
+static lfs_ssize_t lfs_file_rawreadv(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, int iovcnt) {
+    LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+    int err = lfs_file_borrow(lfs, file);
+    if (err) {
+        return err;
+    }
+
+#ifndef LFS_READONLY
+    if (file->flags & LFS_F_WRITING) {
+        // flush out any writes
+        err = lfs_file_flush(lfs, file);
+        if (err) {
+            return err;
+        }
+    }
+#endif
+
+    lfs_size_t size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        lfs_ssize_t res = lfs_file_flushedread(lfs, file,
+                iov[i].buffer, iov[i].size);
+        if (res < 0) {
+            return res;
+        }
+
+        size += res;
+        if ((lfs_size_t)res < iov[i].size) {
+            // eof
+            break;
+        }
+    }
+
+    return size;
+}
+
 
 #ifndef LFS_READONLY
 static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
@@ -3443,11 +4423,7 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
     lfs_size_t nsize = size;
 
     if ((file->flags & LFS_F_INLINE) &&
-            lfs_max(file->pos+nsize, file->ctz.size) >
-            lfs_min(0x3fe, lfs_min(
-                lfs->cfg->cache_size,
-                (lfs->cfg->metadata_max ?
-                    lfs->cfg->metadata_max : lfs->cfg->block_size) / 8))) {
+            lfs_max(file->pos+nsize, file->ctz.size) > lfs->inline_max) {
         // inline file doesn't fit anymore
         int err = lfs_file_outline(lfs, file);
         if (err) {
@@ -3527,11 +4503,32 @@ relocate:
 
 static lfs_ssize_t lfs_file_rawwrite(lfs_t *lfs, lfs_file_t *file,
         const void *buffer, lfs_size_t size) {
+    const struct lfs_iovec iov = {(void*)buffer, size};
+    return lfs_file_rawwritev(lfs, file, &iov, 1);
+}
+
+static lfs_ssize_t lfs_file_rawwritev(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, int iovcnt) {
     LFS_ASSERT((file->flags & LFS_O_WRONLY) == LFS_O_WRONLY);
+    LFS_ASSERT(iovcnt >= 0);
+
+    lfs_size_t size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].size > lfs->file_max - size) {
+            // total larger than file limit?
+            return LFS_ERR_FBIG;
+        }
+        size += iov[i].size;
+    }
+
+    int err = lfs_file_borrow(lfs, file);
+    if (err) {
+        return err;
+    }
 
     if (file->flags & LFS_F_READING) {
         // drop any reads
-        int err = lfs_file_flush(lfs, file);
+        err = lfs_file_flush(lfs, file);
         if (err) {
             return err;
         }
@@ -3559,17 +4556,108 @@ static lfs_ssize_t lfs_file_rawwrite(lfs_t *lfs, lfs_file_t *file,
         }
     }
 
-    lfs_ssize_t nsize = lfs_file_flushedwrite(lfs, file, buffer, size);
-    if (nsize < 0) {
-        return nsize;
+    if ((file->flags & LFS_F_INLINE) &&
+            lfs_max(file->pos+size, file->ctz.size) > lfs->inline_max) {
+        // outline up front if the whole write doesn't fit, rather than
+        // partway through it
+        err = lfs_file_outline(lfs, file);
+        if (err) {
+            file->flags |= LFS_F_ERRED;
+            return err;
+        }
+    }
+
+    // each piece picks up where the last one left off in the file's cache
+    for (int i = 0; i < iovcnt; i++) {
+        lfs_ssize_t res = lfs_file_flushedwrite(lfs, file,
+                iov[i].buffer, iov[i].size);
+        if (res < 0) {
+            return res;
+        }
     }
 
     file->flags &= ~LFS_F_ERRED;
-    return nsize;
+    return size;
 }
-#endif
 
-static lfs_soff_t lfs_file_rawseek(lfs_t *lfs, lfs_file_t *file,
+// whether a write only lands in the file's cache, without touching the
+// block device
+static bool lfs_file_fitscache(lfs_t *lfs, lfs_file_t *file,
+        lfs_size_t size) {
+    if (!(file->flags & LFS_F_WRITING)) {
+        return false;
+    }
+
+    if (file->flags & LFS_F_INLINE) {
+        return lfs_max(file->pos+size, file->ctz.size) <= lfs->inline_max;
+    }
+
+    // the cache is flushed as soon as it fills up
+    lfs_off_t start = (file->cache.block == file->block)
+            ? file->cache.off
+            : lfs_aligndown(file->off, lfs->cfg->prog_size);
+    return file->off + size < start + lfs->cfg->cache_size;
+}
+
+// whether a write needs a newly erased block
+static bool lfs_file_needsblock(lfs_t *lfs, lfs_file_t *file,
+        lfs_size_t size) {
+    if (size == 0) {
+        return false;
+    }
+
+    if (file->flags & LFS_F_INLINE) {
+        return lfs_max(file->pos+size, file->ctz.size) > lfs->inline_max;
+    }
+
+    return !(file->flags & LFS_F_WRITING)
+            || file->off + size > lfs->cfg->block_size;
+}
+
+static lfs_ssize_t lfs_file_rawwrite_nb(lfs_t *lfs, lfs_file_t *file,
+        const void *buffer, lfs_size_t size) {
+    // the buffer may need to be borrowed before it can be checked
+    int err = lfs_file_borrow(lfs, file);
+    if (err) {
+        return err;
+    }
+
+    if (!lfs->cfg->busy || lfs_file_fitscache(lfs, file, size)) {
+        return lfs_file_rawwrite(lfs, file, buffer, size);
+    }
+
+    int busy = lfs->cfg->busy(lfs->cfg);
+    if (busy) {
+        return (busy < 0) ? busy : LFS_ERR_INPROGRESS;
+    }
+
+    if (lfs->free.erased == LFS_BLOCK_NULL
+            && lfs_file_needsblock(lfs, file, size)) {
+        // start erasing the block this write will need and let the caller
+        // get on with other work in the meantime
+        lfs_block_t block;
+        err = lfs_alloc(lfs, &block);
+        if (err) {
+            return err;
+        }
+
+        err = lfs_bd_erase(lfs, block);
+        if (err && err != LFS_ERR_CORRUPT) {
+            return err;
+        }
+
+        // a bad block is left to the block device, try another next time
+        if (!err) {
+            lfs->free.erased = block;
+        }
+        return LFS_ERR_INPROGRESS;
+    }
+
+    return lfs_file_rawwrite(lfs, file, buffer, size);
+}
+#endif
+
+static lfs_soff_t lfs_file_rawseek(lfs_t *lfs, lfs_file_t *file,
         lfs_soff_t off, int whence) {
     // find new pos
     lfs_off_t npos = file->pos;
@@ -3640,14 +4728,17 @@ static int lfs_file_rawtruncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
         return LFS_ERR_INVAL;
     }
 
+    int err = lfs_file_borrow(lfs, file);
+    if (err) {
+        return err;
+    }
+
     lfs_off_t pos = file->pos;
     lfs_off_t oldsize = lfs_file_rawsize(lfs, file);
     if (size < oldsize) {
-        // revert to inline file?
-        if (size <= lfs_min(0x3fe, lfs_min(
-                lfs->cfg->cache_size,
-                (lfs->cfg->metadata_max ?
-                    lfs->cfg->metadata_max : lfs->cfg->block_size) / 8))) {
+        // revert to inline file? the data passes through rcache, so
+        // this is limited to cache_size
+        if (size <= lfs_min(lfs->inline_max, lfs->cfg->cache_size)) {
             // flush+seek to head
             lfs_soff_t res = lfs_file_rawseek(lfs, file, 0, LFS_SEEK_SET);
             if (res < 0) {
@@ -3664,15 +4755,16 @@ static int lfs_file_rawtruncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
 
             file->ctz.head = LFS_BLOCK_INLINE;
             file->ctz.size = size;
+            file->ra.count = 0;
             file->flags |= LFS_F_DIRTY | LFS_F_READING | LFS_F_INLINE;
             file->cache.block = file->ctz.head;
             file->cache.off = 0;
-            file->cache.size = lfs->cfg->cache_size;
+            file->cache.size = lfs_file_buffersize(lfs);
             memcpy(file->cache.buffer, lfs->rcache.buffer, size);
 
         } else {
             // need to flush since directly changing metadata
-            int err = lfs_file_flush(lfs, file);
+            err = lfs_file_flush(lfs, file);
             if (err) {
                 return err;
             }
@@ -3690,6 +4782,7 @@ static int lfs_file_rawtruncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             file->pos = size;
             file->ctz.head = file->block;
             file->ctz.size = size;
+            file->ra.count = 0;
             file->flags |= LFS_F_DIRTY | LFS_F_READING;
         }
     } else if (size > oldsize) {
@@ -3805,6 +4898,7 @@ static int lfs_rawremove(lfs_t *lfs, const char *path) {
     }
 
     // delete the entry
+    lfs_size_t used = lfs_dir_getused(lfs, &cwd, lfs_tag_id(tag));
     err = lfs_dir_commit(lfs, &cwd, LFS_MKATTRS(
             {LFS_MKTAG(LFS_TYPE_DELETE, lfs_tag_id(tag), 0), NULL}));
     if (err) {
@@ -3812,6 +4906,8 @@ static int lfs_rawremove(lfs_t *lfs, const char *path) {
         return err;
     }
 
+    lfs_fs_addused(lfs, -(lfs_ssize_t)used);
+
     lfs->mlist = dir.next;
     if (lfs_tag_type3(tag) == LFS_TYPE_DIR) {
         // fix orphan
@@ -3903,73 +4999,818 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
             return LFS_ERR_NOTEMPTY;
         }
 
-        // mark fs as orphaned
-        err = lfs_fs_preporphans(lfs, +1);
+        // mark fs as orphaned
+        err = lfs_fs_preporphans(lfs, +1);
+        if (err) {
+            return err;
+        }
+
+        // I know it's crazy but yes, dir can be changed by our parent's
+        // commit (if predecessor is child)
+        prevdir.type = 0;
+        prevdir.id = 0;
+        lfs->mlist = &prevdir;
+    }
+
+    if (!samepair) {
+        lfs_fs_prepmove(lfs, newoldid, oldcwd.pair);
+    }
+
+    // move over all attributes, the moved file keeps its blocks but any
+    // file we replace gives its up
+    lfs_size_t prevused = (prevtag != LFS_ERR_NOENT)
+            ? lfs_dir_getused(lfs, &newcwd, newid)
+            : 0;
+    err = lfs_dir_commit(lfs, &newcwd, LFS_MKATTRS(
+            {LFS_MKTAG_IF(prevtag != LFS_ERR_NOENT,
+                LFS_TYPE_DELETE, newid, 0), NULL},
+            {LFS_MKTAG(LFS_TYPE_CREATE, newid, 0), NULL},
+            {LFS_MKTAG(lfs_tag_type3(oldtag), newid, strlen(newpath)), newpath},
+            {LFS_MKTAG(LFS_FROM_MOVE, newid, lfs_tag_id(oldtag)), &oldcwd},
+            {LFS_MKTAG_IF(samepair,
+                LFS_TYPE_DELETE, newoldid, 0), NULL}));
+    if (err) {
+        lfs->mlist = prevdir.next;
+        return err;
+    }
+
+    lfs_fs_addused(lfs, -(lfs_ssize_t)prevused);
+
+    // let commit clean up after move (if we're different! otherwise move
+    // logic already fixed it for us)
+    if (!samepair && lfs_gstate_hasmove(&lfs->gstate)) {
+        // prep gstate and delete move id
+        lfs_fs_prepmove(lfs, 0x3ff, NULL);
+        err = lfs_dir_commit(lfs, &oldcwd, LFS_MKATTRS(
+                {LFS_MKTAG(LFS_TYPE_DELETE, lfs_tag_id(oldtag), 0), NULL}));
+        if (err) {
+            lfs->mlist = prevdir.next;
+            return err;
+        }
+    }
+
+    lfs->mlist = prevdir.next;
+    if (prevtag != LFS_ERR_NOENT
+            && lfs_tag_type3(prevtag) == LFS_TYPE_DIR) {
+        // fix orphan
+        err = lfs_fs_preporphans(lfs, -1);
+        if (err) {
+            return err;
+        }
+
+        err = lfs_fs_pred(lfs, prevdir.m.pair, &newcwd);
+        if (err) {
+            return err;
+        }
+
+        err = lfs_dir_drop(lfs, &newcwd, &prevdir.m);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+// what a transaction does with each of its entries
+enum {
+    LFS_TXN_OPEN   = 1, // writes an existing file
+    LFS_TXN_CREATE = 2, // creates and writes a new file
+    LFS_TXN_REMOVE = 3, // removes a file
+    LFS_TXN_RENAME = 4, // renames a file, replacing any at newpath
+};
+
+// where each op's entries are when the transaction commits
+struct lfs_txn_res {
+    const char *name;
+    uint16_t id;
+    uint16_t newid;
+    bool exists;
+    int start;
+    uint16_t pos;
+};
+
+// whether name a sorts before name b in the order lfs_dir_find keeps
+// names in, see lfs_dir_find_match, a name sorts before its prefixes
+static bool lfs_txn_before(const char *a, const char *b) {
+    lfs_size_t asize = strlen(a);
+    lfs_size_t bsize = strlen(b);
+    int res = memcmp(a, b, lfs_min(asize, bsize));
+    return (res != 0) ? res < 0 : asize > bsize;
+}
+
+// Where the entry at id ends up after attrs. With a name, id is instead
+// where a new entry of that name is inserted, which is after any entry
+// attrs create there that sorts before it.
+static uint16_t lfs_txn_shift(const struct lfs_mattr *attrs, int count,
+        uint16_t id, const char *name) {
+    for (int i = 0; i < count; i++) {
+        uint16_t aid = lfs_tag_id(attrs[i].tag);
+        if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_CREATE &&
+                (id > aid || (id == aid &&
+                    (!name || lfs_txn_before(attrs[i+1].buffer, name))))) {
+            id += 1;
+        } else if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_DELETE &&
+                id > aid) {
+            id -= 1;
+        }
+    }
+
+    return id;
+}
+
+// find a file for a transaction, every entry must be in the pair of the
+// first one found
+static lfs_stag_t lfs_txn_find(lfs_t *lfs, lfs_mdir_t *cwd,
+        const char **path, uint16_t *id) {
+    lfs_mdir_t dir;
+    lfs_stag_t tag = lfs_dir_find(lfs, &dir, path, id);
+    if ((tag < 0 || lfs_tag_id(tag) == 0x3ff) &&
+            !(tag == LFS_ERR_NOENT && *id != 0x3ff)) {
+        return (tag < 0) ? tag : LFS_ERR_INVAL;
+    }
+
+    if (tag >= 0 && lfs_tag_type3(tag) != LFS_TYPE_REG) {
+        return LFS_ERR_ISDIR;
+    }
+
+    if (lfs_pair_isnull(cwd->pair)) {
+        *cwd = dir;
+    } else if (lfs_pair_cmp(dir.pair, cwd->pair) != 0) {
+        return LFS_ERR_INVAL;
+    }
+
+    if (tag >= 0) {
+        *id = lfs_tag_id(tag);
+    }
+    return tag;
+}
+
+static int lfs_txn_rawopencfg(lfs_t *lfs, lfs_txn_t *txn,
+        lfs_file_t *file, const char *path, int flags,
+        const struct lfs_file_config *cfg) {
+    if (txn->count == LFS_TXN_MAX) {
+        return LFS_ERR_NOMEM;
+    }
+
+    // a pool line can be taken back at any time, syncing the file
+    if (!cfg->buffer && lfs->cfg->file_pool_buffer) {
+        return LFS_ERR_INVAL;
+    }
+
+    int err = lfs_file_rawopencfg(lfs, file, path, flags | LFS_F_TXN, cfg);
+    if (err) {
+        return err;
+    }
+
+    struct lfs_txn_op *op = &txn->ops[txn->count];
+    op->type = lfs_pair_isnull(file->m.pair)
+            ? LFS_TXN_CREATE
+            : LFS_TXN_OPEN;
+    op->path = path;
+    op->newpath = NULL;
+    op->file = file;
+    txn->count += 1;
+    return 0;
+}
+
+static int lfs_txn_stage(lfs_txn_t *txn, uint8_t type,
+        const char *path, const char *newpath) {
+    if (txn->count == LFS_TXN_MAX) {
+        return LFS_ERR_NOMEM;
+    }
+
+    struct lfs_txn_op *op = &txn->ops[txn->count];
+    op->type = type;
+    op->path = path;
+    op->newpath = newpath;
+    op->file = NULL;
+    txn->count += 1;
+    return 0;
+}
+
+static int lfs_txn_rawabort(lfs_t *lfs, lfs_txn_t *txn) {
+    for (int i = 0; i < txn->count; i++) {
+        lfs_file_t *file = txn->ops[i].file;
+        if (file) {
+            // throw away anything not committed, the blocks written are
+            // free again once the file is closed
+            file->flags &= ~(LFS_F_DIRTY | LFS_F_WRITING | LFS_F_TXN);
+            lfs_file_rawclose(lfs, file);
+        }
+    }
+
+    txn->count = 0;
+    return 0;
+}
+
+static int lfs_txn_resolve(lfs_t *lfs, lfs_txn_t *txn,
+        lfs_mdir_t *cwd, struct lfs_txn_res *res) {
+    cwd->pair[0] = LFS_BLOCK_NULL;
+    cwd->pair[1] = LFS_BLOCK_NULL;
+
+    // entries each op uses, no entry may be used by two ops
+    uint16_t taken[2*LFS_TXN_MAX];
+    const char *created[2*LFS_TXN_MAX];
+    int ntaken = 0;
+    int ncreated = 0;
+    for (int i = 0; i < txn->count; i++) {
+        struct lfs_txn_op *op = &txn->ops[i];
+        struct lfs_txn_res *r = &res[i];
+        r->exists = false;
+
+        if (op->type == LFS_TXN_OPEN) {
+            // the file may have been removed since it was opened
+            lfs_file_t *file = op->file;
+            if (lfs_pair_isnull(file->m.pair)) {
+                return LFS_ERR_NOENT;
+            }
+
+            if (lfs_pair_isnull(cwd->pair)) {
+                *cwd = file->m;
+            } else if (lfs_pair_cmp(file->m.pair, cwd->pair) != 0) {
+                return LFS_ERR_INVAL;
+            }
+            r->id = file->id;
+        } else {
+            // a new file may have been created by someone else since
+            r->name = op->path;
+            lfs_stag_t tag = lfs_txn_find(lfs, cwd, &r->name, &r->id);
+            if (tag < 0 && tag != LFS_ERR_NOENT) {
+                return tag;
+            } else if (op->type == LFS_TXN_CREATE && tag >= 0) {
+                return LFS_ERR_EXIST;
+            } else if (op->type != LFS_TXN_CREATE && tag < 0) {
+                return LFS_ERR_NOENT;
+            }
+        }
+
+        if (op->type == LFS_TXN_RENAME) {
+            r->name = op->newpath;
+            lfs_stag_t tag = lfs_txn_find(lfs, cwd, &r->name, &r->newid);
+            if (tag < 0 && tag != LFS_ERR_NOENT) {
+                return tag;
+            }
+
+            // check that name fits
+            if (strlen(r->name) > lfs->name_max) {
+                return LFS_ERR_NAMETOOLONG;
+            }
+
+            r->exists = (tag >= 0);
+            if (r->exists && r->newid != r->id) {
+                taken[ntaken++] = r->newid;
+            } else if (!r->exists) {
+                created[ncreated++] = r->name;
+            }
+        } else if (op->type == LFS_TXN_CREATE) {
+            created[ncreated++] = r->name;
+        }
+
+        if (op->type != LFS_TXN_CREATE) {
+            taken[ntaken++] = r->id;
+        }
+    }
+
+    for (int i = 0; i < ntaken; i++) {
+        for (int j = 0; j < i; j++) {
+            if (taken[i] == taken[j]) {
+                return LFS_ERR_INVAL;
+            }
+        }
+    }
+
+    for (int i = 0; i < ncreated; i++) {
+        for (int j = 0; j < i; j++) {
+            if (strcmp(created[i], created[j]) == 0) {
+                return LFS_ERR_INVAL;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int lfs_txn_rawcommit(lfs_t *lfs, lfs_txn_t *txn) {
+    // deorphan if we haven't yet, needed at most once after poweron
+    int err = lfs_fs_forceconsistency(lfs);
+    if (err) {
+        goto abort;
+    }
+
+    // write out the files' data, nothing references it until the commit
+    for (int i = 0; i < txn->count; i++) {
+        lfs_file_t *file = txn->ops[i].file;
+        if (!file) {
+            continue;
+        }
+
+        if (file->flags & LFS_F_ERRED) {
+            err = LFS_ERR_IO;
+            goto abort;
+        }
+
+        err = lfs_file_flush(lfs, file);
+        if (err) {
+            goto abort;
+        }
+    }
+
+    // find every entry again, the directory may have changed since they
+    // were staged
+    struct lfs_mlist cwd;
+    struct lfs_txn_res res[LFS_TXN_MAX];
+    err = lfs_txn_resolve(lfs, txn, &cwd.m, res);
+    if (err) {
+        goto abort;
+    }
+
+    // renames, removes and creates first, each id is where the entry is
+    // after the attrs before it, moves copy from the pair as it is now
+    struct lfs_mattr attrs[5*LFS_TXN_MAX];
+    struct lfs_ctz ctzs[LFS_TXN_MAX];
+    lfs_mdir_t disk = cwd.m;
+    lfs_ssize_t used = 0;
+    int n = 0;
+    for (int i = 0; i < txn->count; i++) {
+        struct lfs_txn_op *op = &txn->ops[i];
+        struct lfs_txn_res *r = &res[i];
+        if (op->type == LFS_TXN_REMOVE) {
+            used -= lfs_dir_getused(lfs, &cwd.m, r->id);
+            uint16_t id = lfs_txn_shift(attrs, n, r->id, NULL);
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_DELETE, id, 0), NULL};
+        } else if (op->type == LFS_TXN_RENAME) {
+            if (r->exists && r->newid == r->id) {
+                // we're renaming to ourselves??
+                continue;
+            }
+
+            // any file we replace gives its blocks up
+            if (r->exists) {
+                used -= lfs_dir_getused(lfs, &cwd.m, r->newid);
+                uint16_t id = lfs_txn_shift(attrs, n, r->newid, NULL);
+                attrs[n++] = (struct lfs_mattr){
+                        LFS_MKTAG(LFS_TYPE_DELETE, id, 0), NULL};
+            }
+
+            uint16_t pos = lfs_txn_shift(attrs, n, r->newid,
+                    r->exists ? NULL : r->name);
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_CREATE, pos, 0), NULL};
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_REG, pos, strlen(r->name)), r->name};
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_FROM_MOVE, pos, r->id), &disk};
+            uint16_t oldid = lfs_txn_shift(attrs, n, r->id, NULL);
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_DELETE, oldid, 0), NULL};
+        } else if (op->type == LFS_TXN_CREATE) {
+            r->start = n;
+            r->pos = lfs_txn_shift(attrs, n, r->id, r->name);
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_CREATE, r->pos, 0), NULL};
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_REG, r->pos, strlen(r->name)),
+                    r->name};
+        }
+    }
+
+    // then the files' data and attributes, at the ids they end up at
+    int entries = n;
+    for (int i = 0; i < txn->count; i++) {
+        lfs_file_t *file = txn->ops[i].file;
+        struct lfs_txn_res *r = &res[i];
+        if (txn->ops[i].type == LFS_TXN_OPEN) {
+            if (!(file->flags & LFS_F_DIRTY)) {
+                continue;
+            }
+
+            used -= lfs_dir_getused(lfs, &cwd.m, r->id);
+            r->pos = lfs_txn_shift(attrs, entries, r->id, NULL);
+        } else if (txn->ops[i].type == LFS_TXN_CREATE) {
+            r->pos = lfs_txn_shift(&attrs[r->start+2],
+                    entries - (r->start+2), r->pos, NULL);
+        } else {
+            continue;
+        }
+
+        if (file->flags & LFS_F_INLINE) {
+            // inline the whole file
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_INLINESTRUCT, r->pos, file->ctz.size),
+                    file->cache.buffer};
+        } else {
+            // update the ctz reference, copied so alloc will work during
+            // a relocate
+            ctzs[i] = file->ctz;
+            lfs_ctz_tole32(&ctzs[i]);
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_CTZSTRUCT, r->pos, sizeof(ctzs[i])),
+                    &ctzs[i]};
+            used += lfs_ctz_count(lfs, file->ctz.size);
+        }
+        attrs[n++] = (struct lfs_mattr){
+                LFS_MKTAG(LFS_FROM_USERATTRS, r->pos, file->cfg->attr_count),
+                file->cfg->attrs};
+    }
+
+    if (n > 0) {
+        // the pair may be relocated by the commit, hook ourselves into
+        // littlefs to catch this, open files follow their ids through
+        // the mlist
+        cwd.next = lfs->mlist;
+        cwd.type = 0;
+        cwd.id = 0;
+        lfs->mlist = &cwd;
+        err = lfs_dir_commit(lfs, &cwd.m, attrs, n);
+        lfs->mlist = cwd.next;
+        if (err) {
+            goto abort;
+        }
+
+        lfs_fs_addused(lfs, used);
+    }
+
+    // the new files' entries exist now, close everyone
+    for (int i = 0; i < txn->count; i++) {
+        lfs_file_t *file = txn->ops[i].file;
+        if (!file) {
+            continue;
+        }
+
+        if (txn->ops[i].type == LFS_TXN_CREATE) {
+            file->m = cwd.m;
+            file->id = res[i].pos;
+            while (file->id >= file->m.count && file->m.split) {
+                // we split and id is on tail now
+                file->id -= file->m.count;
+                int ferr = lfs_dir_fetch(lfs, &file->m, file->m.tail);
+                if (ferr) {
+                    // committed, but we can't follow the file
+                    file->m.pair[0] = LFS_BLOCK_NULL;
+                    file->m.pair[1] = LFS_BLOCK_NULL;
+                    err = err ? err : ferr;
+                    break;
+                }
+            }
+        }
+
+        file->flags &= ~(LFS_F_DIRTY | LFS_F_TXN);
+        int cerr = lfs_file_rawclose(lfs, file);
+        err = err ? err : cerr;
+    }
+
+    txn->count = 0;
+    return err;
+
+abort:
+    lfs_txn_rawabort(lfs, txn);
+    return err;
+}
+#endif
+
+// what a key-value store's staged operations do
+enum {
+    LFS_KV_PUT    = 1,
+    LFS_KV_DELETE = 2,
+};
+
+// keys are names in the store's directory, without any path
+static int lfs_kv_checkkey(lfs_t *lfs, const char *key) {
+    lfs_size_t nlen = strlen(key);
+    if (nlen == 0 || strchr(key, '/') ||
+            strcmp(key, ".") == 0 || strcmp(key, "..") == 0) {
+        return LFS_ERR_INVAL;
+    }
+
+    if (nlen > lfs->name_max) {
+        return LFS_ERR_NAMETOOLONG;
+    }
+
+    return 0;
+}
+
+static struct lfs_kv_op *lfs_kv_staged(lfs_kv_t *kv, const char *key) {
+    for (int i = 0; i < kv->count; i++) {
+        if (strcmp(kv->ops[i].key, key) == 0) {
+            return &kv->ops[i];
+        }
+    }
+
+    return NULL;
+}
+
+// find a key, starting at the first pair of the store's directory, if it
+// doesn't exist dir and id are where it would be created
+static lfs_stag_t lfs_kv_find(lfs_t *lfs, lfs_kv_t *kv,
+        const char *key, lfs_mdir_t *dir, uint16_t *id) {
+    lfs_size_t namelen = strlen(key);
+    dir->tail[0] = kv->dir.head[0];
+    dir->tail[1] = kv->dir.head[1];
+    while (true) {
+        lfs_stag_t tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
+                LFS_MKTAG(0x780, 0, 0),
+                LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
+                id, lfs_dir_find_match, &(struct lfs_dir_find_match){
+                    lfs, key, namelen});
+        if (tag < 0) {
+            return tag;
+        }
+
+        if (tag) {
+            *id = lfs_tag_id(tag);
+            return tag;
+        }
+
+        if (!dir->split) {
+            return LFS_ERR_NOENT;
+        }
+    }
+}
+
+static int lfs_kv_rawopen(lfs_t *lfs, lfs_kv_t *kv, const char *path) {
+    kv->reading = false;
+    kv->count = 0;
+    int err = lfs_dir_rawopen(lfs, &kv->dir, path);
+#ifndef LFS_READONLY
+    if (err == LFS_ERR_NOENT) {
+        err = lfs_rawmkdir(lfs, path);
+        if (!err) {
+            err = lfs_dir_rawopen(lfs, &kv->dir, path);
+        }
+    }
+#endif
+    return err;
+}
+
+static lfs_ssize_t lfs_kv_rawget(lfs_t *lfs, lfs_kv_t *kv,
+        const char *key, void *buffer, lfs_size_t size) {
+    int err = lfs_kv_checkkey(lfs, key);
+    if (err) {
+        return err;
+    }
+
+    // staged changes win
+    const struct lfs_kv_op *op = lfs_kv_staged(kv, key);
+    if (op) {
+        if (op->type == LFS_KV_DELETE) {
+            return LFS_ERR_NOENT;
+        }
+
+        memcpy(buffer, op->value, lfs_min(size, op->size));
+        return op->size;
+    }
+
+    lfs_mdir_t dir;
+    uint16_t id;
+    lfs_stag_t tag = lfs_kv_find(lfs, kv, key, &dir, &id);
+    if (tag < 0) {
+        return tag;
+    }
+
+    if (lfs_tag_type3(tag) != LFS_TYPE_REG) {
+        return LFS_ERR_ISDIR;
+    }
+
+    // an inline value comes with its struct, so read straight into the
+    // buffer if a ctz struct would fit there too
+    struct lfs_ctz ctz;
+    bool direct = (size >= sizeof(ctz));
+    tag = lfs_dir_get(lfs, &dir, LFS_MKTAG(0x700, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_STRUCT, id,
+                direct ? lfs_min(size, 0x3fe) : sizeof(ctz)),
+            direct ? buffer : &ctz);
+    if (tag < 0) {
+        return tag;
+    }
+
+    if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
+        if (!direct) {
+            memcpy(buffer, &ctz, lfs_min(size, lfs_tag_size(tag)));
+        }
+        return lfs_tag_size(tag);
+    }
+
+    // a value written as a larger file through the file API
+    if (direct) {
+        memcpy(&ctz, buffer, sizeof(ctz));
+    }
+    lfs_ctz_fromle32(&ctz);
+
+    lfs_size_t nsize = lfs_min(size, ctz.size);
+    for (lfs_off_t off = 0; off < nsize;) {
+        lfs_block_t block;
+        lfs_off_t boff;
+        err = lfs_ctz_find(lfs, NULL, &lfs->rcache,
+                ctz.head, ctz.size, off, &block, &boff);
+        if (err) {
+            return err;
+        }
+
+        lfs_size_t diff = lfs_min(nsize - off, lfs->cfg->block_size - boff);
+        err = lfs_bd_read(lfs, NULL, &lfs->rcache, diff,
+                block, boff, (uint8_t*)buffer + off, diff);
+        if (err) {
+            return err;
+        }
+
+        off += diff;
+    }
+
+    return ctz.size;
+}
+
+#ifndef LFS_READONLY
+static int lfs_kv_stage(lfs_t *lfs, lfs_kv_t *kv, uint8_t type,
+        const char *key, const void *value, lfs_size_t size) {
+    int err = lfs_kv_checkkey(lfs, key);
+    if (err) {
+        return err;
+    }
+
+    // values are always inlined
+    if (size > lfs->inline_max) {
+        return LFS_ERR_FBIG;
+    }
+
+    struct lfs_kv_op *op = lfs_kv_staged(kv, key);
+    if (!op) {
+        if (kv->count == LFS_KV_BATCH_MAX) {
+            return LFS_ERR_NOMEM;
+        }
+
+        op = &kv->ops[kv->count];
+        kv->count += 1;
+    }
+
+    op->type = type;
+    op->key = key;
+    op->value = value;
+    op->size = size;
+    return 0;
+}
+
+static int lfs_kv_rawcommit(lfs_t *lfs, lfs_kv_t *kv) {
+    // deorphan if we haven't yet, needed at most once after poweron
+    int err = lfs_fs_forceconsistency(lfs);
+    if (err) {
+        goto cleanup;
+    }
+
+    // the batch is one commit, so every key it changes must be in the
+    // pair of the first one found, see lfs_txn_find
+    struct lfs_mlist cwd;
+    cwd.m.pair[0] = LFS_BLOCK_NULL;
+    cwd.m.pair[1] = LFS_BLOCK_NULL;
+    struct lfs_txn_res res[LFS_KV_BATCH_MAX];
+    bool group[LFS_KV_BATCH_MAX];
+    for (int i = 0; i < kv->count; i++) {
+        struct lfs_txn_res *r = &res[i];
+        lfs_mdir_t dir;
+        lfs_stag_t tag = lfs_kv_find(lfs, kv, kv->ops[i].key, &dir, &r->id);
+        if (tag < 0 && tag != LFS_ERR_NOENT) {
+            err = tag;
+            goto cleanup;
+        }
+
+        if (tag >= 0 && lfs_tag_type3(tag) != LFS_TYPE_REG) {
+            err = LFS_ERR_ISDIR;
+            goto cleanup;
+        }
+
+        // deleting a key that doesn't exist changes nothing
+        group[i] = (tag >= 0 || kv->ops[i].type == LFS_KV_PUT);
+        if (!group[i]) {
+            continue;
+        }
+
+        if (lfs_pair_isnull(cwd.m.pair)) {
+            cwd.m = dir;
+        } else if (lfs_pair_cmp(dir.pair, cwd.m.pair) != 0) {
+            err = LFS_ERR_INVAL;
+            goto cleanup;
+        }
+
+        r->name = kv->ops[i].key;
+        r->exists = (tag >= 0);
+    }
+
+    // creates and deletes first, each id is where the entry is after
+    // the attrs before it, see lfs_txn_rawcommit
+    struct lfs_mattr attrs[3*LFS_KV_BATCH_MAX];
+    lfs_ssize_t used = 0;
+    int n = 0;
+    for (int i = 0; i < kv->count; i++) {
+        struct lfs_txn_res *r = &res[i];
+        if (!group[i]) {
+            continue;
+        }
+
+        if (kv->ops[i].type == LFS_KV_DELETE) {
+            used -= lfs_dir_getused(lfs, &cwd.m, r->id);
+            uint16_t id = lfs_txn_shift(attrs, n, r->id, NULL);
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_DELETE, id, 0), NULL};
+        } else if (!r->exists) {
+            r->start = n;
+            r->pos = lfs_txn_shift(attrs, n, r->id, r->name);
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_CREATE, r->pos, 0), NULL};
+            attrs[n++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_REG, r->pos, strlen(r->name)),
+                    r->name};
+        }
+    }
+
+    // then the values, at the ids they end up at
+    int entries = n;
+    for (int i = 0; i < kv->count; i++) {
+        struct lfs_kv_op *op = &kv->ops[i];
+        struct lfs_txn_res *r = &res[i];
+        if (!group[i] || op->type != LFS_KV_PUT) {
+            continue;
+        }
+
+        if (r->exists) {
+            used -= lfs_dir_getused(lfs, &cwd.m, r->id);
+            r->pos = lfs_txn_shift(attrs, entries, r->id, NULL);
+        } else {
+            r->pos = lfs_txn_shift(&attrs[r->start+2],
+                    entries - (r->start+2), r->pos, NULL);
+        }
+
+        attrs[n++] = (struct lfs_mattr){
+                LFS_MKTAG(LFS_TYPE_INLINESTRUCT, r->pos, op->size),
+                op->value};
+    }
+
+    if (n > 0) {
+        // the pair may be relocated by the commit, hook ourselves into
+        // littlefs to catch this
+        cwd.next = lfs->mlist;
+        cwd.type = 0;
+        cwd.id = 0;
+        lfs->mlist = &cwd;
+        err = lfs_dir_commit(lfs, &cwd.m, attrs, n);
+        lfs->mlist = cwd.next;
         if (err) {
-            return err;
+            goto cleanup;
         }
 
-        // I know it's crazy but yes, dir can be changed by our parent's
-        // commit (if predecessor is child)
-        prevdir.type = 0;
-        prevdir.id = 0;
-        lfs->mlist = &prevdir;
+        lfs_fs_addused(lfs, used);
     }
 
-    if (!samepair) {
-        lfs_fs_prepmove(lfs, newoldid, oldcwd.pair);
+cleanup:
+    // deleting the entry our iteration is at leaves it without a pair,
+    // see lfs_dir_commit, so it starts over
+    if (lfs_pair_isnull(kv->dir.m.pair)) {
+        kv->reading = false;
     }
 
-    // move over all attributes
-    err = lfs_dir_commit(lfs, &newcwd, LFS_MKATTRS(
-            {LFS_MKTAG_IF(prevtag != LFS_ERR_NOENT,
-                LFS_TYPE_DELETE, newid, 0), NULL},
-            {LFS_MKTAG(LFS_TYPE_CREATE, newid, 0), NULL},
-            {LFS_MKTAG(lfs_tag_type3(oldtag), newid, strlen(newpath)), newpath},
-            {LFS_MKTAG(LFS_FROM_MOVE, newid, lfs_tag_id(oldtag)), &oldcwd},
-            {LFS_MKTAG_IF(samepair,
-                LFS_TYPE_DELETE, newoldid, 0), NULL}));
-    if (err) {
-        lfs->mlist = prevdir.next;
-        return err;
-    }
+    kv->count = 0;
+    return err;
+}
+#endif
 
-    // let commit clean up after move (if we're different! otherwise move
-    // logic already fixed it for us)
-    if (!samepair && lfs_gstate_hasmove(&lfs->gstate)) {
-        // prep gstate and delete move id
-        lfs_fs_prepmove(lfs, 0x3ff, NULL);
-        err = lfs_dir_commit(lfs, &oldcwd, LFS_MKATTRS(
-                {LFS_MKTAG(LFS_TYPE_DELETE, lfs_tag_id(oldtag), 0), NULL}));
-        if (err) {
-            lfs->mlist = prevdir.next;
-            return err;
-        }
+static int lfs_kv_rawclose(lfs_t *lfs, lfs_kv_t *kv) {
+    int err = 0;
+#ifndef LFS_READONLY
+    if (kv->count > 0) {
+        err = lfs_kv_rawcommit(lfs, kv);
     }
+#endif
 
-    lfs->mlist = prevdir.next;
-    if (prevtag != LFS_ERR_NOENT
-            && lfs_tag_type3(prevtag) == LFS_TYPE_DIR) {
-        // fix orphan
-        err = lfs_fs_preporphans(lfs, -1);
+    int cerr = lfs_dir_rawclose(lfs, &kv->dir);
+    return err ? err : cerr;
+}
+
+static int lfs_kv_rawread(lfs_t *lfs, lfs_kv_t *kv, struct lfs_info *info) {
+    // keys created since the store was opened or rewound count as read
+    // already for the directory, start over from the first pair so an
+    // iteration sees every key committed before it started
+    if (!kv->reading) {
+        int err = lfs_dir_rawrewind(lfs, &kv->dir);
         if (err) {
             return err;
         }
+        kv->reading = true;
+    }
 
-        err = lfs_fs_pred(lfs, prevdir.m.pair, &newcwd);
-        if (err) {
-            return err;
+    while (true) {
+        int res = lfs_dir_rawread(lfs, &kv->dir, info);
+        if (res <= 0) {
+            return res;
         }
 
-        err = lfs_dir_drop(lfs, &newcwd, &prevdir.m);
-        if (err) {
-            return err;
+        // only files are keys, this also skips '.' and '..'
+        if (info->type == LFS_TYPE_REG) {
+            return res;
         }
     }
-
-    return 0;
 }
-#endif
 
 static lfs_ssize_t lfs_rawgetattr(lfs_t *lfs, const char *path,
         uint8_t type, void *buffer, lfs_size_t size) {
@@ -4124,6 +5965,36 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
             goto cleanup;
         }
     }
+    lfs->free.worn = false;
+    lfs->free.erased = LFS_BLOCK_NULL;
+
+    // yield_count isn't protected by the shared lock
+#ifdef LFS_THREADSAFE
+    LFS_ASSERT(!(lfs->cfg->yield && lfs->cfg->lock_shared));
+#endif
+    lfs->yield_count = 0;
+    lfs->pool_stamp = 0;
+    lfs->used = LFS_USED_UNKNOWN;
+
+    // check the verify policy, sampling needs an interval
+    LFS_ASSERT(lfs->cfg->verify >= LFS_VERIFY_ALL
+            && lfs->cfg->verify <= LFS_VERIFY_NONE);
+    LFS_ASSERT(lfs->cfg->verify != LFS_VERIFY_SAMPLED
+            || lfs->cfg->verify_interval > 0);
+    lfs->verify_count = 0;
+
+    // setup compaction summary, must be 16-bit aligned
+    LFS_ASSERT((uintptr_t)lfs->cfg->compact_buffer % 2 == 0);
+    lfs->summary.source = NULL;
+    if (lfs->cfg->compact_buffer) {
+        lfs->summary.tags = lfs->cfg->compact_buffer;
+    } else if (lfs->cfg->compact_size) {
+        lfs->summary.tags = lfs_malloc(lfs->cfg->compact_size);
+        if (!lfs->summary.tags) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+    }
 
     // check that the size limits are sane
     LFS_ASSERT(lfs->cfg->name_max <= LFS_NAME_MAX);
@@ -4146,6 +6017,26 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
 
     LFS_ASSERT(lfs->cfg->metadata_max <= lfs->cfg->block_size);
 
+    LFS_ASSERT(lfs->cfg->inline_max == (lfs_size_t)-1
+            || lfs->cfg->inline_max <= lfs_min(0x3fe,
+                (lfs->cfg->metadata_max
+                    ? lfs->cfg->metadata_max
+                    : lfs->cfg->block_size) / 8));
+    lfs->inline_max = lfs->cfg->inline_max;
+    if (lfs->inline_max == (lfs_size_t)-1) {
+        lfs->inline_max = 0;
+    } else if (!lfs->inline_max) {
+        lfs->inline_max = lfs_min(0x3fe, lfs_min(
+                lfs->cfg->cache_size,
+                (lfs->cfg->metadata_max
+                    ? lfs->cfg->metadata_max
+                    : lfs->cfg->block_size) / 8));
+    }
+
+    // the file buffer pool needs at least one line
+    LFS_ASSERT(!lfs->cfg->file_pool_buffer ||
+            lfs->cfg->file_pool_size >= lfs_file_buffersize(lfs));
+
     // setup default state
     lfs->root[0] = LFS_BLOCK_NULL;
     lfs->root[1] = LFS_BLOCK_NULL;
@@ -4179,6 +6070,10 @@ static int lfs_deinit(lfs_t *lfs) {
         lfs_free(lfs->free.buffer);
     }
 
+    if (!lfs->cfg->compact_buffer && lfs->cfg->compact_size) {
+        lfs_free(lfs->summary.tags);
+    }
+
     return 0;
 }
 
@@ -4808,9 +6703,15 @@ static int lfs_fs_deorphan(lfs_t *lfs, bool powerloss) {
                                     pair}));
                         lfs_pair_fromle32(pair);
                         if (state < 0) {
+                            lfs->used = LFS_USED_UNKNOWN;
                             return state;
                         }
 
+                        // the thread now reaches the revision the parent
+                        // points to, which may hold other blocks than the
+                        // one we counted, so count again when asked
+                        lfs->used = LFS_USED_UNKNOWN;
+
                         // did our commit create more orphans?
                         if (state == LFS_OK_ORPHANED) {
                             moreorphans = true;
@@ -4842,9 +6743,12 @@ static int lfs_fs_deorphan(lfs_t *lfs, bool powerloss) {
                                 dir.tail}));
                     lfs_pair_fromle32(dir.tail);
                     if (state < 0) {
+                        lfs->used = LFS_USED_UNKNOWN;
                         return state;
                     }
 
+                    lfs_fs_addused(lfs, -2);
+
                     // did our commit create more orphans?
                     if (state == LFS_OK_ORPHANED) {
                         moreorphans = true;
@@ -4924,15 +6828,337 @@ static int lfs_fs_size_count(void *p, lfs_block_t block) {
     return 0;
 }
 
-static lfs_ssize_t lfs_fs_rawsize(lfs_t *lfs) {
+// Blocks held by open files that aren't committed yet, counted the same
+// way lfs_fs_rawtraverse counts them
+static lfs_size_t lfs_fs_openused(lfs_t *lfs) {
     lfs_size_t size = 0;
-    int err = lfs_fs_rawtraverse(lfs, lfs_fs_size_count, &size, false);
+#ifndef LFS_READONLY
+    for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
+        if (f->type != LFS_TYPE_REG || (f->flags & LFS_F_INLINE)) {
+            continue;
+        }
+
+        if (f->flags & LFS_F_DIRTY) {
+            size += lfs_ctz_count(lfs, f->ctz.size);
+        }
+
+        if (f->flags & LFS_F_WRITING) {
+            size += lfs_ctz_count(lfs, f->pos);
+        }
+    }
+#else
+    (void)lfs;
+#endif
+    return size;
+}
+
+#ifndef LFS_READONLY
+// Blocks the committed entry at id holds, zero if we aren't keeping
+// count. If this fails we stop keeping count until the next lfs_fs_size.
+static lfs_size_t lfs_dir_getused(lfs_t *lfs,
+        const lfs_mdir_t *dir, uint16_t id) {
+    if (lfs->used == LFS_USED_UNKNOWN) {
+        return 0;
+    }
+
+    struct lfs_ctz ctz;
+    lfs_stag_t tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
+    if (tag < 0) {
+        if (tag != LFS_ERR_NOENT) {
+            lfs->used = LFS_USED_UNKNOWN;
+        }
+        return 0;
+    }
+    lfs_ctz_fromle32(&ctz);
+
+    if (lfs_tag_type3(tag) != LFS_TYPE_CTZSTRUCT) {
+        return 0;
+    }
+    return lfs_ctz_count(lfs, ctz.size);
+}
+
+// Follow a change to the committed blocks, called right after the
+// commit that makes it
+static void lfs_fs_addused(lfs_t *lfs, lfs_ssize_t diff) {
+    if (lfs->used != LFS_USED_UNKNOWN) {
+        lfs->used += diff;
+    }
+}
+#endif
+
+// The count of committed blocks is found with a traversal the first time
+// and kept up to date by every commit from then on. Commits in progress
+// pass cache=false, a traversal then would miss blocks they already
+// counted.
+static lfs_ssize_t lfs_fs_rawsize(lfs_t *lfs, bool cache) {
+    if (lfs->used == LFS_USED_UNKNOWN) {
+        lfs_size_t size = 0;
+        int err = lfs_fs_rawtraverse(lfs, lfs_fs_size_count, &size, false);
+        if (err) {
+            return err;
+        }
+
+        if (!cache) {
+            return size;
+        }
+
+        lfs->used = size - lfs_fs_openused(lfs);
+    }
+
+    return lfs->used + lfs_fs_openused(lfs);
+}
+
+static int lfs_fs_rawwear(lfs_t *lfs, struct lfs_wear *wear) {
+    if (!lfs->cfg->erase_count) {
+        return LFS_ERR_NOTSUP;
+    }
+
+    wear->min = 0xffffffff;
+    wear->max = 0;
+    wear->total = 0;
+    for (int i = 0; i < LFS_WEAR_HOT; i++) {
+        wear->hot[i] = 0xffffffff;
+        wear->hot_count[i] = 0;
+    }
+
+    for (lfs_block_t block = 0; block < lfs->cfg->block_count; block++) {
+        lfs_size_t count;
+        int err = lfs->cfg->erase_count(lfs->cfg, block, &count);
+        if (err) {
+            return err;
+        }
+
+        wear->min = lfs_min(wear->min, count);
+        wear->max = lfs_max(wear->max, count);
+        wear->total += count;
+
+        // insert into the most-erased list, keeping it sorted
+        for (int i = 0; i < LFS_WEAR_HOT; i++) {
+            if (wear->hot[i] == 0xffffffff || count > wear->hot_count[i]) {
+                for (int j = LFS_WEAR_HOT-1; j > i; j--) {
+                    wear->hot[j] = wear->hot[j-1];
+                    wear->hot_count[j] = wear->hot_count[j-1];
+                }
+                wear->hot[i] = block;
+                wear->hot_count[i] = count;
+                break;
+            }
+        }
+    }
+
+    wear->mean = wear->total / lfs->cfg->block_count;
+    return 0;
+}
+
+#ifndef LFS_READONLY
+struct lfs_fs_wearlevel_cold {
+    lfs_t *lfs;
+    lfs_size_t min;
+};
+
+static int lfs_fs_wearlevel_count(void *p, lfs_block_t block) {
+    struct lfs_fs_wearlevel_cold *cold = p;
+    lfs_size_t count;
+    int err = cold->lfs->cfg->erase_count(cold->lfs->cfg, block, &count);
+    if (err) {
+        return err;
+    }
+
+    cold->min = lfs_min(cold->min, count);
+    return 0;
+}
+
+// most erases of any block the allocator could hand out, found a
+// lookahead window at a time, the lookahead is dropped afterwards
+static int lfs_fs_wearlevel_freemax(lfs_t *lfs, lfs_size_t *max) {
+    *max = 0;
+    int err = 0;
+    for (lfs_block_t off = 0; off < lfs->cfg->block_count && !err;
+            off += 8*lfs->cfg->lookahead_size) {
+        lfs->free.off = off;
+        lfs->free.size = lfs_min(8*lfs->cfg->lookahead_size,
+                lfs->cfg->block_count - off);
+        err = lfs_alloc_scan(lfs);
+        if (err) {
+            return err;
+        }
+
+        for (lfs_block_t i = 0; i < lfs->free.size && !err; i++) {
+            if (lfs->free.buffer[i / 32] & (1U << (i % 32))) {
+                continue;
+            }
+
+            lfs_size_t count;
+            err = lfs->cfg->erase_count(lfs->cfg, off + i, &count);
+            if (!err) {
+                *max = lfs_max(*max, count);
+            }
+        }
+    }
+
+    lfs_alloc_drop(lfs);
+    return err;
+}
+
+static int lfs_fs_rawwearlevel(lfs_t *lfs,
+        lfs_size_t threshold, void *buffer) {
+    if (!lfs->cfg->erase_count) {
+        return LFS_ERR_NOTSUP;
+    }
+
+    // find the file sitting on the least worn blocks
+    lfs_mdir_t coldest_dir;
+    uint16_t coldest_id = 0x3ff;
+    struct lfs_ctz coldest_ctz;
+    lfs_size_t coldest = 0xffffffff;
+
+    lfs_mdir_t dir = {.tail = {0, 1}};
+    lfs_block_t tortoise[2] = {LFS_BLOCK_NULL, LFS_BLOCK_NULL};
+    lfs_size_t tortoise_i = 1;
+    lfs_size_t tortoise_period = 1;
+    while (!lfs_pair_isnull(dir.tail)) {
+        // detect cycles with Brent's algorithm
+        if (lfs_pair_issync(dir.tail, tortoise)) {
+            LFS_WARN("Cycle detected in tail list");
+            return LFS_ERR_CORRUPT;
+        }
+        if (tortoise_i == tortoise_period) {
+            tortoise[0] = dir.tail[0];
+            tortoise[1] = dir.tail[1];
+            tortoise_i = 0;
+            tortoise_period *= 2;
+        }
+        tortoise_i += 1;
+
+        int err = lfs_dir_fetch(lfs, &dir, dir.tail);
+        if (err) {
+            return err;
+        }
+
+        for (uint16_t id = 0; id < dir.count; id++) {
+            struct lfs_ctz ctz;
+            lfs_stag_t tag = lfs_dir_get(lfs, &dir, LFS_MKTAG(0x700, 0x3ff, 0),
+                    LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
+            if (tag < 0) {
+                if (tag == LFS_ERR_NOENT) {
+                    continue;
+                }
+                return tag;
+            }
+
+            lfs_ctz_fromle32(&ctz);
+            if (lfs_tag_type3(tag) != LFS_TYPE_CTZSTRUCT || ctz.size == 0) {
+                continue;
+            }
+
+            // leave open files alone
+            bool open = false;
+            for (struct lfs_mlist *m = lfs->mlist; m; m = m->next) {
+                if (m->type == LFS_TYPE_REG && m->id == id &&
+                        lfs_pair_cmp(m->m.pair, dir.pair) == 0) {
+                    open = true;
+                }
+            }
+            if (open) {
+                continue;
+            }
+
+            struct lfs_fs_wearlevel_cold cold = {lfs, 0xffffffff};
+            err = lfs_ctz_traverse(lfs, NULL, &lfs->rcache,
+                    ctz.head, ctz.size, lfs_fs_wearlevel_count, &cold);
+            if (err) {
+                return err;
+            }
+
+            if (cold.min < coldest) {
+                coldest = cold.min;
+                coldest_dir = dir;
+                coldest_id = id;
+                coldest_ctz = ctz;
+            }
+        }
+    }
+
+    if (coldest == 0xffffffff) {
+        return 0;
+    }
+
+    // only free blocks can take the file, worn blocks that are in use,
+    // such as hot metadata pairs, would never close the gap
+    lfs_size_t freemax;
+    int err = lfs_fs_wearlevel_freemax(lfs, &freemax);
+    if (err) {
+        return err;
+    }
+
+    if (freemax < coldest || freemax - coldest < threshold) {
+        return 0;
+    }
+
+    // rewrite the file from the start, this copies every block into newly
+    // allocated ones the same way any other write would, except that the
+    // allocator now prefers the most worn free blocks
+    struct lfs_file_config cfg = {.buffer = buffer};
+    lfs_file_t file = {
+        .id = coldest_id,
+        .type = LFS_TYPE_REG,
+        .m = coldest_dir,
+        .ctz = coldest_ctz,
+        .flags = LFS_O_RDWR,
+        .pos = 0,
+        .off = 0,
+        .cfg = &cfg,
+    };
+
+    if (buffer) {
+        file.cache.buffer = buffer;
+    } else {
+        file.cache.buffer = lfs_malloc(lfs->cfg->cache_size);
+        if (!file.cache.buffer) {
+            return LFS_ERR_NOMEM;
+        }
+    }
+    lfs_cache_zero(lfs, &file.cache);
+    lfs_mlist_append(lfs, (struct lfs_mlist *)&file);
+
+    LFS_DEBUG("Wear leveling {0x%"PRIx32", 0x%"PRIx32"} id %"PRIu16
+            " (%"PRIu32" erases, free max %"PRIu32")",
+            coldest_dir.pair[0], coldest_dir.pair[1], coldest_id,
+            coldest, freemax);
+
+    lfs->free.worn = true;
+    uint8_t byte;
+    lfs_ssize_t res = lfs_file_rawread(lfs, &file, &byte, 1);
+    if (res >= 0) {
+        res = lfs_file_rawseek(lfs, &file, 0, LFS_SEEK_SET);
+    }
+    if (res >= 0) {
+        res = lfs_file_rawwrite(lfs, &file, &byte, 1);
+    }
+
+    // closing syncs the rest of the file over
+    err = lfs_file_rawclose(lfs, &file);
+    lfs->free.worn = false;
+    if (res < 0) {
+        return res;
+    }
+    if (err) {
+        return err;
+    }
+
+    // a move that didn't bring the file onto more worn blocks won't do
+    // better next time, stop here so housekeeping loops end
+    struct lfs_fs_wearlevel_cold moved = {lfs, 0xffffffff};
+    err = lfs_ctz_traverse(lfs, NULL, &lfs->rcache,
+            file.ctz.head, file.ctz.size, lfs_fs_wearlevel_count, &moved);
     if (err) {
         return err;
     }
 
-    return size;
+    return (moved.min > coldest) ? 1 : 0;
 }
+#endif
 
 #ifdef LFS_MIGRATE
 ////// Migration from littelfs v1 below this //////
@@ -5589,11 +7815,30 @@ cleanup:
 #ifdef LFS_THREADSAFE
 #define LFS_LOCK(cfg)   cfg->lock(cfg)
 #define LFS_UNLOCK(cfg) cfg->unlock(cfg)
+#define LFS_LOCK_SHARED(cfg) \
+    ((cfg)->lock_shared ? (cfg)->lock_shared(cfg) : (cfg)->lock(cfg))
+#define LFS_UNLOCK_SHARED(cfg) \
+    ((cfg)->lock_shared ? (cfg)->unlock_shared(cfg) : (cfg)->unlock(cfg))
 #else
 #define LFS_LOCK(cfg)   ((void)cfg, 0)
 #define LFS_UNLOCK(cfg) ((void)cfg)
+#define LFS_LOCK_SHARED(cfg)   ((void)cfg, 0)
+#define LFS_UNLOCK_SHARED(cfg) ((void)cfg)
 #endif
 
+// reads of files opened read-only share the lock with other readers,
+// nothing but the owner ever changes such a file's state, unless the file
+// borrows its buffer from the pool
+static inline bool lfs_file_isshared(const lfs_file_t *file) {
+    return (file->flags & 3) == LFS_O_RDONLY
+            && !(file->flags & LFS_F_POOLED);
+}
+
+#define LFS_FILE_LOCK(cfg, file) \
+    (lfs_file_isshared(file) ? LFS_LOCK_SHARED(cfg) : LFS_LOCK(cfg))
+#define LFS_FILE_UNLOCK(cfg, file) \
+    (lfs_file_isshared(file) ? LFS_UNLOCK_SHARED(cfg) : LFS_UNLOCK(cfg))
+
 // Public API
 #ifndef LFS_READONLY
 int lfs_format(lfs_t *lfs, const struct lfs_config *cfg) {
@@ -5701,23 +7946,238 @@ int lfs_rename(lfs_t *lfs, const char *oldpath, const char *newpath) {
 }
 #endif
 
-int lfs_stat(lfs_t *lfs, const char *path, struct lfs_info *info) {
+#ifndef LFS_READONLY
+int lfs_txn_begin(lfs_t *lfs, lfs_txn_t *txn) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_begin(%p, %p)", (void*)lfs, (void*)txn);
+
+    txn->count = 0;
+
+    LFS_TRACE("lfs_txn_begin -> %d", 0);
+    LFS_UNLOCK(lfs->cfg);
+    return 0;
+}
+
+int lfs_txn_opencfg(lfs_t *lfs, lfs_txn_t *txn, lfs_file_t *file,
+        const char *path, int flags,
+        const struct lfs_file_config *cfg) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_opencfg(%p, %p, %p, \"%s\", %x, %p {"
+                 ".buffer=%p, .attrs=%p, .attr_count=%"PRIu32"})",
+            (void*)lfs, (void*)txn, (void*)file, path, flags,
+            (void*)cfg, cfg->buffer, (void*)cfg->attrs, cfg->attr_count);
+    LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    err = lfs_txn_rawopencfg(lfs, txn, file, path, flags, cfg);
+
+    LFS_TRACE("lfs_txn_opencfg -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_txn_remove(lfs_t *lfs, lfs_txn_t *txn, const char *path) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_remove(%p, %p, \"%s\")", (void*)lfs, (void*)txn, path);
+
+    err = lfs_txn_stage(txn, LFS_TXN_REMOVE, path, NULL);
+
+    LFS_TRACE("lfs_txn_remove -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_txn_rename(lfs_t *lfs, lfs_txn_t *txn,
+        const char *oldpath, const char *newpath) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_rename(%p, %p, \"%s\", \"%s\")",
+            (void*)lfs, (void*)txn, oldpath, newpath);
+
+    err = lfs_txn_stage(txn, LFS_TXN_RENAME, oldpath, newpath);
+
+    LFS_TRACE("lfs_txn_rename -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_txn_commit(lfs_t *lfs, lfs_txn_t *txn) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_commit(%p, %p)", (void*)lfs, (void*)txn);
+
+    err = lfs_txn_rawcommit(lfs, txn);
+
+    LFS_TRACE("lfs_txn_commit -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_txn_abort(lfs_t *lfs, lfs_txn_t *txn) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_abort(%p, %p)", (void*)lfs, (void*)txn);
+
+    err = lfs_txn_rawabort(lfs, txn);
+
+    LFS_TRACE("lfs_txn_abort -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+int lfs_kv_open(lfs_t *lfs, lfs_kv_t *kv, const char *path) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_kv_open(%p, %p, \"%s\")", (void*)lfs, (void*)kv, path);
+    LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)&kv->dir));
+
+    err = lfs_kv_rawopen(lfs, kv, path);
+
+    LFS_TRACE("lfs_kv_open -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_kv_close(lfs_t *lfs, lfs_kv_t *kv) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_kv_close(%p, %p)", (void*)lfs, (void*)kv);
+
+    err = lfs_kv_rawclose(lfs, kv);
+
+    LFS_TRACE("lfs_kv_close -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+lfs_ssize_t lfs_kv_get(lfs_t *lfs, lfs_kv_t *kv, const char *key,
+        void *buffer, lfs_size_t size) {
+    int err = LFS_LOCK_SHARED(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_kv_get(%p, %p, \"%s\", %p, %"PRIu32")",
+            (void*)lfs, (void*)kv, key, buffer, size);
+
+    lfs_ssize_t res = lfs_kv_rawget(lfs, kv, key, buffer, size);
+
+    LFS_TRACE("lfs_kv_get -> %"PRId32, res);
+    LFS_UNLOCK_SHARED(lfs->cfg);
+    return res;
+}
+
+#ifndef LFS_READONLY
+int lfs_kv_put(lfs_t *lfs, lfs_kv_t *kv, const char *key,
+        const void *value, lfs_size_t size) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_kv_put(%p, %p, \"%s\", %p, %"PRIu32")",
+            (void*)lfs, (void*)kv, key, value, size);
+
+    err = lfs_kv_stage(lfs, kv, LFS_KV_PUT, key, value, size);
+
+    LFS_TRACE("lfs_kv_put -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_kv_delete(lfs_t *lfs, lfs_kv_t *kv, const char *key) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_kv_delete(%p, %p, \"%s\")", (void*)lfs, (void*)kv, key);
+
+    err = lfs_kv_stage(lfs, kv, LFS_KV_DELETE, key, NULL, 0);
+
+    LFS_TRACE("lfs_kv_delete -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_kv_commit(lfs_t *lfs, lfs_kv_t *kv) {
     int err = LFS_LOCK(lfs->cfg);
     if (err) {
         return err;
     }
+    LFS_TRACE("lfs_kv_commit(%p, %p)", (void*)lfs, (void*)kv);
+
+    err = lfs_kv_rawcommit(lfs, kv);
+
+    LFS_TRACE("lfs_kv_commit -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+int lfs_kv_read(lfs_t *lfs, lfs_kv_t *kv, struct lfs_info *info) {
+    int err = LFS_LOCK_SHARED(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_kv_read(%p, %p, %p)",
+            (void*)lfs, (void*)kv, (void*)info);
+
+    err = lfs_kv_rawread(lfs, kv, info);
+
+    LFS_TRACE("lfs_kv_read -> %d", err);
+    LFS_UNLOCK_SHARED(lfs->cfg);
+    return err;
+}
+
+int lfs_kv_rewind(lfs_t *lfs, lfs_kv_t *kv) {
+    int err = LFS_LOCK_SHARED(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_kv_rewind(%p, %p)", (void*)lfs, (void*)kv);
+
+    // the next lfs_kv_read fetches the first pair again
+    kv->reading = false;
+
+    LFS_TRACE("lfs_kv_rewind -> %d", err);
+    LFS_UNLOCK_SHARED(lfs->cfg);
+    return err;
+}
+
+int lfs_stat(lfs_t *lfs, const char *path, struct lfs_info *info) {
+    int err = LFS_LOCK_SHARED(lfs->cfg);
+    if (err) {
+        return err;
+    }
     LFS_TRACE("lfs_stat(%p, \"%s\", %p)", (void*)lfs, path, (void*)info);
 
     err = lfs_rawstat(lfs, path, info);
 
     LFS_TRACE("lfs_stat -> %d", err);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs->cfg);
     return err;
 }
 
 lfs_ssize_t lfs_getattr(lfs_t *lfs, const char *path,
         uint8_t type, void *buffer, lfs_size_t size) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_LOCK_SHARED(lfs->cfg);
     if (err) {
         return err;
     }
@@ -5727,7 +8187,7 @@ lfs_ssize_t lfs_getattr(lfs_t *lfs, const char *path,
     lfs_ssize_t res = lfs_rawgetattr(lfs, path, type, buffer, size);
 
     LFS_TRACE("lfs_getattr -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs->cfg);
     return res;
 }
 
@@ -5810,6 +8270,10 @@ int lfs_file_close(lfs_t *lfs, lfs_file_t *file) {
     }
     LFS_TRACE("lfs_file_close(%p, %p)", (void*)lfs, (void*)file);
     LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+#ifndef LFS_READONLY
+    // files in a transaction are closed when it ends
+    LFS_ASSERT(!(file->flags & LFS_F_TXN));
+#endif
 
     err = lfs_file_rawclose(lfs, file);
 
@@ -5833,11 +8297,44 @@ int lfs_file_sync(lfs_t *lfs, lfs_file_t *file) {
     LFS_UNLOCK(lfs->cfg);
     return err;
 }
+
+int lfs_file_syncv(lfs_t *lfs, lfs_file_t *const *files, int count) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_syncv(%p, %p, %d)",
+            (void*)lfs, (void*)files, count);
+    for (int i = 0; i < count; i++) {
+        LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)files[i]));
+    }
+
+    err = lfs_file_rawsyncv(lfs, files, count);
+
+    LFS_TRACE("lfs_file_syncv -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_file_sync_nb(lfs_t *lfs, lfs_file_t *file) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_sync_nb(%p, %p)", (void*)lfs, (void*)file);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    err = lfs_file_rawsync_nb(lfs, file);
+
+    LFS_TRACE("lfs_file_sync_nb -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
 #endif
 
 lfs_ssize_t lfs_file_read(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_FILE_LOCK(lfs->cfg, file);
     if (err) {
         return err;
     }
@@ -5848,7 +8345,7 @@ lfs_ssize_t lfs_file_read(lfs_t *lfs, lfs_file_t *file,
     lfs_ssize_t res = lfs_file_rawread(lfs, file, buffer, size);
 
     LFS_TRACE("lfs_file_read -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_FILE_UNLOCK(lfs->cfg, file);
     return res;
 }
 
@@ -5871,9 +8368,62 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
 }
 #endif
 
+lfs_ssize_t lfs_file_readv(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, int iovcnt) {
+    int err = LFS_FILE_LOCK(lfs->cfg, file);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_readv(%p, %p, %p, %d)",
+            (void*)lfs, (void*)file, (void*)iov, iovcnt);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_rawreadv(lfs, file, iov, iovcnt);
+
+    LFS_TRACE("lfs_file_readv -> %"PRId32, res);
+    LFS_FILE_UNLOCK(lfs->cfg, file);
+    return res;
+}
+
+#ifndef LFS_READONLY
+lfs_ssize_t lfs_file_writev(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, int iovcnt) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_writev(%p, %p, %p, %d)",
+            (void*)lfs, (void*)file, (void*)iov, iovcnt);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_rawwritev(lfs, file, iov, iovcnt);
+
+    LFS_TRACE("lfs_file_writev -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
+lfs_ssize_t lfs_file_write_nb(lfs_t *lfs, lfs_file_t *file,
+        const void *buffer, lfs_size_t size) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_write_nb(%p, %p, %p, %"PRIu32")",
+            (void*)lfs, (void*)file, buffer, size);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_rawwrite_nb(lfs, file, buffer, size);
+
+    LFS_TRACE("lfs_file_write_nb -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+#endif
+
 lfs_soff_t lfs_file_seek(lfs_t *lfs, lfs_file_t *file,
         lfs_soff_t off, int whence) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_FILE_LOCK(lfs->cfg, file);
     if (err) {
         return err;
     }
@@ -5884,7 +8434,7 @@ lfs_soff_t lfs_file_seek(lfs_t *lfs, lfs_file_t *file,
     lfs_soff_t res = lfs_file_rawseek(lfs, file, off, whence);
 
     LFS_TRACE("lfs_file_seek -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_FILE_UNLOCK(lfs->cfg, file);
     return res;
 }
 
@@ -5907,7 +8457,7 @@ int lfs_file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
 #endif
 
 lfs_soff_t lfs_file_tell(lfs_t *lfs, lfs_file_t *file) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_FILE_LOCK(lfs->cfg, file);
     if (err) {
         return err;
     }
@@ -5917,7 +8467,7 @@ lfs_soff_t lfs_file_tell(lfs_t *lfs, lfs_file_t *file) {
     lfs_soff_t res = lfs_file_rawtell(lfs, file);
 
     LFS_TRACE("lfs_file_tell -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_FILE_UNLOCK(lfs->cfg, file);
     return res;
 }
 
@@ -5936,7 +8486,7 @@ int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file) {
 }
 
 lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_FILE_LOCK(lfs->cfg, file);
     if (err) {
         return err;
     }
@@ -5946,7 +8496,7 @@ lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file) {
     lfs_soff_t res = lfs_file_rawsize(lfs, file);
 
     LFS_TRACE("lfs_file_size -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_FILE_UNLOCK(lfs->cfg, file);
     return res;
 }
 
@@ -5996,7 +8546,7 @@ int lfs_dir_close(lfs_t *lfs, lfs_dir_t *dir) {
 }
 
 int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_LOCK_SHARED(lfs->cfg);
     if (err) {
         return err;
     }
@@ -6006,12 +8556,28 @@ int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
     err = lfs_dir_rawread(lfs, dir, info);
 
     LFS_TRACE("lfs_dir_read -> %d", err);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs->cfg);
+    return err;
+}
+
+int lfs_dir_readplus(lfs_t *lfs, lfs_dir_t *dir,
+        int (*cb)(void *data, const struct lfs_info *info), void *data) {
+    int err = LFS_LOCK_SHARED(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_dir_readplus(%p, %p, %p, %p)",
+            (void*)lfs, (void*)dir, (void*)(uintptr_t)cb, data);
+
+    err = lfs_dir_rawreadplus(lfs, dir, cb, data);
+
+    LFS_TRACE("lfs_dir_readplus -> %d", err);
+    LFS_UNLOCK_SHARED(lfs->cfg);
     return err;
 }
 
 int lfs_dir_seek(lfs_t *lfs, lfs_dir_t *dir, lfs_off_t off) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_LOCK_SHARED(lfs->cfg);
     if (err) {
         return err;
     }
@@ -6021,12 +8587,12 @@ int lfs_dir_seek(lfs_t *lfs, lfs_dir_t *dir, lfs_off_t off) {
     err = lfs_dir_rawseek(lfs, dir, off);
 
     LFS_TRACE("lfs_dir_seek -> %d", err);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs->cfg);
     return err;
 }
 
 lfs_soff_t lfs_dir_tell(lfs_t *lfs, lfs_dir_t *dir) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_LOCK_SHARED(lfs->cfg);
     if (err) {
         return err;
     }
@@ -6035,12 +8601,12 @@ lfs_soff_t lfs_dir_tell(lfs_t *lfs, lfs_dir_t *dir) {
     lfs_soff_t res = lfs_dir_rawtell(lfs, dir);
 
     LFS_TRACE("lfs_dir_tell -> %"PRId32, res);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs->cfg);
     return res;
 }
 
 int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir) {
-    int err = LFS_LOCK(lfs->cfg);
+    int err = LFS_LOCK_SHARED(lfs->cfg);
     if (err) {
         return err;
     }
@@ -6049,7 +8615,7 @@ int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir) {
     err = lfs_dir_rawrewind(lfs, dir);
 
     LFS_TRACE("lfs_dir_rewind -> %d", err);
-    LFS_UNLOCK(lfs->cfg);
+    LFS_UNLOCK_SHARED(lfs->cfg);
     return err;
 }
 
@@ -6060,7 +8626,7 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs) {
     }
     LFS_TRACE("lfs_fs_size(%p)", (void*)lfs);
 
-    lfs_ssize_t res = lfs_fs_rawsize(lfs);
+    lfs_ssize_t res = lfs_fs_rawsize(lfs, true);
 
     LFS_TRACE("lfs_fs_size -> %"PRId32, res);
     LFS_UNLOCK(lfs->cfg);
@@ -6082,6 +8648,37 @@ int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data) {
     return err;
 }
 
+int lfs_fs_wear(lfs_t *lfs, struct lfs_wear *wear) {
+    int err = LFS_LOCK_SHARED(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_wear(%p, %p)", (void*)lfs, (void*)wear);
+
+    err = lfs_fs_rawwear(lfs, wear);
+
+    LFS_TRACE("lfs_fs_wear -> %d", err);
+    LFS_UNLOCK_SHARED(lfs->cfg);
+    return err;
+}
+
+#ifndef LFS_READONLY
+int lfs_fs_wearlevel(lfs_t *lfs, lfs_size_t threshold, void *buffer) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_wearlevel(%p, %"PRIu32", %p)",
+            (void*)lfs, threshold, buffer);
+
+    err = lfs_fs_rawwearlevel(lfs, threshold, buffer);
+
+    LFS_TRACE("lfs_fs_wearlevel -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
 #ifndef LFS_READONLY
 int lfs_fs_mkconsistent(lfs_t *lfs) {
     int err = LFS_LOCK(lfs->cfg);
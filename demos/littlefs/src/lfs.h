@@ -66,6 +66,27 @@ typedef uint32_t lfs_block_t;
 #define LFS_ATTR_MAX 1022
 #endif
 
+// Maximum number of files lfs_file_syncv commits together, may be redefined
+// to trade stack, about 26 bytes a file on AVR, for fewer commits.
+#ifndef LFS_SYNCV_MAX
+#define LFS_SYNCV_MAX 8
+#endif
+
+// Maximum number of operations in a transaction, may be redefined to trade
+// the size of lfs_txn_t and about 50 bytes of stack an operation in
+// lfs_txn_commit for larger transactions.
+#ifndef LFS_TXN_MAX
+#define LFS_TXN_MAX 4
+#endif
+
+// Maximum number of puts and deletes staged in a key-value store, may be
+// redefined to trade the size of lfs_kv_t, about 9 bytes an operation on
+// AVR, and about 30 bytes of stack an operation in lfs_kv_commit for
+// larger batches.
+#ifndef LFS_KV_BATCH_MAX
+#define LFS_KV_BATCH_MAX 8
+#endif
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs_error {
@@ -84,6 +105,8 @@ enum lfs_error {
     LFS_ERR_NOMEM       = -12,  // No more memory available
     LFS_ERR_NOATTR      = -61,  // No data/attr available
     LFS_ERR_NAMETOOLONG = -36,  // File name too long
+    LFS_ERR_NOTSUP      = -95,  // Operation not supported
+    LFS_ERR_INPROGRESS  = -115, // Block device busy, try again later
 };
 
 // File types
@@ -144,6 +167,17 @@ enum lfs_open_flags {
     LFS_F_ERRED   = 0x080000, // An error occurred during write
 #endif
     LFS_F_INLINE  = 0x100000, // Currently inlined in directory entry
+    LFS_F_POOLED  = 0x200000, // Buffer is borrowed from file_pool_buffer
+#ifndef LFS_READONLY
+    LFS_F_TXN     = 0x400000, // Committed by lfs_txn_commit
+#endif
+};
+
+// Checks of data programmed into file blocks, see lfs_config.verify
+enum lfs_verify {
+    LFS_VERIFY_ALL     = 0, // Check every program of file data
+    LFS_VERIFY_SAMPLED = 1, // Check one in verify_interval programs
+    LFS_VERIFY_NONE    = 2, // Trust the block device's prog
 };
 
 // File seek flags
@@ -263,6 +297,120 @@ struct lfs_config {
     // can help bound the metadata compaction time. Must be <= block_size.
     // Defaults to block_size when zero.
     lfs_size_t metadata_max;
+
+    // Optional callback reporting how many times a block has been erased,
+    // for block devices that keep erase counters. Used by lfs_fs_wear, may
+    // be NULL. Negative error codes are propagated to the user.
+    int (*erase_count)(const struct lfs_config *c, lfs_block_t block,
+            lfs_size_t *count);
+
+    // Optional callback reporting blocks the block device has retired,
+    // cb should be called once for every bad block. The allocator never
+    // hands these out, and a prog or erase returning LFS_ERR_CORRUPT makes
+    // littlefs relocate away from a block that just went bad. May be NULL.
+    int (*bad_blocks)(const struct lfs_config *c,
+            int (*cb)(void *data, lfs_block_t block), void *data);
+
+    // Optional upper limit on files kept inline in their metadata pair, in
+    // bytes. Small inline files share metadata blocks instead of taking a
+    // whole block each, at the cost of more frequent metadata compaction.
+    // Must be <= 0x3fe and <= metadata_max/8. Unlike the default, this may
+    // exceed cache_size, in which case file buffers must be inline_max
+    // bytes. Defaults to min(cache_size, metadata_max/8, 0x3fe) when zero,
+    // set to -1 to disable inline files.
+    lfs_size_t inline_max;
+
+#ifdef LFS_THREADSAFE
+    // Optional shared lock, allowing read-only operations to run
+    // concurrently with each other while writers still take lock. These
+    // are lfs_stat, lfs_getattr, lfs_dir_read/readplus/seek/tell/rewind,
+    // lfs_kv_get/read/rewind, lfs_fs_wear, and lfs_file_read/seek/tell/size
+    // on files opened LFS_O_RDONLY with their own buffer. Concurrent
+    // operations must be on different file, dir and key-value store
+    // handles, and read may then be called from several threads at once.
+    // If NULL, lock is used for everything.
+    int (*lock_shared)(const struct lfs_config *c);
+    int (*unlock_shared)(const struct lfs_config *c);
+
+    // Mutual exclusion for the shared read cache, required when
+    // lock_shared is provided. Held briefly around every read through
+    // the filesystem-wide cache.
+    int (*lock_cache)(const struct lfs_config *c);
+    int (*unlock_cache)(const struct lfs_config *c);
+#endif
+
+    // Optional check for an erase still in flight on the block device.
+    // Returns a positive value while busy, zero once idle, or a negative
+    // error code. When provided, erase may return as soon as the erase is
+    // started, as long as the block device waits for it to finish before
+    // starting any other operation and before sync returns. This lets
+    // lfs_file_write_nb and lfs_file_sync_nb hand control back to the
+    // caller instead of waiting. May be NULL.
+    int (*busy)(const struct lfs_config *c);
+
+    // Optional callback giving a single-threaded event loop a turn during
+    // long operations such as mount, traverse, sync and metadata commits.
+    // Called before every yield_ops-th read, prog, erase or sync, and
+    // repeatedly instead of waiting while busy reports an erase in
+    // flight, so the time between calls is bounded by yield_ops flash
+    // operations. It must not call back into littlefs, and can't be used
+    // with lock_shared. May be NULL.
+    void (*yield)(const struct lfs_config *c);
+
+    // Number of block device operations between calls to yield, zero
+    // calls it before every operation.
+    lfs_size_t yield_ops;
+
+    // Optional pool of file buffers, shared by open files that don't bring
+    // their own lfs_file_config.buffer. The pool is cut into lines the
+    // size of a file buffer, the larger of cache_size and inline_max, and
+    // a file only takes a line when it is read, written, truncated or
+    // synced. When every line is taken, the least recently used file gives
+    // its line up, preferring files with nothing to sync, and is synced
+    // first if it has unsynced writes. This keeps any number of files open
+    // in file_pool_size bytes, but files whose writes must only land
+    // together at an explicit sync need their own buffer. If NULL, each
+    // file's buffer is allocated with lfs_malloc.
+    void *file_pool_buffer;
+
+    // Size of the file buffer pool in bytes, at least one file buffer.
+    lfs_size_t file_pool_size;
+
+    // Optional statically allocated compaction buffer. Must be compact_size
+    // and aligned to a 16-bit boundary. By default lfs_malloc is used to
+    // allocate this buffer.
+    void *compact_buffer;
+
+    // Size of the compaction buffer in bytes. Before compacting a metadata
+    // pair, littlefs records the newest tag of every type and id in this
+    // buffer with one pass over the log, taking 6 bytes for each tag the
+    // compaction keeps. Without it every tag is checked by rereading the
+    // rest of the log, which is quadratic in the size of the log. Logs
+    // with more tags than fit are still compacted that way. Zero disables
+    // the buffer.
+    lfs_size_t compact_size;
+
+    // Which programs of file data are checked before littlefs relies on
+    // them, one of enum lfs_verify. A check that fails is handled like a
+    // prog returning LFS_ERR_CORRUPT, the data is written to a new block.
+    // Metadata is always checked by its commit CRC. Relaxing this makes
+    // sequential writes faster, but data the block device got wrong is
+    // only noticed by the application. Block devices that check their own
+    // programs, returning LFS_ERR_CORRUPT on a mismatch, lose nothing with
+    // LFS_VERIFY_NONE. Defaults to LFS_VERIFY_ALL.
+    int verify;
+
+    // With LFS_VERIFY_SAMPLED, every verify_interval-th program of file
+    // data is checked. Must be nonzero.
+    lfs_size_t verify_interval;
+
+    // Optional CRC-32 of size bytes on disk, as computed by lfs_crc
+    // starting from 0xffffffff. When provided, checks compare this with
+    // the CRC of the data programmed instead of reading the data back
+    // into the read cache, so the block device can compute it however is
+    // cheapest. Returns a negative error code on failure. May be NULL.
+    int (*crc)(const struct lfs_config *c, lfs_block_t block,
+            lfs_off_t off, lfs_size_t size, uint32_t *crc);
 };
 
 // File info structure
@@ -294,10 +442,21 @@ struct lfs_attr {
     lfs_size_t size;
 };
 
+// One piece of a scatter/gather list for lfs_file_readv/lfs_file_writev
+struct lfs_iovec {
+    // Data to read into or write from, lfs_file_writev never writes to it
+    void *buffer;
+
+    // Size of the piece in bytes
+    lfs_size_t size;
+};
+
 // Optional configuration provided during lfs_file_opencfg
 struct lfs_file_config {
-    // Optional statically allocated file buffer. Must be cache_size.
-    // By default lfs_malloc is used to allocate this buffer.
+    // Optional statically allocated file buffer. Must be the larger of
+    // cache_size and inline_max. A file with its own buffer never waits on
+    // file_pool_buffer. By default the file borrows from the pool if there
+    // is one, otherwise lfs_malloc is used to allocate this buffer.
     void *buffer;
 
     // Optional list of custom attributes related to the file. If the file
@@ -315,6 +474,47 @@ struct lfs_file_config {
 
     // Number of custom attributes in the list
     lfs_size_t attr_count;
+
+    // Optional buffer for read-ahead, must be 32-bit aligned. When the file
+    // is read sequentially across a block boundary, the addresses of the
+    // next readahead_size/4 blocks are resolved in one walk of the file's
+    // block list and kept here, instead of walking the list from the end
+    // of the file again at every block. Like the file buffer, this must not
+    // be shared by files that are open at the same time. This mostly saves
+    // flash reads, on the SRXE's 30 blocks the walks are short and a
+    // sequential read only gets about 1% faster, so the demo leaves it off.
+    void *readahead_buffer;
+
+    // Size of the read-ahead buffer in bytes, a multiple of 4. Zero disables
+    // read-ahead.
+    lfs_size_t readahead_size;
+};
+
+// Number of directory entries lfs_dir_readplus looks up per pass over a
+// metadata log, each takes about 20 bytes of stack
+#ifndef LFS_READPLUS_IDS
+#define LFS_READPLUS_IDS 8
+#endif
+
+// Number of most-erased blocks reported by lfs_fs_wear
+#ifndef LFS_WEAR_HOT
+#define LFS_WEAR_HOT 4
+#endif
+
+// Erase count statistics, filled out by lfs_fs_wear
+struct lfs_wear {
+    // Fewest, most, and mean (rounded down) erases of any block
+    lfs_size_t min;
+    lfs_size_t max;
+    lfs_size_t mean;
+
+    // Total erases over all blocks
+    lfs_size_t total;
+
+    // The most erased blocks and their erase counts, most erased first.
+    // Unused entries, if there are fewer blocks, are set to 0xffffffff.
+    lfs_block_t hot[LFS_WEAR_HOT];
+    lfs_size_t hot_count[LFS_WEAR_HOT];
 };
 
 
@@ -365,10 +565,41 @@ typedef struct lfs_file {
     lfs_block_t block;
     lfs_off_t off;
     lfs_cache_t cache;
+    uint32_t stamp;
+
+    struct lfs_readahead {
+        lfs_block_t head;
+        lfs_off_t index;
+        lfs_size_t count;
+    } ra;
 
     const struct lfs_file_config *cfg;
 } lfs_file_t;
 
+// littlefs transaction type
+typedef struct lfs_txn {
+    int count;
+    struct lfs_txn_op {
+        uint8_t type;
+        const char *path;
+        const char *newpath;
+        lfs_file_t *file;
+    } ops[LFS_TXN_MAX];
+} lfs_txn_t;
+
+// littlefs key-value store type
+typedef struct lfs_kv {
+    lfs_dir_t dir;
+    bool reading;
+    int count;
+    struct lfs_kv_op {
+        uint8_t type;
+        const char *key;
+        const void *value;
+        lfs_size_t size;
+    } ops[LFS_KV_BATCH_MAX];
+} lfs_kv_t;
+
 typedef struct lfs_superblock {
     uint32_t version;
     lfs_size_t block_size;
@@ -407,12 +638,32 @@ typedef struct lfs {
         lfs_block_t i;
         lfs_block_t ack;
         uint32_t *buffer;
+        bool worn;
+        lfs_block_t erased;
     } free;
 
     const struct lfs_config *cfg;
     lfs_size_t name_max;
     lfs_size_t file_max;
     lfs_size_t attr_max;
+    lfs_size_t inline_max;
+    lfs_size_t yield_count;
+    lfs_size_t verify_count;
+    uint32_t pool_stamp;
+    lfs_size_t used;
+
+    struct lfs_summary {
+        const lfs_mdir_t *source;
+        const void *attrs;
+        int attrcount;
+        lfs_size_t count;
+        uint16_t last;
+        struct lfs_summary_tag {
+            uint16_t type;
+            uint16_t id;
+            uint16_t pos;
+        } *tags;
+    } summary;
 
 #ifdef LFS_MIGRATE
     struct lfs1 *lfs1;
@@ -556,6 +807,20 @@ int lfs_file_close(lfs_t *lfs, lfs_file_t *file);
 // Returns a negative error code on failure.
 int lfs_file_sync(lfs_t *lfs, lfs_file_t *file);
 
+#ifndef LFS_READONLY
+// Synchronize several files on storage at once
+//
+// Works like calling lfs_file_sync on each of the count files, except
+// that the files in the same directory are committed together, up to
+// LFS_SYNCV_MAX at a time, with one commit and one CRC instead of one
+// each. The files of a commit are updated together or not at all if
+// power is lost. Inline files using file_pool_buffer are committed on
+// their own.
+//
+// Returns a negative error code on failure.
+int lfs_file_syncv(lfs_t *lfs, lfs_file_t *const *files, int count);
+#endif
+
 // Read data from file
 //
 // Takes a buffer and size indicating where to store the read data.
@@ -574,6 +839,51 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
         const void *buffer, lfs_size_t size);
 #endif
 
+// Read data from file into a list of buffers
+//
+// Fills each of the iovcnt buffers in turn, as if by one lfs_file_read of
+// their total size. Stops early at the end of the file.
+//
+// Returns the number of bytes read, or a negative error code on failure.
+lfs_ssize_t lfs_file_readv(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, int iovcnt);
+
+#ifndef LFS_READONLY
+// Write data to file from a list of buffers
+//
+// Writes each of the iovcnt buffers in turn, as if by one lfs_file_write
+// of their total size, so a record made of several parts only takes the
+// lock and does the file limit and inline checks once, and its parts are
+// packed into the file's cache together.
+//
+// Returns the number of bytes written, or a negative error code on failure.
+lfs_ssize_t lfs_file_writev(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, int iovcnt);
+
+// Write data to file without waiting on the block device
+//
+// Works like lfs_file_write, except that it returns LFS_ERR_INPROGRESS
+// without writing anything if the block device is busy and the write
+// can't be taken by the file's cache alone. A write that needs a new
+// block first starts erasing one and returns LFS_ERR_INPROGRESS, the
+// block is used once the write is retried after the erase finished. Call
+// again with the same data until something else is returned, doing other
+// work in between. Without a busy callback this is lfs_file_write.
+//
+// Returns the number of bytes written, or a negative error code on failure.
+lfs_ssize_t lfs_file_write_nb(lfs_t *lfs, lfs_file_t *file,
+        const void *buffer, lfs_size_t size);
+
+// Synchronize a file on storage without waiting on the block device
+//
+// Returns LFS_ERR_INPROGRESS if the block device is busy, otherwise syncs
+// the file like lfs_file_sync. The sync itself may still wait on erases
+// needed to compact metadata.
+//
+// Returns a negative error code on failure.
+int lfs_file_sync_nb(lfs_t *lfs, lfs_file_t *file);
+#endif
+
 // Change the position of the file
 //
 // The change in position is determined by the offset and whence flag.
@@ -635,6 +945,21 @@ int lfs_dir_close(lfs_t *lfs, lfs_dir_t *dir);
 // or a negative error code on failure.
 int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info);
 
+// Read the remaining entries in the directory in bulk
+//
+// Calls cb with the info of every entry from the current position on, as
+// lfs_dir_read would return them, including "." and "..". Entries are
+// found a batch of LFS_READPLUS_IDS at a time with a single pass over the
+// metadata log, where lfs_dir_read makes two passes per entry, so this
+// is much cheaper for large directories. cb must not call back into
+// littlefs. A nonzero return from cb stops the listing after that entry
+// and is returned.
+//
+// Returns 0 at the end of the directory, the nonzero value from cb, or a
+// negative error code on failure.
+int lfs_dir_readplus(lfs_t *lfs, lfs_dir_t *dir,
+        int (*cb)(void *data, const struct lfs_info *info), void *data);
+
 // Change the position of the directory
 //
 // The new off must be a value previous returned from tell and specifies
@@ -657,6 +982,162 @@ lfs_soff_t lfs_dir_tell(lfs_t *lfs, lfs_dir_t *dir);
 int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir);
 
 
+/// Transaction operations ///
+
+#ifndef LFS_READONLY
+// Begin a transaction
+//
+// A transaction stages changes to several files of one directory, file
+// writes, creates, removes and renames, and lfs_txn_commit makes all of
+// them in a single metadata commit. If power is lost, either all of the
+// changes are on disk or none of them are, so related files can be
+// replaced together without writing temporary files and renaming them
+// one at a time. A transaction holds up to LFS_TXN_MAX operations.
+//
+// Returns a negative error code on failure.
+int lfs_txn_begin(lfs_t *lfs, lfs_txn_t *txn);
+
+// Open a file as part of a transaction
+//
+// Works like lfs_file_opencfg, except that a file that doesn't exist is
+// only created, and what is written to the file only replaces what is on
+// disk, when the transaction commits. lfs_file_sync writes out the file's
+// data without committing it. The file is closed by lfs_txn_commit or
+// lfs_txn_abort, not lfs_file_close. With file_pool_buffer, the file must
+// have its own buffer in the config struct.
+//
+// The path must remain allocated until the transaction ends. If this
+// fails, the transaction is left as it was.
+//
+// Returns a negative error code on failure.
+int lfs_txn_opencfg(lfs_t *lfs, lfs_txn_t *txn, lfs_file_t *file,
+        const char *path, int flags,
+        const struct lfs_file_config *config);
+
+// Remove a file as part of a transaction
+//
+// The path must remain allocated until the transaction ends, it is only
+// looked up when the transaction commits.
+//
+// Returns a negative error code on failure.
+int lfs_txn_remove(lfs_t *lfs, lfs_txn_t *txn, const char *path);
+
+// Rename a file as part of a transaction
+//
+// Works like lfs_rename for files, replacing any file at newpath. The
+// paths must remain allocated until the transaction ends, they are only
+// looked up when the transaction commits.
+//
+// Returns a negative error code on failure.
+int lfs_txn_rename(lfs_t *lfs, lfs_txn_t *txn,
+        const char *oldpath, const char *newpath);
+
+// Commit a transaction
+//
+// Writes out the data of the transaction's files and makes every staged
+// change in one metadata commit. All of the entries must be in the same
+// metadata pair, usually the same directory, and no entry may be used by
+// more than one operation, otherwise LFS_ERR_INVAL is returned. A file
+// whose write failed can't be committed and LFS_ERR_IO is returned.
+//
+// Whether this succeeds or not, the transaction's files are closed and
+// the transaction ends, on failure nothing on disk is changed.
+//
+// Returns a negative error code on failure.
+int lfs_txn_commit(lfs_t *lfs, lfs_txn_t *txn);
+
+// Abort a transaction
+//
+// Closes the transaction's files, throwing away what was written to them,
+// and ends the transaction without changing anything on disk.
+//
+// Returns a negative error code on failure.
+int lfs_txn_abort(lfs_t *lfs, lfs_txn_t *txn);
+#endif
+
+
+/// Key-value operations ///
+
+// Open a key-value store
+//
+// A key-value store keeps small values in a directory, each as an inline
+// file named after its key, so they can also be read with the file API.
+// Keys are looked up in the directory's metadata pair directly, a get
+// costs one fetch of the pair, usually from the read cache, instead of
+// opening, reading and closing a file. Puts and deletes are staged and
+// lfs_kv_commit makes them in one metadata commit. The directory is
+// created if it doesn't exist.
+//
+// Returns a negative error code on failure.
+int lfs_kv_open(lfs_t *lfs, lfs_kv_t *kv, const char *path);
+
+// Close a key-value store
+//
+// Any staged puts and deletes are committed first.
+//
+// Returns a negative error code on failure.
+int lfs_kv_close(lfs_t *lfs, lfs_kv_t *kv);
+
+// Get the value of a key
+//
+// Staged puts and deletes are seen before they are committed. If the value
+// is larger than the buffer, only size bytes are read.
+//
+// Returns the size of the value, LFS_ERR_NOENT if there is no such key, or
+// a negative error code on failure.
+lfs_ssize_t lfs_kv_get(lfs_t *lfs, lfs_kv_t *kv, const char *key,
+        void *buffer, lfs_size_t size);
+
+#ifndef LFS_READONLY
+// Stage setting the value of a key
+//
+// Values are limited to inline_max, keys to name_max and can't contain
+// '/'. Staging a key again replaces what was staged for it. The key and
+// value must remain allocated until the batch is committed. Returns
+// LFS_ERR_NOMEM if LFS_KV_BATCH_MAX operations are already staged.
+//
+// Returns a negative error code on failure.
+int lfs_kv_put(lfs_t *lfs, lfs_kv_t *kv, const char *key,
+        const void *value, lfs_size_t size);
+
+// Stage deleting a key
+//
+// Deleting a key that doesn't exist does nothing. The key must remain
+// allocated until the batch is committed.
+//
+// Returns a negative error code on failure.
+int lfs_kv_delete(lfs_t *lfs, lfs_kv_t *kv, const char *key);
+
+// Commit the staged puts and deletes
+//
+// Every batch is a single metadata commit, so all or none of it is on
+// disk after a power loss. All of the keys a batch changes must be in the
+// same metadata pair, otherwise LFS_ERR_INVAL is returned and nothing on
+// disk is changed. This only happens once the store has outgrown its
+// first pair, smaller batches can then be committed on their own.
+// Committing during an iteration may make it skip keys or start over.
+//
+// The batch is emptied whether this succeeds or not.
+//
+// Returns a negative error code on failure.
+int lfs_kv_commit(lfs_t *lfs, lfs_kv_t *kv);
+#endif
+
+// Read the next key of a key-value store
+//
+// Fills out the info structure with the key as name and the size of its
+// value, staged puts and deletes aren't seen until they are committed.
+//
+// Returns a positive value on success, 0 at the end of the store, or a
+// negative error code on failure.
+int lfs_kv_read(lfs_t *lfs, lfs_kv_t *kv, struct lfs_info *info);
+
+// Start reading keys from the beginning again
+//
+// Returns a negative error code on failure.
+int lfs_kv_rewind(lfs_t *lfs, lfs_kv_t *kv);
+
+
 /// Filesystem-level filesystem operations
 
 // Finds the current size of the filesystem
@@ -664,6 +1145,10 @@ int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir);
 // Note: Result is best effort. If files share COW structures, the returned
 // size may be larger than the filesystem actually is.
 //
+// The first call after mounting traverses the filesystem, after that the
+// count is kept up to date by every write and later calls only look at
+// the open files.
+//
 // Returns the number of allocated blocks, or a negative error code on failure.
 lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 
@@ -676,6 +1161,36 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 // Returns a negative error code on failure.
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data);
 
+// Gather erase count statistics over every block on the device
+//
+// Requires the erase_count callback in the config, otherwise
+// LFS_ERR_NOTSUP is returned. This asks the block device about every
+// block, so it may be slow if the counters are not kept in RAM.
+//
+// Returns a negative error code on failure.
+int lfs_fs_wear(lfs_t *lfs, struct lfs_wear *wear);
+
+#ifndef LFS_READONLY
+// Run one step of static wear leveling
+//
+// littlefs only levels wear dynamically, so blocks holding files that are
+// never rewritten are never erased again. This finds the file sitting on
+// the least worn blocks and, if the most worn free block has been erased
+// at least threshold more times, rewrites the file onto the most worn free
+// blocks so its old blocks go back to the allocator. Worn blocks that are
+// in use, such as hot metadata pairs, don't count. Intended to be called
+// from housekeeping code until it returns 0, which it also does once a
+// move fails to bring the file onto more worn blocks.
+//
+// Requires the erase_count callback, otherwise LFS_ERR_NOTSUP is returned.
+// Open files are skipped. The buffer must be cache_size, or NULL to use
+// lfs_malloc.
+//
+// Returns 1 if a file was moved, 0 if there was nothing to do, or a
+// negative error code on failure.
+int lfs_fs_wearlevel(lfs_t *lfs, lfs_size_t threshold, void *buffer);
+#endif
+
 #ifndef LFS_READONLY
 // Attempt to make the filesystem consistent and ready for writing
 //
@@ -0,0 +1,85 @@
+/*
+ * Leveled logging for the littlefs demo
+ */
+#include "lfs_log.h"
+
+// Timestamp source for binary records, defaults to a sequence number so
+// records can still be ordered without a timer. Define LFS_LOG_CLOCK to
+// something like millis() for real timestamps.
+#ifndef LFS_LOG_CLOCK
+static uint32_t lfs_log_seq = 0;
+#define LFS_LOG_CLOCK() (lfs_log_seq++)
+#endif
+
+static const char *const lfs_log_names[] = {
+    "?", "read", "prog", "erase", "sync", "bad", "compact",
+};
+
+// ring of the most recent records, head is the oldest record
+static struct lfs_log_record lfs_log_ring[LFS_LOG_RING_SIZE];
+static uint16_t lfs_log_head = 0;
+static uint16_t lfs_log_len = 0;
+static uint32_t lfs_log_lost = 0;
+static uint32_t lfs_log_counts[LFS_LOG_EVENT_COUNT];
+
+void lfs_log_put(uint8_t level, uint8_t event,
+        uint32_t block, uint32_t off, uint32_t size) {
+    if (event < LFS_LOG_EVENT_COUNT) {
+        lfs_log_counts[event] += 1;
+    }
+
+    if (lfs_log_len == LFS_LOG_RING_SIZE) {
+        // full, overwrite the oldest record
+        lfs_log_head = (lfs_log_head + 1) & (LFS_LOG_RING_SIZE-1);
+        lfs_log_len -= 1;
+        lfs_log_lost += 1;
+    }
+
+    struct lfs_log_record *r = &lfs_log_ring[
+            (lfs_log_head + lfs_log_len) & (LFS_LOG_RING_SIZE-1)];
+    r->time = LFS_LOG_CLOCK();
+    r->event = event;
+    r->level = level;
+    r->block = (uint16_t)block;
+    r->off = (uint16_t)off;
+    r->size = (uint16_t)size;
+    lfs_log_len += 1;
+}
+
+uint16_t lfs_log_drain(struct lfs_log_record *records, uint16_t count) {
+    uint16_t n = 0;
+    while (n < count && lfs_log_len > 0) {
+        records[n] = lfs_log_ring[lfs_log_head];
+        lfs_log_head = (lfs_log_head + 1) & (LFS_LOG_RING_SIZE-1);
+        lfs_log_len -= 1;
+        n += 1;
+    }
+
+    return n;
+}
+
+void lfs_log_dump(void) {
+    char buf[40];
+    if (lfs_log_lost) {
+        snprintf(buf, sizeof(buf), "log: %"PRIu32" lost", lfs_log_lost);
+        printLine(buf);
+        lfs_log_lost = 0;
+    }
+
+    struct lfs_log_record r;
+    while (lfs_log_drain(&r, 1)) {
+        const char *name = (r.event < sizeof(lfs_log_names)
+                / sizeof(lfs_log_names[0])) ? lfs_log_names[r.event] : "?";
+        snprintf(buf, sizeof(buf), "%"PRIu32" %s %u:%u %u",
+                r.time, name, r.block, r.off, r.size);
+        printLine(buf);
+    }
+}
+
+uint32_t lfs_log_dropped(void) {
+    return lfs_log_lost;
+}
+
+uint32_t lfs_log_count(uint8_t event) {
+    return (event < LFS_LOG_EVENT_COUNT) ? lfs_log_counts[event] : 0;
+}
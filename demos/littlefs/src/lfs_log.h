@@ -0,0 +1,161 @@
+/*
+ * Leveled logging for the littlefs demo
+ *
+ * Levels below LFS_LOG_LEVEL are compiled out. Enabled text messages are
+ * formatted and sent to the screen, enabled events are stored as fixed-size
+ * binary records in a RAM ring, which can be dumped to the screen later or
+ * drained and decoded on the host with host/lfs_log_decode.py.
+ */
+#ifndef LFS_LOG_H
+#define LFS_LOG_H
+
+#include <stdint.h>
+#include <inttypes.h>
+
+// srxecore
+#include "screen.h"
+#include "printf.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+// Log levels, in increasing order of severity
+#define LFS_LOG_LEVEL_TRACE 0
+#define LFS_LOG_LEVEL_DEBUG 1
+#define LFS_LOG_LEVEL_INFO  2
+#define LFS_LOG_LEVEL_WARN  3
+#define LFS_LOG_LEVEL_ERROR 4
+#define LFS_LOG_LEVEL_NONE  5
+
+// Lowest level that is compiled in, anything below this costs nothing
+#ifndef LFS_LOG_LEVEL
+#define LFS_LOG_LEVEL LFS_LOG_LEVEL_INFO
+#endif
+
+// Lowest level for text messages. The format strings live in RAM on AVR,
+// so text is off by default even when events of the same level are on.
+#ifndef LFS_LOG_TEXT_LEVEL
+#define LFS_LOG_TEXT_LEVEL LFS_LOG_LEVEL_NONE
+#endif
+
+// Number of binary records kept in RAM, the oldest records are overwritten
+// once the ring is full. Must be a power of two.
+#ifndef LFS_LOG_RING_SIZE
+#define LFS_LOG_RING_SIZE 32
+#endif
+
+// Size of the stack buffer used to format text messages
+#ifndef LFS_LOG_TEXT_SIZE
+#define LFS_LOG_TEXT_SIZE 128
+#endif
+
+// Event ids stored in binary records, these are part of the record format
+// understood by host/lfs_log_decode.py, so only ever append to this list
+enum lfs_log_event {
+    LFS_LOG_BD_READ     = 1,    // block device read
+    LFS_LOG_BD_PROG     = 2,    // block device program
+    LFS_LOG_BD_ERASE    = 3,    // block device erase
+    LFS_LOG_BD_SYNC     = 4,    // block device sync
+    LFS_LOG_BD_BAD      = 5,    // block marked bad
+    LFS_LOG_MD_COMPACT  = 6,    // metadata pair compacted
+    LFS_LOG_BD_SKIP     = 7,    // block device erase skipped, already blank
+    LFS_LOG_MD_RELOCATE = 8,    // metadata block relocated, worn or bad
+    LFS_LOG_EVENT_COUNT,
+};
+
+// Binary log record, 12 bytes, stored little-endian on the SRXE
+struct lfs_log_record {
+    uint32_t time;      // LFS_LOG_CLOCK() at the time of the event
+    uint8_t event;      // enum lfs_log_event
+    uint8_t level;      // LFS_LOG_LEVEL_*
+    uint16_t block;     // block number, truncated to 16 bits
+    uint16_t off;       // offset in block, truncated to 16 bits
+    uint16_t size;      // size of operation, truncated to 16 bits
+};
+
+
+/// Binary records ///
+
+// Record an event if its level is compiled in. The level must be a
+// constant so the call is removed entirely when filtered.
+#define LFS_LOG_EVENT(level, event, block, off, size) do { \
+        if ((level) >= LFS_LOG_LEVEL) { \
+            lfs_log_put(level, event, block, off, size); \
+        } \
+    } while (0)
+
+// Append a record to the ring, prefer LFS_LOG_EVENT
+void lfs_log_put(uint8_t level, uint8_t event,
+        uint32_t block, uint32_t off, uint32_t size);
+
+// Copy up to count of the oldest records into records and remove them
+// from the ring.
+//
+// Returns the number of records copied.
+uint16_t lfs_log_drain(struct lfs_log_record *records, uint16_t count);
+
+// Print and remove every record in the ring
+void lfs_log_dump(void);
+
+// Number of records overwritten before they could be drained
+uint32_t lfs_log_dropped(void);
+
+// Number of records of an event ever logged, including drained and
+// overwritten records
+uint32_t lfs_log_count(uint8_t event);
+
+
+/// Text messages ///
+
+#define LFS_LOG_TEXT_(name, fmt, ...) do { \
+        char lfs_log_buf_[LFS_LOG_TEXT_SIZE]; \
+        snprintf(lfs_log_buf_, sizeof(lfs_log_buf_), \
+                "%s:%d:" name ": " fmt "%s", \
+                __FILE__, __LINE__, __VA_ARGS__); \
+        printLine(lfs_log_buf_); \
+    } while (0)
+
+#if LFS_LOG_LEVEL <= LFS_LOG_LEVEL_TRACE && \
+        LFS_LOG_TEXT_LEVEL <= LFS_LOG_LEVEL_TRACE
+#define LFS_LOG_TRACE(...) LFS_LOG_TEXT_("trace", __VA_ARGS__, "")
+#else
+#define LFS_LOG_TRACE(...)
+#endif
+
+#if LFS_LOG_LEVEL <= LFS_LOG_LEVEL_DEBUG && \
+        LFS_LOG_TEXT_LEVEL <= LFS_LOG_LEVEL_DEBUG
+#define LFS_LOG_DEBUG(...) LFS_LOG_TEXT_("debug", __VA_ARGS__, "")
+#else
+#define LFS_LOG_DEBUG(...)
+#endif
+
+#if LFS_LOG_LEVEL <= LFS_LOG_LEVEL_INFO && \
+        LFS_LOG_TEXT_LEVEL <= LFS_LOG_LEVEL_INFO
+#define LFS_LOG_INFO(...) LFS_LOG_TEXT_("info", __VA_ARGS__, "")
+#else
+#define LFS_LOG_INFO(...)
+#endif
+
+#if LFS_LOG_LEVEL <= LFS_LOG_LEVEL_WARN && \
+        LFS_LOG_TEXT_LEVEL <= LFS_LOG_LEVEL_WARN
+#define LFS_LOG_WARN(...) LFS_LOG_TEXT_("warn", __VA_ARGS__, "")
+#else
+#define LFS_LOG_WARN(...)
+#endif
+
+#if LFS_LOG_LEVEL <= LFS_LOG_LEVEL_ERROR && \
+        LFS_LOG_TEXT_LEVEL <= LFS_LOG_LEVEL_ERROR
+#define LFS_LOG_ERROR(...) LFS_LOG_TEXT_("error", __VA_ARGS__, "")
+#else
+#define LFS_LOG_ERROR(...)
+#endif
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
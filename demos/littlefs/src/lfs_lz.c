@@ -0,0 +1,451 @@
+/*
+ * Compressed files for the littlefs demo
+ */
+#include "lfs_lz.h"
+#include "lfs_util.h"
+
+#if LFS_LZ_CHUNK_SIZE > 4096
+#error "LFS_LZ_CHUNK_SIZE must be <= 4096"
+#endif
+#if LFS_LZ_WINDOW > LFS_LZ_CHUNK_SIZE
+#error "LFS_LZ_WINDOW must be <= LFS_LZ_CHUNK_SIZE"
+#endif
+
+#define LFS_LZ_MATCH_MIN 3
+#define LFS_LZ_MATCH_MAX (LFS_LZ_MATCH_MIN + 15)
+
+// no chunk in the buffer
+#define LFS_LZ_NOCHUNK 0xffff
+
+static uint16_t lfs_lz_le16(const uint8_t *p) {
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint16_t lfs_lz_count(const lfs_lz_file_t *lz) {
+    return lfs_lz_le16((const uint8_t*)lz->cfg->index + 2);
+}
+
+// stored and uncompressed size of chunk i
+static void lfs_lz_entry(const lfs_lz_file_t *lz, uint16_t i,
+        lfs_size_t *csize, lfs_size_t *size) {
+    const uint8_t *e = (const uint8_t*)lz->cfg->index + 4 + 4*i;
+    *csize = lfs_lz_le16(&e[0]);
+    *size = lfs_lz_le16(&e[2]);
+}
+
+#ifndef LFS_READONLY
+static void lfs_lz_tole16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+// hash of the smallest match at p, an index into the compressor's table
+static uint8_t lfs_lz_hash(const uint8_t *p) {
+    return (uint8_t)((p[0] << 5) ^ (p[1] << 2) ^ p[2]);
+}
+
+// compress size bytes from in to out, returns the compressed size, or 0 if
+// compressing doesn't save anything, out must hold size bytes, head is the
+// table of LFS_LZ_HASH_SIZE recent positions, and every candidate match
+// compared is counted in probes
+static lfs_size_t lfs_lz_compress(const uint8_t *in, lfs_size_t size,
+        uint8_t *out, uint8_t *head, uint32_t *probes) {
+    // no position is a candidate yet, 0xffff is past any chunk
+    memset(head, 0xff, 2*LFS_LZ_HASH_SIZE);
+
+    lfs_size_t o = 0;
+    lfs_size_t flag = 0;
+    uint8_t bit = 8;
+    for (lfs_size_t i = 0; i < size;) {
+        // room for a flag byte and a match, and still smaller than size
+        if (o + 3 >= size) {
+            return 0;
+        }
+
+        if (bit == 8) {
+            flag = o;
+            out[o++] = 0;
+            bit = 0;
+        }
+
+        // the only candidate is the last position with the same hash, a
+        // collision just costs a literal, matches may run into the bytes
+        // they repeat
+        lfs_size_t max = lfs_min(LFS_LZ_MATCH_MAX, size - i);
+        lfs_size_t best = 0;
+        lfs_size_t dist = 0;
+        if (max >= LFS_LZ_MATCH_MIN) {
+            lfs_size_t j = lfs_lz_le16(&head[2*lfs_lz_hash(&in[i])]);
+            if (j < i && i - j <= LFS_LZ_WINDOW) {
+                *probes += 1;
+                while (best < max && in[j+best] == in[i+best]) {
+                    best += 1;
+                }
+                dist = i - j;
+            }
+        }
+
+        // remember every position the match or literal covers, the
+        // nearest is the most likely to match again
+        lfs_size_t n = (best >= LFS_LZ_MATCH_MIN) ? best : 1;
+        for (lfs_size_t k = i; k < i + n && k + LFS_LZ_MATCH_MIN <= size;
+                k++) {
+            lfs_lz_tole16(&head[2*lfs_lz_hash(&in[k])], k);
+        }
+
+        if (best >= LFS_LZ_MATCH_MIN) {
+            out[flag] |= 1U << bit;
+            out[o++] = (uint8_t)(dist-1);
+            out[o++] = (uint8_t)(((dist-1) >> 8)
+                    | ((best-LFS_LZ_MATCH_MIN) << 4));
+            i += best;
+        } else {
+            out[o++] = in[i++];
+        }
+        bit += 1;
+    }
+
+    return o;
+}
+#endif
+
+// decompress csize bytes from in into size bytes of out, anything that
+// doesn't decode to exactly size bytes is corrupt
+static int lfs_lz_decompress(const uint8_t *in, lfs_size_t csize,
+        uint8_t *out, lfs_size_t size) {
+    lfs_size_t i = 0;
+    lfs_size_t o = 0;
+    while (o < size) {
+        if (i >= csize) {
+            return LFS_ERR_CORRUPT;
+        }
+
+        uint8_t flags = in[i++];
+        for (uint8_t bit = 0; bit < 8 && o < size; bit++) {
+            if (!(flags & (1U << bit))) {
+                if (i >= csize) {
+                    return LFS_ERR_CORRUPT;
+                }
+                out[o++] = in[i++];
+                continue;
+            }
+
+            if (i + 2 > csize) {
+                return LFS_ERR_CORRUPT;
+            }
+            lfs_size_t dist = ((lfs_size_t)in[i]
+                    | ((lfs_size_t)(in[i+1] & 0xf) << 8)) + 1;
+            lfs_size_t n = (in[i+1] >> 4) + LFS_LZ_MATCH_MIN;
+            i += 2;
+            if (dist > o || n > size - o) {
+                return LFS_ERR_CORRUPT;
+            }
+
+            for (; n > 0; n--) {
+                out[o] = out[o-dist];
+                o += 1;
+            }
+        }
+    }
+
+    return (i == csize) ? 0 : LFS_ERR_CORRUPT;
+}
+
+#ifndef LFS_READONLY
+// store the pending writes as the next chunk and add it to the index
+static int lfs_lz_seal(lfs_t *lfs, lfs_lz_file_t *lz) {
+    uint8_t *chunk = lz->cfg->buffer;
+    uint8_t *out = chunk + LFS_LZ_CHUNK_SIZE;
+    lfs_size_t csize = lfs_lz_compress(chunk, lz->pending, out,
+            out + LFS_LZ_CHUNK_SIZE, &lz->probes);
+    if (!csize) {
+        csize = lz->pending;
+        out = chunk;
+    }
+
+    lfs_soff_t res = lfs_file_seek(lfs, &lz->file, 0, LFS_SEEK_END);
+    if (res >= 0) {
+        res = lfs_file_write(lfs, &lz->file, out, csize);
+    }
+    if (res < 0) {
+        return res;
+    }
+
+    uint8_t *index = lz->cfg->index;
+    uint16_t count = lfs_lz_count(lz);
+    lfs_lz_tole16(&index[4 + 4*count], csize);
+    lfs_lz_tole16(&index[4 + 4*count + 2], lz->pending);
+    lfs_lz_tole16(&index[2], count+1);
+    lz->attr.size = LFS_LZ_INDEX_SIZE(count+1);
+
+    // the buffer still holds the chunk uncompressed
+    lz->chunk = count;
+    lz->pending = 0;
+    return 0;
+}
+#endif
+
+// decompress chunk k into the buffer
+static int lfs_lz_load(lfs_t *lfs, lfs_lz_file_t *lz, uint16_t k,
+        lfs_off_t coff, lfs_size_t csize, lfs_size_t size) {
+    uint8_t *chunk = lz->cfg->buffer;
+    uint8_t *in = chunk + LFS_LZ_CHUNK_SIZE;
+    if (size > LFS_LZ_CHUNK_SIZE || csize > size) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    // stored as is if compressing didn't help
+    if (csize == size) {
+        in = chunk;
+    }
+
+    lz->chunk = LFS_LZ_NOCHUNK;
+    lfs_soff_t res = lfs_file_seek(lfs, &lz->file, coff, LFS_SEEK_SET);
+    if (res >= 0) {
+        res = lfs_file_read(lfs, &lz->file, in, csize);
+    }
+    if (res < 0) {
+        return res;
+    }
+    if ((lfs_size_t)res != csize) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    if (in != chunk) {
+        int err = lfs_lz_decompress(in, csize, chunk, size);
+        if (err) {
+            return err;
+        }
+    }
+
+    lz->chunk = k;
+    return 0;
+}
+
+int lfs_lz_open(lfs_t *lfs, lfs_lz_file_t *lz, const char *path,
+        int flags, const struct lfs_lz_config *cfg) {
+    uint8_t *index = cfg->index;
+    LFS_ASSERT(cfg->index_size >= LFS_LZ_INDEX_SIZE(1));
+    memset(index, 0, cfg->index_size);
+    lz->cfg = cfg;
+    lz->flags = flags;
+    lz->pos = 0;
+    lz->size = 0;
+    lz->chunk = LFS_LZ_NOCHUNK;
+    lz->pending = 0;
+    lz->probes = 0;
+    lz->attr = (struct lfs_attr){LFS_LZ_ATTR, index, cfg->index_size};
+    lz->file_cfg = (struct lfs_file_config){
+        .buffer = cfg->file_buffer,
+        .attrs = &lz->attr,
+        .attr_count = 1,
+    };
+
+#ifndef LFS_READONLY
+    // the index is needed to append, and is only read when the file is
+    // opened for reading
+    if ((flags & LFS_O_WRONLY) == LFS_O_WRONLY) {
+        flags |= LFS_O_RDWR;
+    }
+#endif
+
+    int err = lfs_file_opencfg(lfs, &lz->file, path, flags, &lz->file_cfg);
+    if (err) {
+        return err;
+    }
+
+    lfs_soff_t stored = lfs_file_size(lfs, &lz->file);
+    if (stored < 0) {
+        err = stored;
+        goto cleanup;
+    }
+
+    // a new or truncated file still has no index, or an old one that
+    // littlefs read before truncating
+    if (stored == 0) {
+        memset(index, 0, cfg->index_size);
+        index[0] = 'Z';
+        index[1] = LFS_LZ_VERSION;
+    } else if (index[0] != 'Z' || index[1] != LFS_LZ_VERSION) {
+        err = LFS_ERR_CORRUPT;
+        goto cleanup;
+    }
+
+    uint16_t count = lfs_lz_count(lz);
+    if ((lfs_size_t)LFS_LZ_INDEX_SIZE(count) > cfg->index_size) {
+        err = LFS_ERR_FBIG;
+        goto cleanup;
+    }
+
+    // the chunks must account for every stored byte
+    lfs_size_t total = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        lfs_size_t csize, size;
+        lfs_lz_entry(lz, i, &csize, &size);
+        if (size > LFS_LZ_CHUNK_SIZE || csize > size) {
+            err = LFS_ERR_CORRUPT;
+            goto cleanup;
+        }
+        total += csize;
+        lz->size += size;
+    }
+    if (total != (lfs_size_t)stored) {
+        err = LFS_ERR_CORRUPT;
+        goto cleanup;
+    }
+
+    // only the chunks in use are written back
+    lz->attr.size = LFS_LZ_INDEX_SIZE(count);
+    return 0;
+
+cleanup:
+    lfs_file_close(lfs, &lz->file);
+    return err;
+}
+
+int lfs_lz_close(lfs_t *lfs, lfs_lz_file_t *lz) {
+    int err = 0;
+#ifndef LFS_READONLY
+    if (lz->pending) {
+        err = lfs_lz_seal(lfs, lz);
+    }
+#endif
+
+    int cerr = lfs_file_close(lfs, &lz->file);
+    return err ? err : cerr;
+}
+
+#ifndef LFS_READONLY
+int lfs_lz_sync(lfs_t *lfs, lfs_lz_file_t *lz) {
+    if (lz->pending) {
+        int err = lfs_lz_seal(lfs, lz);
+        if (err) {
+            return err;
+        }
+    }
+
+    return lfs_file_sync(lfs, &lz->file);
+}
+#endif
+
+lfs_ssize_t lfs_lz_read(lfs_t *lfs, lfs_lz_file_t *lz,
+        void *buffer, lfs_size_t size) {
+    LFS_ASSERT((lz->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+    uint8_t *data = buffer;
+    const uint8_t *chunk = lz->cfg->buffer;
+    lfs_size_t nsize = (lz->pos < lz->size)
+            ? lfs_min(size, lz->size - lz->pos)
+            : 0;
+    lfs_size_t read = nsize;
+
+    while (nsize > 0) {
+        // find the chunk holding pos, pending writes come after the index
+        uint16_t count = lfs_lz_count(lz);
+        uint16_t k = 0;
+        lfs_off_t off = 0;
+        lfs_off_t coff = 0;
+        lfs_size_t csize = 0;
+        lfs_size_t ksize = lz->pending;
+        for (; k < count; k++) {
+            lfs_lz_entry(lz, k, &csize, &ksize);
+            if (lz->pos < off + ksize) {
+                break;
+            }
+            off += ksize;
+            coff += csize;
+            ksize = lz->pending;
+        }
+
+        if (k < count && k != lz->chunk) {
+#ifndef LFS_READONLY
+            // the pending writes share the buffer
+            if (lz->pending) {
+                int err = lfs_lz_seal(lfs, lz);
+                if (err) {
+                    return err;
+                }
+                continue;
+            }
+#endif
+
+            int err = lfs_lz_load(lfs, lz, k, coff, csize, ksize);
+            if (err) {
+                return err;
+            }
+        }
+
+        lfs_size_t diff = lfs_min(nsize, off + ksize - lz->pos);
+        memcpy(data, &chunk[lz->pos - off], diff);
+        lz->pos += diff;
+        data += diff;
+        nsize -= diff;
+    }
+
+    return read;
+}
+
+#ifndef LFS_READONLY
+lfs_ssize_t lfs_lz_write(lfs_t *lfs, lfs_lz_file_t *lz,
+        const void *buffer, lfs_size_t size) {
+    LFS_ASSERT((lz->flags & LFS_O_WRONLY) == LFS_O_WRONLY);
+    uint8_t *chunk = lz->cfg->buffer;
+    const uint8_t *data = buffer;
+
+    // the pending chunk and any after it each take an index entry
+    uint16_t count = lfs_lz_count(lz);
+    lfs_size_t free = (lz->cfg->index_size - LFS_LZ_INDEX_SIZE(count)) / 4;
+    if (size > free*LFS_LZ_CHUNK_SIZE - lz->pending) {
+        return LFS_ERR_FBIG;
+    }
+
+    lfs_size_t nsize = size;
+    while (nsize > 0) {
+        // a chunk read back may still be in the buffer
+        if (!lz->pending) {
+            lz->chunk = LFS_LZ_NOCHUNK;
+        }
+
+        lfs_size_t diff = lfs_min(nsize, LFS_LZ_CHUNK_SIZE - lz->pending);
+        memcpy(&chunk[lz->pending], data, diff);
+        lz->pending += diff;
+        lz->size += diff;
+        data += diff;
+        nsize -= diff;
+
+        if (lz->pending == LFS_LZ_CHUNK_SIZE) {
+            int err = lfs_lz_seal(lfs, lz);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    lz->pos = lz->size;
+    return size;
+}
+#endif
+
+lfs_soff_t lfs_lz_seek(lfs_t *lfs, lfs_lz_file_t *lz,
+        lfs_soff_t off, int whence) {
+    (void)lfs;
+    lfs_soff_t npos = lz->pos;
+    if (whence == LFS_SEEK_SET) {
+        npos = off;
+    } else if (whence == LFS_SEEK_CUR) {
+        npos = lz->pos + off;
+    } else if (whence == LFS_SEEK_END) {
+        npos = lz->size + off;
+    }
+
+    if (npos < 0) {
+        return LFS_ERR_INVAL;
+    }
+
+    lz->pos = npos;
+    return npos;
+}
+
+lfs_soff_t lfs_lz_size(lfs_t *lfs, lfs_lz_file_t *lz) {
+    (void)lfs;
+    return lz->size;
+}
@@ -0,0 +1,158 @@
+/*
+ * Compressed files for the littlefs demo
+ *
+ * A compressed file is an ordinary littlefs file holding its data in
+ * chunks of up to LFS_LZ_CHUNK_SIZE bytes, each compressed on its own with
+ * LZSS, or stored as is when that doesn't make it any smaller. The chunk
+ * index, the stored and uncompressed size of every chunk, lives in a
+ * custom attribute of the file, so it is committed together with the data
+ * on every sync, and a read can seek to any chunk without decompressing
+ * the ones before it:
+ *
+ *     index   'Z', version, chunk count,
+ *             per chunk: stored size, uncompressed size
+ *     chunk   groups of a flag byte and up to 8 items, a clear bit is a
+ *             literal byte, a set bit a 2 byte match of 12 bits of
+ *             distance-1 and 4 bits of length-3
+ *
+ * All fields are little-endian. Writes always go to the end of the file,
+ * as with LFS_O_APPEND. Data is compressed a chunk at a time and a sync
+ * stores whatever is pending as a short chunk, so frequent syncs cost
+ * some compression.
+ */
+#ifndef LFS_LZ_H
+#define LFS_LZ_H
+
+#include "lfs.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+// Largest uncompressed chunk, at most 4096. Larger chunks compress better
+// but take more RAM, see LFS_LZ_BUFFER_SIZE.
+#ifndef LFS_LZ_CHUNK_SIZE
+#define LFS_LZ_CHUNK_SIZE 512
+#endif
+
+// How far back a match may reach, at most LFS_LZ_CHUNK_SIZE. The
+// compressor only compares each byte against the last position that
+// started with the same hash, so this doesn't change the time spent
+// compressing.
+#ifndef LFS_LZ_WINDOW
+#define LFS_LZ_WINDOW 256
+#endif
+
+// Type of the custom attribute holding the chunk index
+#ifndef LFS_LZ_ATTR
+#define LFS_LZ_ATTR 0x7a
+#endif
+
+#define LFS_LZ_VERSION 1
+
+// Number of 16-bit entries in the compressor's table of recent positions
+#define LFS_LZ_HASH_SIZE 256
+
+// Size of lfs_lz_config.buffer, a chunk, its compressed form and the
+// compressor's table
+#define LFS_LZ_BUFFER_SIZE (2*LFS_LZ_CHUNK_SIZE + 2*LFS_LZ_HASH_SIZE)
+
+// Size of an index of up to count chunks, limited to the filesystem's
+// attr_max
+#define LFS_LZ_INDEX_SIZE(count) (4 + 4*(count))
+
+// Buffers of a compressed file, which must stay valid until it is closed
+struct lfs_lz_config {
+    // Buffer for the underlying file, see lfs_file_config.buffer
+    void *file_buffer;
+
+    // Buffer of LFS_LZ_BUFFER_SIZE bytes
+    void *buffer;
+
+    // Buffer for the chunk index of index_size bytes, which bounds the
+    // number of chunks in the file, see LFS_LZ_INDEX_SIZE
+    void *index;
+    lfs_size_t index_size;
+};
+
+typedef struct lfs_lz_file {
+    lfs_file_t file;
+    struct lfs_file_config file_cfg;
+    struct lfs_attr attr;
+    const struct lfs_lz_config *cfg;
+    int flags;
+    lfs_off_t pos;
+    lfs_size_t size;
+    uint16_t chunk;
+    uint16_t pending;
+    // Candidate matches the compressor has compared, a measure of the
+    // CPU time spent compressing
+    uint32_t probes;
+} lfs_lz_file_t;
+
+
+/// Compressed file operations ///
+
+// Open a compressed file with the buffers in cfg
+//
+// The flags are the same as for lfs_file_open. The index is needed to
+// append, so a file opened for writing is also opened for reading
+// underneath. Opening a file that has data but no index returns
+// LFS_ERR_CORRUPT, and one with more chunks than fit in cfg->index
+// returns LFS_ERR_FBIG.
+//
+// Returns a negative error code on failure.
+int lfs_lz_open(lfs_t *lfs, lfs_lz_file_t *lz, const char *path,
+        int flags, const struct lfs_lz_config *cfg);
+
+// Close a compressed file
+//
+// Any pending writes are written out as if by lfs_lz_sync.
+//
+// Returns a negative error code on failure.
+int lfs_lz_close(lfs_t *lfs, lfs_lz_file_t *lz);
+
+#ifndef LFS_READONLY
+// Store pending writes and commit them with the index
+//
+// Returns a negative error code on failure.
+int lfs_lz_sync(lfs_t *lfs, lfs_lz_file_t *lz);
+#endif
+
+// Read data from a compressed file at the current position
+//
+// Reading a chunk other than the one being written stores the pending
+// writes as a short chunk first.
+//
+// Returns the number of bytes read, or a negative error code on failure.
+lfs_ssize_t lfs_lz_read(lfs_t *lfs, lfs_lz_file_t *lz,
+        void *buffer, lfs_size_t size);
+
+#ifndef LFS_READONLY
+// Append data to a compressed file
+//
+// Returns LFS_ERR_FBIG without writing anything if the data doesn't fit
+// in the index.
+//
+// Returns the number of bytes written, or a negative error code on failure.
+lfs_ssize_t lfs_lz_write(lfs_t *lfs, lfs_lz_file_t *lz,
+        const void *buffer, lfs_size_t size);
+#endif
+
+// Change the position of a compressed file for reading
+//
+// The whence and return value are the same as for lfs_file_seek.
+lfs_soff_t lfs_lz_seek(lfs_t *lfs, lfs_lz_file_t *lz,
+        lfs_soff_t off, int whence);
+
+// Uncompressed size of a compressed file
+lfs_soff_t lfs_lz_size(lfs_t *lfs, lfs_lz_file_t *lz);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
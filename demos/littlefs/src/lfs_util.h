@@ -10,20 +10,24 @@
 #include "screen.h"
 #include "printf.h"
 
+#include "lfs_log.h"
+
 #define LFS_NO_MALLOC 1
 
-#define LFS_YES_TRACE 1
-#define LFS_TRACE_(fmt, ...) do { \
-    char trace_buf[256] = {0}; \
-    snprintf(trace_buf, sizeof(trace_buf), "%s:%d:trace: " fmt "%s\n", __FILE__, __LINE__, __VA_ARGS__); \
-    printLine(trace_buf); \
-} while (0)
-#define LFS_TRACE(...) LFS_TRACE_(__VA_ARGS__, "")
-
-#define LFS_DEBUG(...)
-#define LFS_WARN(...)
-#define LFS_ERROR(...)
+// Logging goes through lfs_log.h, compile with LFS_LOG_LEVEL and
+// LFS_LOG_TEXT_LEVEL to choose which of these cost anything
+#define LFS_TRACE(...) LFS_LOG_TRACE(__VA_ARGS__)
+#define LFS_DEBUG(...) LFS_LOG_DEBUG(__VA_ARGS__)
+#define LFS_WARN(...) LFS_LOG_WARN(__VA_ARGS__)
+#define LFS_ERROR(...) LFS_LOG_ERROR(__VA_ARGS__)
+
+// Host builds (see host/Makefile) check asserts
+#ifdef LFS_HOST
+#include <assert.h>
+#define LFS_ASSERT(test) assert(test)
+#else
 #define LFS_ASSERT(...)
+#endif
 
 
 // Builtin functions, these may be replaced by more efficient
@@ -1,6 +1,9 @@
 // littlefs
 #include "lfs.h"
+#include "lfs_log.h"
+#include "srxe_bd.h"
 #include "screen.h"
+#include "printf.h"
 
 // srxecore
 #include "clock.h"
@@ -8,61 +11,16 @@
 #include "keyboard.h"
 #include "lcdtext.h"
 #include "lcdbase.h"
-#include "flash.h"
+
+// erase count gap that triggers static wear leveling
+#define WEAR_THRESHOLD 100
 
 // variables used by the filesystem
 static lfs_t lfs;
 static lfs_file_t file;
-
-int srxe_read(const struct lfs_config *c, lfs_block_t block,
-            lfs_off_t off, void *buffer, lfs_size_t size) {
-    printLine("Reading block...");
-    uint32_t addr = (block * c->block_size) + off;
-    int rv = flashRead(addr, (uint8_t*)buffer, size);
-    return rv ? LFS_ERR_OK : LFS_ERR_IO;
-}
-
-#define PAGE_SIZE 256
-int srxe_prog(const struct lfs_config *c, lfs_block_t block,
-            lfs_off_t off, const void *buffer, lfs_size_t size) {
-    printLine("Writing block...");
-    uint32_t addr = (block * c->block_size) + off;
-
-    bool rv = 0;
-    lfs_size_t pages = size / PAGE_SIZE;
-    for (lfs_size_t i = 0; i < pages; i++) {
-        rv &= flashWritePage(addr + i * PAGE_SIZE, (uint8_t*)buffer + i * PAGE_SIZE);
-    }
-
-    return rv ? LFS_ERR_OK : LFS_ERR_IO;
-}
-
-int srxe_erase(const struct lfs_config *c, lfs_block_t block) {
-    printLine("Erasing block...");
-    uint32_t addr = block * c->block_size;
-    int rv = flashEraseSector(addr, 1);
-    return rv ? LFS_ERR_OK : LFS_ERR_IO;
-}
-
-int srxe_sync(const struct lfs_config *c) {
-  printLine("Syncing...");
-  // no-op
-  return LFS_ERR_OK;
-}
-
-
-const struct lfs_config cfg = {
-    srxe_read,  // read
-    srxe_prog,  // prog
-    srxe_erase,  // erase
-    srxe_sync,  // sync
-    16,  // read_size
-    PAGE_SIZE,  // prog_size
-    4096,  // block_size
-    30,  // block_count
-    PAGE_SIZE,  // cache_size
-    16,  // lookahead_size
-    500,  // block_cycles
+static uint8_t file_buffer[SRXE_FILE_BUFFER_SIZE];
+static const struct lfs_file_config file_cfg = {
+    .buffer = file_buffer,
 };
 
 
@@ -70,15 +28,15 @@ const struct lfs_config cfg = {
 void initFileSystem() {
     // mount the filesystem
     printLine("Mounting filesystem...");
-    int err = lfs_mount(&lfs, &cfg);
+    int err = lfs_mount(&lfs, &srxe_cfg);
 
     // reformat if we can't mount the filesystem
     // this should only happen on the first boot
     if (err) {
         // tell the host we are formatting
         printLine("Formatting filesystem...");
-        lfs_format(&lfs, &cfg);
-        lfs_mount(&lfs, &cfg);
+        lfs_format(&lfs, &srxe_cfg);
+        lfs_mount(&lfs, &srxe_cfg);
     }
     printLine("Done mounting filesystem.");
 }
@@ -101,7 +59,7 @@ int main() {
 
     // write to a file
     printLine("Opening file...");
-    lfs_file_opencfg(&lfs, &file, "hello.txt", LFS_O_WRONLY | LFS_O_CREAT, &cfg);
+    lfs_file_opencfg(&lfs, &file, "hello.txt", LFS_O_WRONLY | LFS_O_CREAT, &file_cfg);
     printLine("Writing to file...");
     lfs_file_write(&lfs, &file, "Hello World!", 12);
     printLine("Closing file...");
@@ -112,7 +70,7 @@ int main() {
 
     // read back
     printLine("Opening file...");
-    lfs_file_opencfg(&lfs, &file, "hello.txt", LFS_O_RDONLY, &cfg);
+    lfs_file_opencfg(&lfs, &file, "hello.txt", LFS_O_RDONLY, &file_cfg);
     printLine("Reading from file...");
     char buf[12] = {0};
     lfs_file_read(&lfs, &file, buf, 12);
@@ -124,8 +82,34 @@ int main() {
     printLine("Deleting file...");
     lfs_remove(&lfs, "hello.txt");
 
+    printLine("Press any key to dump the flash log.");
+    kbdGetKeyWait();
+    lfs_log_dump();
+
+    // show how evenly the flash is wearing
+    struct lfs_wear wear;
+    if (lfs_fs_wear(&lfs, &wear) == 0) {
+        char line[64];
+        snprintf(line, sizeof(line), "Erases min %lu max %lu mean %lu",
+                (unsigned long)wear.min, (unsigned long)wear.max,
+                (unsigned long)wear.mean);
+        printLine(line);
+        snprintf(line, sizeof(line), "Hottest block %lu (%lu)",
+                (unsigned long)wear.hot[0], (unsigned long)wear.hot_count[0]);
+        printLine(line);
+    }
+
+    // move static data off the least worn blocks while we are idle
+    while (lfs_fs_wearlevel(&lfs, WEAR_THRESHOLD, file_buffer) > 0) {
+        printLine("Wear leveling...");
+    }
+
     printLine("Press any key to sleep.");
     kbdGetKeyWait();
+#if !defined(SRXE_NO_WEAR) || !defined(SRXE_NO_BADBLOCK)
+    srxe_bd_flush();
+#endif
+    srxe_bd_release();
     printLine("Sleeping...");
     lcdSleep();
     powerSleep();
@@ -0,0 +1,548 @@
+/*
+ * littlefs block device for the SRXE's SPI flash
+ */
+#include "srxe_bd.h"
+#include "lfs_util.h"
+#include "lfs_log.h"
+
+#include <stddef.h>
+
+// srxecore
+#include "flash.h"
+
+
+/// Continuous reads ///
+#ifdef SRXE_FLASH_STREAM_BEGIN
+// A read that picks up where the last one ended keeps clocking bytes out
+// of the open read command instead of sending a new command and address.
+// The stream is ended before anything else is sent to the flash.
+static bool srxe_streaming = false;
+static uint32_t srxe_stream_addr;
+
+static void srxe_stream_end(void) {
+    if (srxe_streaming) {
+        SRXE_FLASH_STREAM_END();
+        srxe_streaming = false;
+    }
+}
+
+static bool srxe_stream_read(uint32_t addr, uint8_t *buffer, uint32_t size) {
+    if (!srxe_streaming || addr != srxe_stream_addr) {
+        srxe_stream_end();
+        if (!SRXE_FLASH_STREAM_BEGIN(addr)) {
+            return false;
+        }
+        srxe_streaming = true;
+    }
+
+    if (!SRXE_FLASH_STREAM_READ(buffer, size)) {
+        srxe_stream_end();
+        return false;
+    }
+
+    srxe_stream_addr = addr + size;
+    return true;
+}
+#else
+static void srxe_stream_end(void) {
+}
+
+static bool srxe_stream_read(uint32_t addr, uint8_t *buffer, uint32_t size) {
+    return flashRead(addr, buffer, size);
+}
+#endif
+
+void srxe_bd_release(void) {
+    srxe_stream_end();
+}
+
+
+/// Persistent state ///
+#ifndef SRXE_NO_WEAR
+#define SRXE_WEAR
+#endif
+
+#ifndef SRXE_NO_BADBLOCK
+#define SRXE_BADBLOCK
+#endif
+
+#if defined(SRXE_WEAR) || defined(SRXE_BADBLOCK)
+#define SRXE_STATE
+#endif
+
+#if defined(SRXE_STATE) || !defined(SRXE_FLASH_PROG)
+// A whole page as it is sent to the flash, for state records and programs
+// of part of a page. The caches can't hold it, littlefs programs straight
+// from them, and the AVR's stack has no room to spare for it.
+static uint8_t srxe_page[SRXE_PAGE_SIZE];
+#endif
+
+#ifdef SRXE_STATE
+// Each record takes a page in one of the two state sectors, a new record
+// is appended on every flush and the record with the highest sequence
+// number wins. When a sector fills up we move on to the other one, so
+// the newest complete record always survives the erase.
+#define SRXE_STATE_MAGIC    0x32585253  // "SRX2"
+#define SRXE_STATE_PAGES    (2*SRXE_BLOCK_SIZE / SRXE_PAGE_SIZE)
+
+struct srxe_state_record {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t counts[SRXE_BLOCK_COUNT];
+    uint8_t bad[(SRXE_BLOCK_COUNT+7) / 8];
+    uint32_t crc;
+};
+
+static struct srxe_state_record srxe_state;
+static bool srxe_state_loaded = false;
+static uint8_t srxe_state_dirty = 0;
+static uint16_t srxe_state_page = 0;
+
+static uint32_t srxe_state_addr(uint16_t page) {
+    return (uint32_t)SRXE_STATE_BLOCK*SRXE_BLOCK_SIZE
+            + (uint32_t)page*SRXE_PAGE_SIZE;
+}
+
+static bool srxe_state_isblank(uint16_t page) {
+    uint32_t buffer[8];
+    for (uint16_t off = 0; off < SRXE_PAGE_SIZE; off += sizeof(buffer)) {
+        if (!flashRead(srxe_state_addr(page) + off,
+                (uint8_t*)buffer, sizeof(buffer))) {
+            return false;
+        }
+
+        for (unsigned i = 0; i < sizeof(buffer)/sizeof(buffer[0]); i++) {
+            if (buffer[i] != 0xffffffff) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void srxe_state_load(void) {
+    if (srxe_state_loaded) {
+        return;
+    }
+
+    srxe_stream_end();
+
+    // find the newest valid record, starting from zero if there is none
+    memset(&srxe_state, 0, sizeof(srxe_state));
+    int32_t newest = -1;
+    for (uint16_t page = 0; page < SRXE_STATE_PAGES; page++) {
+        struct srxe_state_record r;
+        if (!flashRead(srxe_state_addr(page), (uint8_t*)&r, sizeof(r))) {
+            continue;
+        }
+
+        if (lfs_fromle32(r.magic) != SRXE_STATE_MAGIC
+                || lfs_fromle32(r.crc) != lfs_crc(0xffffffff,
+                    &r, offsetof(struct srxe_state_record, crc))) {
+            continue;
+        }
+
+        r.seq = lfs_fromle32(r.seq);
+        if (newest < 0 || lfs_scmp(r.seq, srxe_state.seq) > 0) {
+            srxe_state = r;
+            newest = page;
+        }
+    }
+
+    for (int i = 0; i < SRXE_BLOCK_COUNT; i++) {
+        srxe_state.counts[i] = lfs_fromle32(srxe_state.counts[i]);
+    }
+
+    // append after the newest record, skipping anything left behind by a
+    // torn write, a new sector is erased before its first record
+    srxe_state_page = newest + 1;
+    while (srxe_state_page % (SRXE_STATE_PAGES/2) != 0
+            && !srxe_state_isblank(srxe_state_page)) {
+        srxe_state_page += 1;
+    }
+    srxe_state_page %= SRXE_STATE_PAGES;
+
+    srxe_state_loaded = true;
+}
+
+int srxe_bd_flush(void) {
+    if (!srxe_state_dirty) {
+        return LFS_ERR_OK;
+    }
+
+    srxe_stream_end();
+
+    if (srxe_state_page % (SRXE_STATE_PAGES/2) == 0) {
+        if (!flashEraseSector(srxe_state_addr(srxe_state_page), 1)) {
+            return LFS_ERR_IO;
+        }
+    }
+
+    memset(srxe_page, 0xff, sizeof(srxe_page));
+    struct srxe_state_record *r = (struct srxe_state_record*)srxe_page;
+    r->magic = lfs_tole32(SRXE_STATE_MAGIC);
+    r->seq = lfs_tole32(srxe_state.seq + 1);
+    for (int i = 0; i < SRXE_BLOCK_COUNT; i++) {
+        r->counts[i] = lfs_tole32(srxe_state.counts[i]);
+    }
+    memcpy(r->bad, srxe_state.bad, sizeof(r->bad));
+    r->crc = lfs_tole32(lfs_crc(0xffffffff,
+            r, offsetof(struct srxe_state_record, crc)));
+
+    if (!flashWritePage(srxe_state_addr(srxe_state_page), srxe_page)) {
+        return LFS_ERR_IO;
+    }
+
+    srxe_state.seq += 1;
+    srxe_state_page = (srxe_state_page + 1) % SRXE_STATE_PAGES;
+    srxe_state_dirty = 0;
+    return LFS_ERR_OK;
+}
+#endif
+
+
+
+/// Blank sectors ///
+#ifndef SRXE_NO_BLANK
+#define SRXE_BLANK
+#endif
+
+#ifdef SRXE_BLANK
+// Sectors known to read back as erased, set by an erase and cleared by
+// the first program into the sector, so erasing a sector that was never
+// used since its last erase costs nothing. This only lives in RAM, after
+// a reset every sector is unknown until it is erased or checked again.
+static uint8_t srxe_blank[(SRXE_BLOCK_COUNT+7) / 8];
+
+static bool srxe_isblank(uint32_t sector) {
+    return sector < SRXE_BLOCK_COUNT
+            && (srxe_blank[sector / 8] & (1U << (sector % 8)));
+}
+
+static void srxe_markblank(uint32_t sector, bool blank) {
+    if (sector >= SRXE_BLOCK_COUNT) {
+        return;
+    }
+
+    if (blank) {
+        srxe_blank[sector / 8] |= 1U << (sector % 8);
+    } else {
+        srxe_blank[sector / 8] &= ~(1U << (sector % 8));
+    }
+}
+
+#ifdef SRXE_BLANK_CHECK
+// read a sector back looking for anything but 0xff, littlefs writes
+// every block it uses from the start, so a used sector almost always
+// fails on the first read
+static bool srxe_checkblank(uint32_t sector) {
+    uint32_t buffer[8];
+    uint32_t addr = sector*SRXE_BLOCK_SIZE;
+    for (uint16_t off = 0; off < SRXE_BLOCK_SIZE; off += sizeof(buffer)) {
+        if (!srxe_stream_read(addr + off, (uint8_t*)buffer, sizeof(buffer))) {
+            return false;
+        }
+
+        for (unsigned i = 0; i < sizeof(buffer)/sizeof(buffer[0]); i++) {
+            if (buffer[i] != 0xffffffff) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+#endif
+#endif
+
+void srxe_bd_reset(void) {
+    srxe_stream_end();
+#ifdef SRXE_BLANK
+    memset(srxe_blank, 0, sizeof(srxe_blank));
+#endif
+#ifdef SRXE_STATE
+    srxe_state_loaded = false;
+    srxe_state_dirty = 0;
+#endif
+}
+
+
+/// Erase counters ///
+#ifdef SRXE_WEAR
+int srxe_erase_count(const struct lfs_config *c, lfs_block_t block,
+        lfs_size_t *count) {
+    (void)c;
+    if (block >= SRXE_BLOCK_COUNT) {
+        return LFS_ERR_INVAL;
+    }
+
+    srxe_state_load();
+    *count = srxe_state.counts[block];
+    return LFS_ERR_OK;
+}
+#endif
+
+
+/// Bad blocks ///
+#ifdef SRXE_BADBLOCK
+static bool srxe_isbad(lfs_block_t block) {
+    srxe_state_load();
+    return block < SRXE_BLOCK_COUNT
+            && (srxe_state.bad[block / 8] & (1U << (block % 8)));
+}
+
+// mark a block as bad and persist the table right away, returns
+// LFS_ERR_CORRUPT so littlefs relocates whatever it was writing
+static int srxe_markbad(lfs_block_t block) {
+    LFS_LOG_EVENT(LFS_LOG_LEVEL_WARN, LFS_LOG_BD_BAD, block, 0, 0);
+    if (block < SRXE_BLOCK_COUNT && !srxe_isbad(block)) {
+        srxe_state.bad[block / 8] |= 1U << (block % 8);
+        srxe_state_dirty = 1;
+        int err = srxe_bd_flush();
+        if (err) {
+            return err;
+        }
+    }
+
+    return LFS_ERR_CORRUPT;
+}
+
+// compare a freshly programmed page against what we asked for, in one
+// continuous read when the driver allows it
+static bool srxe_verify(uint32_t addr, const uint8_t *buffer,
+        lfs_size_t size) {
+    uint8_t check[32];
+    for (lfs_size_t i = 0; i < size; i += sizeof(check)) {
+        lfs_size_t n = lfs_min(sizeof(check), size - i);
+        if (!srxe_stream_read(addr + i, check, n)
+                || memcmp(check, buffer + i, n) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int srxe_bad_blocks(const struct lfs_config *c,
+        int (*cb)(void *data, lfs_block_t block), void *data) {
+    (void)c;
+    srxe_state_load();
+    for (lfs_block_t block = 0; block < SRXE_BLOCK_COUNT; block++) {
+        if (srxe_state.bad[block / 8] & (1U << (block % 8))) {
+            int err = cb(data, block);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+#endif
+
+
+/// Block device operations ///
+
+// program part of a single page, without a driver function for that the
+// whole page is sent with 0xff around the range, which leaves the bytes
+// outside it as they are
+static bool srxe_progpage(uint32_t addr, const uint8_t *buffer,
+        lfs_size_t size) {
+    srxe_stream_end();
+#ifdef SRXE_FLASH_PROG
+    return SRXE_FLASH_PROG(addr, buffer, size);
+#else
+    if (size == SRXE_PAGE_SIZE) {
+        return flashWritePage(addr, (uint8_t*)buffer);
+    }
+
+    memset(srxe_page, 0xff, sizeof(srxe_page));
+    memcpy(&srxe_page[addr % SRXE_PAGE_SIZE], buffer, size);
+    return flashWritePage(addr - addr % SRXE_PAGE_SIZE, srxe_page);
+#endif
+}
+
+int srxe_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    LFS_LOG_EVENT(LFS_LOG_LEVEL_INFO, LFS_LOG_BD_READ, block, off, size);
+    uint32_t addr = (block * c->block_size) + off;
+    int rv = srxe_stream_read(addr, (uint8_t*)buffer, size);
+    return rv ? LFS_ERR_OK : LFS_ERR_IO;
+}
+
+int srxe_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    LFS_LOG_EVENT(LFS_LOG_LEVEL_INFO, LFS_LOG_BD_PROG, block, off, size);
+    LFS_ASSERT(c->block_size == SRXE_BLOCK_SIZE);
+    uint32_t addr = (block * c->block_size) + off;
+    srxe_stream_end();
+#ifdef SRXE_BLANK
+    srxe_markblank(addr / SRXE_BLOCK_SIZE, false);
+#endif
+
+    // a program can't cross a page, so split the range at page boundaries
+    const uint8_t *data = buffer;
+    while (size > 0) {
+        lfs_size_t n = lfs_min(size, SRXE_PAGE_SIZE - addr % SRXE_PAGE_SIZE);
+        if (!srxe_progpage(addr, data, n)) {
+            return LFS_ERR_IO;
+        }
+
+#ifdef SRXE_BADBLOCK
+        if (!srxe_verify(addr, data, n)) {
+            return srxe_markbad(block);
+        }
+#endif
+
+        addr += n;
+        data += n;
+        size -= n;
+    }
+
+    return LFS_ERR_OK;
+}
+
+int srxe_erase(const struct lfs_config *c, lfs_block_t block) {
+    LFS_LOG_EVENT(LFS_LOG_LEVEL_INFO, LFS_LOG_BD_ERASE,
+            block, 0, c->block_size);
+    LFS_ASSERT(c->block_size == SRXE_BLOCK_SIZE);
+    uint32_t addr = block * c->block_size;
+#ifdef SRXE_BLANK
+    // skip the erase if the sector hasn't been programmed since the last
+    // one, this also leaves its erase count alone
+    uint32_t sector = addr / SRXE_BLOCK_SIZE;
+#ifdef SRXE_BLANK_CHECK
+    if (!srxe_isblank(sector) && srxe_checkblank(sector)) {
+        srxe_markblank(sector, true);
+    }
+#endif
+    if (srxe_isblank(sector)) {
+        LFS_LOG_EVENT(LFS_LOG_LEVEL_INFO, LFS_LOG_BD_SKIP,
+                block, 0, c->block_size);
+        return LFS_ERR_OK;
+    }
+#endif
+
+    srxe_stream_end();
+#ifdef SRXE_FLASH_BUSY
+    // don't wait, the flash driver waits before its next command, and an
+    // erase that fails shows up in the readback of the first program
+    int rv = flashEraseSector(addr, 0);
+#else
+    int rv = flashEraseSector(addr, 1);
+#endif
+
+#ifdef SRXE_WEAR
+    if (block < SRXE_BLOCK_COUNT) {
+        srxe_state_load();
+        srxe_state.counts[block] += 1;
+        if (!srxe_state_dirty) {
+            srxe_state_dirty = 1;
+        }
+    }
+#endif
+
+    if (!rv) {
+#ifdef SRXE_BADBLOCK
+        return srxe_markbad(block);
+#else
+        return LFS_ERR_IO;
+#endif
+    }
+
+#ifdef SRXE_BLANK
+    srxe_markblank(sector, true);
+#endif
+    return LFS_ERR_OK;
+}
+
+int srxe_crc(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, lfs_size_t size, uint32_t *crc) {
+    uint32_t addr = (block * c->block_size) + off;
+    uint8_t buffer[32];
+    *crc = 0xffffffff;
+    for (lfs_size_t i = 0; i < size; i += sizeof(buffer)) {
+        lfs_size_t n = lfs_min(sizeof(buffer), size - i);
+        if (!srxe_stream_read(addr + i, buffer, n)) {
+            return LFS_ERR_IO;
+        }
+
+        *crc = lfs_crc(*crc, buffer, n);
+    }
+
+    return LFS_ERR_OK;
+}
+
+int srxe_sync(const struct lfs_config *c) {
+    (void)c;
+    LFS_LOG_EVENT(LFS_LOG_LEVEL_INFO, LFS_LOG_BD_SYNC, 0, 0, 0);
+    // programs complete before returning, so there is nothing to do here
+    // except finish any erase and occasionally persist the erase counters
+    srxe_stream_end();
+#ifdef SRXE_FLASH_BUSY
+    while (SRXE_FLASH_BUSY()) {
+    }
+#endif
+#ifdef SRXE_WEAR
+    if (srxe_state_dirty) {
+        srxe_state_dirty += 1;
+        if (srxe_state_dirty > SRXE_WEAR_INTERVAL) {
+            return srxe_bd_flush();
+        }
+    }
+#endif
+    return LFS_ERR_OK;
+}
+
+#ifdef SRXE_FLASH_BUSY
+int srxe_busy(const struct lfs_config *c) {
+    (void)c;
+    return SRXE_FLASH_BUSY() ? 1 : 0;
+}
+#endif
+
+
+// statically allocated caches
+static uint8_t srxe_read_buffer[SRXE_PAGE_SIZE];
+static uint8_t srxe_prog_buffer[SRXE_PAGE_SIZE];
+static uint32_t srxe_lookahead_buffer[16/4];
+#if SRXE_COMPACT_TAGS
+static uint16_t srxe_compact_buffer[3*SRXE_COMPACT_TAGS];
+#endif
+
+const struct lfs_config srxe_cfg = {
+    .read           = srxe_read,
+    .prog           = srxe_prog,
+    .erase          = srxe_erase,
+    .sync           = srxe_sync,
+
+    .read_size      = 16,
+    .prog_size      = SRXE_PROG_SIZE,
+    .block_size     = SRXE_BLOCK_SIZE,
+    .block_count    = SRXE_BLOCK_COUNT,
+    .cache_size     = SRXE_PAGE_SIZE,
+    .lookahead_size = sizeof(srxe_lookahead_buffer),
+    .block_cycles   = 500,
+    .inline_max     = SRXE_INLINE_MAX,
+    .verify         = SRXE_VERIFY,
+
+    .read_buffer        = srxe_read_buffer,
+    .prog_buffer        = srxe_prog_buffer,
+    .lookahead_buffer   = srxe_lookahead_buffer,
+#if SRXE_COMPACT_TAGS
+    .compact_buffer     = srxe_compact_buffer,
+    .compact_size       = sizeof(srxe_compact_buffer),
+#endif
+
+#ifdef SRXE_WEAR
+    .erase_count        = srxe_erase_count,
+#endif
+#ifdef SRXE_BADBLOCK
+    .bad_blocks         = srxe_bad_blocks,
+#endif
+#ifdef SRXE_FLASH_BUSY
+    .busy               = srxe_busy,
+#endif
+    .crc                = srxe_crc,
+};
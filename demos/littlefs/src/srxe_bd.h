@@ -0,0 +1,166 @@
+/*
+ * littlefs block device for the SRXE's SPI flash
+ *
+ * The callbacks map littlefs blocks directly onto 4 KiB flash sectors
+ * starting at address 0, programming in 256 byte pages through srxecore's
+ * flash driver. The same file is built on the host against an emulated
+ * flash driver, see host/flash_emu.c.
+ */
+#ifndef SRXE_BD_H
+#define SRXE_BD_H
+
+#include "lfs.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+// Flash geometry
+#define SRXE_PAGE_SIZE      256
+#define SRXE_BLOCK_SIZE     4096
+#define SRXE_BLOCK_COUNT    30
+
+// Erase counters and the bad block table are persisted in the two
+// sectors following the filesystem, unless built with both SRXE_NO_WEAR
+// and SRXE_NO_BADBLOCK
+#define SRXE_STATE_BLOCK    SRXE_BLOCK_COUNT
+
+// Number of sync calls with new erases before the erase counters are
+// written out, a power loss forgets at most this many syncs of erases
+#ifndef SRXE_WEAR_INTERVAL
+#define SRXE_WEAR_INTERVAL  4
+#endif
+
+// Smallest program littlefs makes, every metadata commit is padded to
+// this, so smaller commits fit more of them in a metadata block between
+// compactions, see host/progbench.c. Must divide the cache size of
+// SRXE_PAGE_SIZE
+#ifndef SRXE_PROG_SIZE
+#define SRXE_PROG_SIZE      16
+#endif
+
+// Files up to this size are kept inline in metadata instead of taking a
+// whole 4 KiB block each, see host/bench.c for the tradeoff
+#ifndef SRXE_INLINE_MAX
+#define SRXE_INLINE_MAX     512
+#endif
+
+// Checks littlefs makes of file data it programs, see lfs_config.verify.
+// With bad block tracking srxe_prog already reads back every page it
+// programs, so littlefs doesn't need to check it again, see
+// host/verifybench.c
+#ifndef SRXE_VERIFY
+#ifndef SRXE_NO_BADBLOCK
+#define SRXE_VERIFY         LFS_VERIFY_NONE
+#else
+#define SRXE_VERIFY         LFS_VERIFY_ALL
+#endif
+#endif
+
+// Tags a metadata pair can hold for compaction to take a single pass over
+// it, 6 bytes of RAM each, larger directories compact with a pass per tag,
+// see host/compactbench.c. Zero disables the buffer
+#ifndef SRXE_COMPACT_TAGS
+#define SRXE_COMPACT_TAGS   64
+#endif
+
+// Erases of sectors that haven't been programmed since their last erase
+// are skipped, unless built with SRXE_NO_BLANK. Which sectors are blank
+// is only known in RAM, define SRXE_BLANK_CHECK to also skip erasing a
+// sector that reads back as all 0xff, such as every sector of a new chip.
+// That costs a 4 KiB read per blank sector instead of a 50 ms erase, but
+// trusts a sector whose erase was cut short by a power loss as soon as it
+// reads back as 0xff, before its cells may be fully erased, so it is off
+// by default. See host/erasebench.c.
+
+// Define SRXE_FLASH_BUSY to the name of a function polling the flash's
+// busy bit to start erases without waiting for them, see lfs_config.busy.
+// The flash driver must wait for the chip before every other command.
+// This lets lfs_file_write_nb and lfs_file_sync_nb return to the caller
+// during the 50 ms of a sector erase.
+
+// Define SRXE_FLASH_PROG(addr, buffer, size) to the name of a function
+// programming part of a page, returning false on failure, to send only
+// the bytes being written. Otherwise a program smaller than a page sends
+// the whole page with 0xff around it, which leaves the other bytes as
+// they are. Either way a page is programmed several times between
+// erases, which the SRXE's NOR flash allows.
+
+// Define SRXE_FLASH_STREAM_BEGIN(addr), SRXE_FLASH_STREAM_READ(buffer,
+// size) and SRXE_FLASH_STREAM_END() to the names of functions that send a
+// read command, clock bytes out of it with chip select held, and release
+// chip select, to let a read that continues where the last one ended skip
+// the command and address. Metadata fetches and file reads mostly read
+// straight through a block, so most reads continue the stream. The
+// functions return false on failure, like flashRead. While a stream is
+// open nothing else may use the SPI bus, see srxe_bd_release.
+
+// Size of file buffers passed in lfs_file_config, these hold whole inline
+// files so may be larger than a page
+#define SRXE_FILE_BUFFER_SIZE \
+    (SRXE_INLINE_MAX > SRXE_PAGE_SIZE ? SRXE_INLINE_MAX : SRXE_PAGE_SIZE)
+
+// Filesystem configuration used by the demo, with statically allocated
+// caches since we build with LFS_NO_MALLOC
+extern const struct lfs_config srxe_cfg;
+
+// Block device callbacks, these can be reused in configs derived from
+// srxe_cfg as long as block_size stays SRXE_BLOCK_SIZE, the blank,
+// erase count and bad block state is kept per sector, any prog_size works
+int srxe_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size);
+int srxe_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size);
+int srxe_erase(const struct lfs_config *c, lfs_block_t block);
+int srxe_sync(const struct lfs_config *c);
+
+// CRC of data on flash without copying it into littlefs's caches, see
+// lfs_config.crc
+int srxe_crc(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, lfs_size_t size, uint32_t *crc);
+
+#ifdef SRXE_FLASH_BUSY
+// Report an erase still in flight, see lfs_config.busy
+int srxe_busy(const struct lfs_config *c);
+#endif
+
+#ifndef SRXE_NO_WEAR
+// Report the erase count of a block, see lfs_config.erase_count
+int srxe_erase_count(const struct lfs_config *c, lfs_block_t block,
+        lfs_size_t *count);
+#endif
+
+#ifndef SRXE_NO_BADBLOCK
+// Report every block marked bad, see lfs_config.bad_blocks
+//
+// A block is marked bad when an erase fails or a programmed page does not
+// read back as written. The prog or erase then returns LFS_ERR_CORRUPT so
+// littlefs relocates the data, and the block is never allocated again.
+int srxe_bad_blocks(const struct lfs_config *c,
+        int (*cb)(void *data, lfs_block_t block), void *data);
+#endif
+
+#if !defined(SRXE_NO_WEAR) || !defined(SRXE_NO_BADBLOCK)
+// Write out the erase counters now instead of waiting for a later sync,
+// call this before powering down. Bad blocks are always written out as
+// soon as they are found.
+int srxe_bd_flush(void);
+#endif
+
+// End any continuous read so something else can use the SPI bus, call
+// this before touching other SPI devices, including from lfs_config.yield,
+// and before sleeping. Programs, erases and syncs end it as well.
+void srxe_bd_release(void);
+
+// Forget any state cached in RAM, as after a reset. Only needed on the
+// host, where a power loss is emulated without restarting the program.
+void srxe_bd_reset(void);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Streaming delta updates for the SRXE's littlefs image
+ */
+#include "srxe_delta.h"
+#include "lfs_util.h"
+
+enum srxe_delta_state {
+    SRXE_DELTA_HEADER,
+    SRXE_DELTA_RECORD,
+    SRXE_DELTA_DATA,
+    SRXE_DELTA_CRC,
+    SRXE_DELTA_DONE,
+    SRXE_DELTA_ERRED,
+};
+
+static uint16_t srxe_delta_le16(const uint8_t *p) {
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t srxe_delta_le32(const uint8_t *p) {
+    return (uint32_t)srxe_delta_le16(p)
+            | ((uint32_t)srxe_delta_le16(p+2) << 16);
+}
+
+// next page in the record's bitmap at or after page, or SRXE_DELTA_PAGES
+static uint8_t srxe_delta_nextpage(uint16_t pages, uint8_t page) {
+    while (page < SRXE_DELTA_PAGES && !(pages & (1U << page))) {
+        page += 1;
+    }
+    return page;
+}
+
+static int srxe_delta_header(struct srxe_delta *d) {
+    const uint8_t *h = d->buffer;
+    const uint8_t *keep = &h[16];
+    if (srxe_delta_le32(&h[0]) != SRXE_DELTA_MAGIC
+            || srxe_delta_le32(&h[SRXE_DELTA_HEADER_SIZE-4])
+                != lfs_crc(0xffffffff, h, SRXE_DELTA_HEADER_SIZE-4)) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    if (srxe_delta_le32(&h[4]) != d->cfg->block_size
+            || srxe_delta_le16(&h[8]) != SRXE_PAGE_SIZE
+            || srxe_delta_le16(&h[10]) != d->cfg->block_count) {
+        return LFS_ERR_INVAL;
+    }
+
+    d->records = srxe_delta_le16(&h[12]);
+    uint32_t base = srxe_delta_le32(&h[SRXE_DELTA_HEADER_SIZE-8]);
+
+    // the kept blocks are reread into the header's buffer, so hold on
+    // to the bitmap, records must leave these blocks alone
+    memcpy(d->keep, keep, sizeof(d->keep));
+
+    // check the blocks we keep are the ones the delta was made against
+    uint32_t crc = 0xffffffff;
+    for (lfs_block_t block = 0; block < d->cfg->block_count; block++) {
+        if (!(d->keep[block / 8] & (1U << (block % 8)))) {
+            continue;
+        }
+
+        for (lfs_off_t off = 0; off < d->cfg->block_size;
+                off += SRXE_PAGE_SIZE) {
+            int err = d->cfg->read(d->cfg, block, off,
+                    d->buffer, SRXE_PAGE_SIZE);
+            if (err) {
+                return err;
+            }
+            crc = lfs_crc(crc, d->buffer, SRXE_PAGE_SIZE);
+        }
+    }
+
+    if (crc != base) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    d->state = d->records ? SRXE_DELTA_RECORD : SRXE_DELTA_DONE;
+    return 0;
+}
+
+static int srxe_delta_record(struct srxe_delta *d) {
+    d->block = srxe_delta_le16(&d->buffer[0]);
+    d->pages = srxe_delta_le16(&d->buffer[2]);
+    d->crc = lfs_crc(0xffffffff, d->buffer, SRXE_DELTA_RECORD_SIZE);
+    if (d->block >= d->cfg->block_count
+            || (d->keep[d->block / 8] & (1U << (d->block % 8)))) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    int err = d->cfg->erase(d->cfg, d->block);
+    if (err) {
+        return err;
+    }
+
+    d->page = srxe_delta_nextpage(d->pages, 0);
+    d->state = (d->page < SRXE_DELTA_PAGES)
+            ? SRXE_DELTA_DATA : SRXE_DELTA_CRC;
+    return 0;
+}
+
+static int srxe_delta_data(struct srxe_delta *d) {
+    d->crc = lfs_crc(d->crc, d->buffer, SRXE_PAGE_SIZE);
+    int err = d->cfg->prog(d->cfg, d->block,
+            (lfs_off_t)d->page*SRXE_PAGE_SIZE, d->buffer, SRXE_PAGE_SIZE);
+    if (err) {
+        return err;
+    }
+
+    d->page = srxe_delta_nextpage(d->pages, d->page+1);
+    if (d->page == SRXE_DELTA_PAGES) {
+        d->state = SRXE_DELTA_CRC;
+    }
+    return 0;
+}
+
+static int srxe_delta_crc(struct srxe_delta *d) {
+    if (srxe_delta_le32(d->buffer) != d->crc) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    d->records -= 1;
+    if (d->records == 0) {
+        d->state = SRXE_DELTA_DONE;
+        return d->cfg->sync(d->cfg);
+    }
+
+    d->state = SRXE_DELTA_RECORD;
+    return 0;
+}
+
+void srxe_delta_init(struct srxe_delta *d, const struct lfs_config *cfg,
+        void *buffer) {
+    LFS_ASSERT(SRXE_DELTA_HEADER_SIZE <= SRXE_PAGE_SIZE);
+    LFS_ASSERT(SRXE_DELTA_PAGES <= 16);
+    memset(d, 0, sizeof(*d));
+    d->cfg = cfg;
+    d->buffer = buffer;
+    d->state = SRXE_DELTA_HEADER;
+}
+
+int srxe_delta_feed(struct srxe_delta *d, const void *data, lfs_size_t size) {
+    static const uint16_t sizes[] = {
+        [SRXE_DELTA_HEADER] = SRXE_DELTA_HEADER_SIZE,
+        [SRXE_DELTA_RECORD] = SRXE_DELTA_RECORD_SIZE,
+        [SRXE_DELTA_DATA]   = SRXE_PAGE_SIZE,
+        [SRXE_DELTA_CRC]    = 4,
+    };
+
+    const uint8_t *p = data;
+    while (size > 0) {
+        if (d->state == SRXE_DELTA_ERRED) {
+            return LFS_ERR_INVAL;
+        } else if (d->state == SRXE_DELTA_DONE) {
+            // trailing garbage
+            d->state = SRXE_DELTA_ERRED;
+            return LFS_ERR_INVAL;
+        }
+
+        // gather the next field
+        lfs_size_t diff = lfs_min(size, sizes[d->state] - d->fill);
+        memcpy(&d->buffer[d->fill], p, diff);
+        d->fill += diff;
+        p += diff;
+        size -= diff;
+        if (d->fill < sizes[d->state]) {
+            continue;
+        }
+
+        d->fill = 0;
+        int err;
+        switch (d->state) {
+            case SRXE_DELTA_HEADER: err = srxe_delta_header(d); break;
+            case SRXE_DELTA_RECORD: err = srxe_delta_record(d); break;
+            case SRXE_DELTA_DATA:   err = srxe_delta_data(d); break;
+            default:                err = srxe_delta_crc(d); break;
+        }
+
+        if (err) {
+            d->state = SRXE_DELTA_ERRED;
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+int srxe_delta_finish(struct srxe_delta *d) {
+    return (d->state == SRXE_DELTA_DONE) ? 0 : LFS_ERR_INVAL;
+}
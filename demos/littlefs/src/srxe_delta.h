@@ -0,0 +1,81 @@
+/*
+ * Streaming delta updates for the SRXE's littlefs image
+ *
+ * A delta, made on the host by host/lfsdelta, rewrites only the blocks
+ * that are live in the new image and differ from the old one. The delta
+ * starts with a header naming the blocks it leaves alone and a CRC of
+ * their expected contents, followed by one record per rewritten block:
+ *
+ *     header  magic "SRXD", block_size, page_size, block_count,
+ *             record count, kept block bitmap, CRC of kept blocks, CRC
+ *     record  block, bitmap of pages to program, page data, CRC
+ *
+ * All fields are little-endian. Every record erases its block before
+ * programming it, so records don't depend on what they overwrite and a
+ * delta interrupted by power loss can simply be applied again from the
+ * start. The filesystem must not be mounted while a delta is applied.
+ */
+#ifndef SRXE_DELTA_H
+#define SRXE_DELTA_H
+
+#include "lfs.h"
+#include "srxe_bd.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+#define SRXE_DELTA_MAGIC        0x44585253  // "SRXD"
+#define SRXE_DELTA_KEEP_SIZE    ((SRXE_BLOCK_COUNT+7) / 8)
+#define SRXE_DELTA_HEADER_SIZE  (16 + SRXE_DELTA_KEEP_SIZE + 8)
+#define SRXE_DELTA_RECORD_SIZE  4
+
+// Pages in a block, the page bitmap of a record is 16 bits
+#define SRXE_DELTA_PAGES        (SRXE_BLOCK_SIZE / SRXE_PAGE_SIZE)
+
+// Delta applier state, fed the delta in arbitrarily sized pieces
+struct srxe_delta {
+    const struct lfs_config *cfg;
+    uint8_t *buffer;
+    uint8_t state;
+    uint16_t fill;
+    uint16_t records;
+    uint16_t block;
+    uint16_t pages;
+    uint8_t page;
+    uint32_t crc;
+    uint8_t keep[SRXE_DELTA_KEEP_SIZE];
+};
+
+// Start applying a delta with the block device callbacks in cfg
+//
+// buffer must be SRXE_PAGE_SIZE bytes and stay valid until the delta is
+// finished, the demo's file buffer can be reused while nothing is open.
+void srxe_delta_init(struct srxe_delta *d, const struct lfs_config *cfg,
+        void *buffer);
+
+// Apply the next size bytes of the delta
+//
+// The header is checked against the blocks the delta keeps before
+// anything is erased, so a delta made for a different image is rejected
+// with LFS_ERR_CORRUPT without touching the flash. A record that fails
+// its CRC also returns LFS_ERR_CORRUPT, after its block was already
+// rewritten, apply the whole delta again in that case.
+//
+// Returns a negative error code on failure.
+int srxe_delta_feed(struct srxe_delta *d, const void *data, lfs_size_t size);
+
+// Check that the whole delta was applied
+//
+// Returns LFS_ERR_INVAL if the delta was cut short, or a negative error
+// code on failure.
+int srxe_delta_finish(struct srxe_delta *d);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif